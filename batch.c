@@ -0,0 +1,343 @@
+/* batch.c: Simulation of many independent registers
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "batch.h"
+#include "qureg.h"
+#include "objcode.h"
+#include "context.h"
+#include "matrix.h"
+#include "error.h"
+
+/* Small registers are handed out by a pool of threads. Each thread
+   starts with a contiguous share of the registers and takes them from
+   the front. A thread that has run out of work steals the back half
+   of the remaining registers of another thread. */
+
+struct quantum_batch_worker_struct
+{
+  int lo;                     /* next register of this thread */
+  int hi;                     /* end of the share of this thread */
+  int id;
+  struct quantum_batch_struct *batch;
+  quantum_context *ctx;       /* settings of the calling thread */
+#ifdef HAVE_LIBPTHREAD
+  pthread_t thread;
+  pthread_mutex_t lock;
+#endif
+};
+
+typedef struct quantum_batch_worker_struct quantum_batch_worker;
+
+struct quantum_batch_struct
+{
+  void (*circuit)(int, quantum_reg *, void *);
+  void *arg;
+  quantum_reg *reg;
+  int *task;                  /* numbers of the small registers */
+  int workers;
+  quantum_batch_worker *worker;
+};
+
+typedef struct quantum_batch_struct quantum_batch_job;
+
+/* Number of threads of the pool, 0 for one per OpenMP thread */
+
+static int threads = 0;
+
+/* Set the number of threads used for small registers. Returns the
+   previous setting. */
+
+int
+quantum_batch_threads(int n)
+{
+  int old = threads;
+
+  threads = (n > 0) ? n : 0;
+
+  return old;
+}
+
+/* Number of basis states REG may grow to. For sparse registers, the
+   hash table has been sized for the expected number of states. */
+
+static long
+quantum_batch_size(quantum_reg *reg)
+{
+  long n = reg->size;
+
+  if(reg->hashw > 2 && (1L << (reg->hashw - 2)) > n)
+    n = 1L << (reg->hashw - 2);
+
+  return n;
+}
+
+#ifdef HAVE_LIBPTHREAD
+
+/* Take the next register from the share of W, or steal from another
+   thread. Returns -1 if no work is left. */
+
+static int
+quantum_batch_next(quantum_batch_worker *w)
+{
+  quantum_batch_job *b = w->batch;
+  quantum_batch_worker *v;
+  int i, k, lo, t = -1;
+
+  pthread_mutex_lock(&w->lock);
+
+  if(w->lo < w->hi)
+    t = b->task[w->lo++];
+
+  pthread_mutex_unlock(&w->lock);
+
+  for(i=1; (t < 0) && (i < b->workers); i++)
+    {
+      v = &b->worker[(w->id + i) % b->workers];
+
+      pthread_mutex_lock(&v->lock);
+
+      /* The back half is taken while V is locked, since other threads
+	 may steal from V as well */
+
+      k = (v->hi - v->lo + 1) / 2;
+      v->hi -= k;
+      lo = v->hi;
+
+      pthread_mutex_unlock(&v->lock);
+
+      if(k > 0)
+	{
+	  /* The stolen registers are now the share of W */
+
+	  pthread_mutex_lock(&w->lock);
+	  w->lo = lo;
+	  w->hi = lo + k;
+	  t = b->task[w->lo++];
+	  pthread_mutex_unlock(&w->lock);
+	}
+    }
+
+  return t;
+}
+
+static void *
+quantum_batch_worker_main(void *arg)
+{
+  quantum_batch_worker *w = arg;
+  quantum_batch_job *b = w->batch;
+  int t;
+
+  quantum_set_context(w->ctx);
+
+  /* The threads of the pool already keep all CPUs busy */
+
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+
+  while((t = quantum_batch_next(w)) >= 0)
+    b->circuit(t, &b->reg[t], b->arg);
+
+  quantum_set_context(0);
+
+  return 0;
+}
+
+#endif
+
+/* Run the small registers of B in parallel */
+
+static void
+quantum_batch_pool(quantum_batch_job *b, int n)
+{
+#ifdef HAVE_LIBPTHREAD
+  quantum_context *ctx = quantum_get_context();
+  quantum_batch_worker *w;
+  int i;
+
+  b->worker = calloc(b->workers, sizeof(quantum_batch_worker));
+
+  if(!b->worker)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(b->workers * sizeof(quantum_batch_worker));
+
+  for(i=0; i<b->workers; i++)
+    {
+      w = &b->worker[i];
+      w->id = i;
+      w->batch = b;
+      w->lo = (long) n * i / b->workers;
+      w->hi = (long) n * (i + 1) / b->workers;
+      w->ctx = quantum_clone_context(ctx);
+      pthread_mutex_init(&w->lock, 0);
+    }
+
+  for(i=0; i<b->workers; i++)
+    {
+      w = &b->worker[i];
+
+      if(pthread_create(&w->thread, 0, quantum_batch_worker_main, w))
+	{
+	  /* Run the share of this thread in the calling thread once
+	     the others are done */
+
+	  w->thread = pthread_self();
+	}
+    }
+
+  for(i=0; i<b->workers; i++)
+    {
+      w = &b->worker[i];
+
+      if(pthread_equal(w->thread, pthread_self()))
+	{
+	  quantum_context *old = quantum_set_context(w->ctx);
+	  int t;
+
+	  while((t = quantum_batch_next(w)) >= 0)
+	    b->circuit(t, &b->reg[t], b->arg);
+
+	  quantum_set_context(old);
+	}
+      else
+	pthread_join(w->thread, 0);
+    }
+
+  /* Account the gates and the precision loss of the pool to the
+     calling thread */
+
+  for(i=0; i<b->workers; i++)
+    {
+      w = &b->worker[i];
+      ctx->gate_counter += w->ctx->gate_counter;
+      ctx->loss += w->ctx->loss;
+      pthread_mutex_destroy(&w->lock);
+      quantum_delete_context(w->ctx);
+    }
+
+  free(b->worker);
+  quantum_memman(-b->workers * sizeof(quantum_batch_worker));
+#else
+  int i;
+
+  for(i=0; i<n; i++)
+    b->circuit(b->task[i], &b->reg[b->task[i]], b->arg);
+#endif
+}
+
+/* Apply CIRCUIT to each of the N registers in REG. CIRCUIT is called
+   with the number of the register, the register itself and ARG. Large
+   registers are simulated first, one at a time, small ones then run
+   in parallel. Each parallel simulation runs in its own context with
+   the settings of the calling thread, so CIRCUIT must not share other
+   data between registers without locking. While the calling thread is
+   recording object code, all registers are simulated one after
+   another in its context, so that every gate ends up in the
+   recording. */
+
+void
+quantum_batch(void circuit(int, quantum_reg *, void *), void *arg, int n,
+	      quantum_reg *reg)
+{
+  quantum_batch_job b;
+  int i, small = 0;
+
+  if(n <= 0)
+    return;
+
+  b.circuit = circuit;
+  b.arg = arg;
+  b.reg = reg;
+  b.task = calloc(n, sizeof(int));
+
+  if(!b.task)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(n * sizeof(int));
+
+  for(i=0; i<n; i++)
+    {
+      if(quantum_batch_size(&reg[i]) >= QUANTUM_BATCH_LARGE)
+	circuit(i, &reg[i], arg);
+      else
+	b.task[small++] = i;
+    }
+
+  b.workers = threads;
+
+  if(!b.workers)
+    {
+#ifdef _OPENMP
+      b.workers = omp_get_max_threads();
+#else
+      b.workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+
+  if(b.workers > small)
+    b.workers = small;
+
+  /* The contexts of the pool do not record object code */
+
+  if(quantum_get_context()->recorder.status)
+    b.workers = 1;
+
+  if(b.workers > 1)
+    quantum_batch_pool(&b, small);
+  else
+    {
+      for(i=0; i<small; i++)
+	circuit(b.task[i], &reg[b.task[i]], arg);
+    }
+
+  free(b.task);
+  quantum_memman(-n * sizeof(int));
+}
+
+/* Apply the gates of PROG to each of the N registers in REG */
+
+static void
+quantum_batch_apply(int i, quantum_reg *reg, void *prog)
+{
+  quantum_objcode_apply(prog, reg);
+}
+
+void
+quantum_batch_objcode(quantum_objcode_program *prog, int n, quantum_reg *reg)
+{
+  quantum_batch(quantum_batch_apply, prog, n, reg);
+}
@@ -0,0 +1,43 @@
+/* batch.h: Declarations for batch.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __BATCH_H
+
+#define __BATCH_H
+
+#include "qureg.h"
+#include "objcode.h"
+
+/* Registers with at least this many basis states are simulated one
+   after another, using the threads within each gate. Smaller
+   registers are simulated side by side with one thread each. */
+
+#define QUANTUM_BATCH_LARGE (1 << 16)
+
+extern void quantum_batch(void circuit(int, quantum_reg *, void *),
+			  void *arg, int n, quantum_reg *reg);
+extern void quantum_batch_objcode(quantum_objcode_program *prog, int n,
+				  quantum_reg *reg);
+extern int quantum_batch_threads(int threads);
+
+#endif
@@ -0,0 +1,393 @@
+/* checkpoint.c: Saving and restoring quantum registers
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "checkpoint.h"
+#include "compress.h"
+#include "matrix.h"
+#include "qureg.h"
+#include "precision.h"
+#include "config.h"
+#include "error.h"
+#include "numa.h"
+
+/* Store the lowest 32 bits of N as little-endian bytes */
+
+static void
+quantum_qureg_put32(uint32_t n, unsigned char *buf)
+{
+  int i;
+
+  for(i=0; i<4; i++)
+    buf[i] = n >> (8 * i);
+}
+
+static uint32_t
+quantum_qureg_get32(const unsigned char *buf)
+{
+  return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8)
+    | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+/* Write LEN bytes of DATA to F, compressed if FLAGS contains QUREG_LZ.
+   Returns nonzero on error. */
+
+static int
+quantum_qureg_write(FILE *f, const unsigned char *data, size_t len, 
+		    int flags)
+{
+  size_t raw, n;
+  unsigned char *lz;
+
+  if(!(flags & QUREG_LZ))
+    return fwrite(data, 1, len, f) != len;
+
+  lz = malloc(8 + QUANTUM_LZ_BOUND(QUREG_BLOCK));
+
+  if(!lz)
+    quantum_error(QUANTUM_ENOMEM);
+
+  for(; len; len-=raw, data+=raw)
+    {
+      raw = len < QUREG_BLOCK ? len : QUREG_BLOCK;
+      n = quantum_lz_compress(data, raw, &lz[8]);
+
+      /* Keep incompressible data as it is */
+
+      if(n >= raw)
+	{
+	  n = raw;
+	  memcpy(&lz[8], data, raw);
+	}
+
+      quantum_qureg_put32(raw, lz);
+      quantum_qureg_put32(n, &lz[4]);
+
+      if(fwrite(lz, 1, n + 8, f) != n + 8)
+	break;
+    }
+
+  free(lz);
+
+  return len != 0;
+}
+
+/* Read LEN bytes into DST from the SIZE bytes at DATA, starting at
+   *POS. Returns nonzero if the data is truncated or corrupt. */
+
+static int
+quantum_qureg_read(const unsigned char *data, size_t size, size_t *pos,
+		   unsigned char *dst, size_t len, int flags)
+{
+  size_t raw, n, done;
+
+  if(!(flags & QUREG_LZ))
+    {
+      if(size - *pos < len)
+	return 1;
+
+      memcpy(dst, &data[*pos], len);
+      *pos += len;
+
+      return 0;
+    }
+
+  for(done=0; done<len; done+=raw)
+    {
+      if(size - *pos < 8)
+	return 1;
+
+      raw = quantum_qureg_get32(&data[*pos]);
+      n = quantum_qureg_get32(&data[*pos + 4]);
+
+      if(!raw || (raw > QUREG_BLOCK) || (raw > len - done) || (n > raw) 
+	 || (n > size - *pos - 8))
+	return 1;
+
+      if(n == raw)
+	memcpy(&dst[done], &data[*pos + 8], raw);
+
+      else if(quantum_lz_decompress(&data[*pos + 8], n, &dst[done], raw) 
+	      != raw)
+	return 1;
+
+      *pos += n + 8;
+    }
+
+  return 0;
+}
+
+/* Save the quantum register REG to FILE, compressing the contents if
+   COMPRESS is nonzero. The file is written under a temporary name
+   first, so an existing checkpoint is only replaced by a complete
+   one. Returns 0 on success and -1 on error. */
+
+int
+quantum_save_qureg(quantum_reg *reg, char *file, int compress)
+{
+  FILE *f;
+  char *tmp;
+  int flags = 0, error;
+  uint32_t mark = QUREG_BYTEORDER;
+  unsigned char header[QUREG_HEADER];
+
+  if(compress)
+    flags |= QUREG_LZ;
+
+  /* Checkpoints hold the basis states in the order of the qubits */
+
+  quantum_unmap(reg);
+
+  if(!reg->state)
+    flags |= QUREG_DENSE;
+
+  tmp = malloc(strlen(file) + 5);
+
+  if(!tmp)
+    quantum_error(QUANTUM_ENOMEM);
+
+  sprintf(tmp, "%s.tmp", file);
+
+  f = fopen(tmp, "w");
+
+  if(!f)
+    {
+      fprintf(stderr, "Could not open %s: ", tmp);
+      perror(0);
+      free(tmp);
+      return -1;
+    }
+
+  memset(header, 0, QUREG_HEADER);
+  memcpy(header, QUREG_MAGIC, 4);
+  quantum_qureg_put32(QUREG_VERSION, &header[4]);
+  memcpy(&header[8], &mark, 4);
+  quantum_qureg_put32(flags, &header[12]);
+  quantum_qureg_put32(reg->width, &header[16]);
+  quantum_qureg_put32(reg->hashw, &header[20]);
+  quantum_qureg_put32(reg->size, &header[24]);
+  quantum_qureg_put32(sizeof(MAX_UNSIGNED), &header[32]);
+  quantum_qureg_put32(quantum_amplitude_size(reg), &header[36]);
+
+  error = fwrite(header, 1, QUREG_HEADER, f) != QUREG_HEADER;
+
+  if(!error && reg->state)
+    error = quantum_qureg_write(f, (unsigned char *) reg->state, 
+				reg->size * sizeof(MAX_UNSIGNED), flags);
+
+  if(!error)
+    error = quantum_qureg_write(f, (unsigned char *) reg->amplitude, 
+				reg->size * quantum_amplitude_size(reg), flags);
+
+  if(fclose(f))
+    error = 1;
+
+  if(!error && rename(tmp, file))
+    error = 1;
+
+  if(error)
+    {
+      fprintf(stderr, "Could not write %s: ", file);
+      perror(0);
+      remove(tmp);
+    }
+
+  free(tmp);
+
+  return error ? -1 : 0;
+}
+
+/* Restore a quantum register saved with quantum_save_qureg from FILE
+   into REG. The file is mapped into memory and copied or decompressed
+   directly from the page cache. Returns 0 on success and -1 on
+   error. */
+
+int
+quantum_load_qureg(char *file, quantum_reg *reg)
+{
+  int fd, flags, precision;
+  struct stat st;
+  size_t size, pos, n;
+  uint32_t mark, width, hashw;
+  unsigned char *data;
+  quantum_reg r;
+
+  fd = open(file, O_RDONLY);
+
+  if(fd < 0)
+    {
+      fprintf(stderr, "Could not open %s: ", file);
+      perror(0);
+      return -1;
+    }
+
+  if(fstat(fd, &st))
+    {
+      perror("fstat");
+      close(fd);
+      return -1;
+    }
+
+  size = st.st_size;
+  data = MAP_FAILED;
+
+  if(size >= QUREG_HEADER)
+    data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if(data == MAP_FAILED)
+    {
+      fprintf(stderr, "%s: not a quantum register file\n", file);
+      return -1;
+    }
+
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  memcpy(&mark, &data[8], 4);
+  flags = quantum_qureg_get32(&data[12]);
+  n = quantum_qureg_get32(&data[24]) 
+    | ((uint64_t) quantum_qureg_get32(&data[28]) << 32);
+
+  /* Registers are restored with the precision they were saved with */
+
+  switch(quantum_qureg_get32(&data[36]))
+    {
+    case sizeof(float complex):
+      precision = QUANTUM_SINGLE;
+      break;
+    case sizeof(double complex):
+      precision = QUANTUM_DOUBLE;
+      break;
+    case sizeof(quantum_bfloat16):
+      precision = QUANTUM_BFLOAT16;
+      break;
+    default:
+      precision = -1;
+    }
+
+  width = quantum_qureg_get32(&data[16]);
+  hashw = quantum_qureg_get32(&data[20]);
+
+  /* Dense registers have no hash table, sparse ones need a table
+     larger than the number of basis states */
+
+  if(memcmp(data, QUREG_MAGIC, 4) 
+     || (quantum_qureg_get32(&data[4]) > QUREG_VERSION)
+     || (mark != QUREG_BYTEORDER) || (flags & ~(QUREG_LZ | QUREG_DENSE))
+     || (quantum_qureg_get32(&data[32]) != sizeof(MAX_UNSIGNED))
+     || (precision < 0)
+     || (width > 8 * sizeof(MAX_UNSIGNED))
+     || (hashw >= 8 * sizeof(int) - 2)
+     || ((flags & QUREG_DENSE) ? (hashw != 0) : ((1UL << hashw) <= n))
+     || (n > INT_MAX))
+    {
+      fprintf(stderr, "%s: unsupported quantum register format\n", file);
+      munmap(data, size);
+      return -1;
+    }
+
+  r.width = width;
+  r.hashw = hashw;
+  r.size = n;
+  r.recorder = 0;
+  r.map = 0;
+  r.state = 0;
+  r.hash = 0;
+  r.renormalized = 0;
+
+  r.precision = (precision == QUANTUM_NATIVE_PRECISION) ? 0 : precision;
+
+  if(quantum_memman_exceeds(n * (quantum_amplitude_size(&r)
+				 + (flags & QUREG_DENSE ? 0 
+				    : sizeof(MAX_UNSIGNED)))
+			    + (r.hashw ? (1 << r.hashw) : 0) * sizeof(int)))
+    quantum_error(QUANTUM_EBUDGET);
+
+  /* Allocate the arrays and fill them from the file */
+
+  r.amplitude = quantum_numa_calloc(n, quantum_amplitude_size(&r),
+				    QUANTUM_NUMA_LOCAL);
+
+  if(n && !r.amplitude)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  n * quantum_amplitude_size(&r));
+
+  if(!(flags & QUREG_DENSE))
+    {
+      r.state = quantum_numa_calloc(n, sizeof(MAX_UNSIGNED),
+				    QUANTUM_NUMA_LOCAL);
+
+      if(n && !r.state)
+	quantum_error(QUANTUM_ENOMEM);
+
+      quantum_memman_category(QUANTUM_MEM_STATE, n * sizeof(MAX_UNSIGNED));
+    }
+
+  pos = QUREG_HEADER;
+
+  if((r.state && quantum_qureg_read(data, size, &pos, 
+				    (unsigned char *) r.state,
+				    n * sizeof(MAX_UNSIGNED), flags))
+     || quantum_qureg_read(data, size, &pos, (unsigned char *) r.amplitude,
+			   n * quantum_amplitude_size(&r), flags))
+    {
+      fprintf(stderr, "%s: truncated or corrupt quantum register\n", file);
+      munmap(data, size);
+      quantum_delete_qureg(&r);
+      return -1;
+    }
+
+  munmap(data, size);
+
+  /* The hash table is not saved, but rebuilt from the basis states */
+
+  if(r.hashw)
+    {
+      r.hash = quantum_numa_calloc(1 << r.hashw, sizeof(int),
+				   QUANTUM_NUMA_RANDOM);
+
+      if(!r.hash)
+	quantum_error(QUANTUM_ENOMEM);
+
+      quantum_memman_category(QUANTUM_MEM_HASH, 
+			      (1 << r.hashw) * sizeof(int));
+
+      quantum_reconstruct_hash(&r);
+    }
+
+  *reg = r;
+
+  return 0;
+}
@@ -0,0 +1,68 @@
+/* checkpoint.h: Declarations for checkpoint.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __CHECKPOINT_H
+
+#define __CHECKPOINT_H
+
+#include "qureg.h"
+
+/* Register files start with a header of QUREG_HEADER bytes. The header
+   fields are stored in little-endian byte order:
+
+   offset  size  field
+        0     4  magic "QREG"
+        4     4  format version (QUREG_VERSION)
+        8     4  byte order mark (QUREG_BYTEORDER) in host order
+       12     4  flags (QUREG_LZ, QUREG_DENSE)
+       16     4  width
+       20     4  width of the hash table
+       24     8  number of basis states
+       32     4  sizeof(MAX_UNSIGNED)
+       36     4  size of one amplitude
+       40    24  reserved (0)
+
+   The header is followed by the array of basis states, which is
+   missing for dense registers (QUREG_DENSE), and the array of
+   amplitudes, both in host format. A file can therefore only be loaded
+   on a host with the same byte order and types.
+
+   With QUREG_LZ, each array is split into blocks of at most
+   QUREG_BLOCK bytes, stored like the blocks of compressed object code:
+   original and compressed size as 4-byte integers, followed by the
+   data compressed with quantum_lz_compress, or the plain data if both
+   sizes are equal. */
+
+#define QUREG_MAGIC "QREG"
+#define QUREG_VERSION 1
+#define QUREG_HEADER 64
+#define QUREG_BYTEORDER 0x01020304
+#define QUREG_BLOCK (1 << 20)
+
+#define QUREG_LZ    0x01
+#define QUREG_DENSE 0x02
+
+extern int quantum_save_qureg(quantum_reg *reg, char *file, int compress);
+extern int quantum_load_qureg(char *file, quantum_reg *reg);
+
+#endif
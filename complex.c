@@ -43,14 +43,14 @@ quantum_conj(COMPLEX_FLOAT a)
 /* Calculate the square of a complex number (i.e. the probability) */
 
 double
-quantum_prob(COMPLEX_FLOAT a)
+quantum_prob(complex double a)
 {
   return quantum_prob_inline(a);
 }
 
 /* Calculate e^(i * phi) */
 
-COMPLEX_FLOAT quantum_cexp(REAL_FLOAT phi)
+complex double quantum_cexp(double phi)
 {
   return cos(phi) + IMAGINARY * sin(phi);
 }
@@ -0,0 +1,214 @@
+/* compress.c: Block compression of binary data
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <string.h>
+#include <stdint.h>
+
+#include "compress.h"
+
+/* A simple LZ77 block compressor in the spirit of LZ4. A block is a
+   sequence of tokens. Each token holds the number of literal bytes
+   in its upper and the length of the following match minus
+   LZ_MINMATCH in its lower four bits. A nibble value of 15 is
+   followed by extension bytes which are added to the length until
+   one of them is less than 255. The literals are followed by the
+   offset of the match as a 16-bit little-endian integer. The final
+   token of a block carries literals only. */
+
+#define LZ_MINMATCH 4
+#define LZ_HASHBITS 12
+#define LZ_MAXOFFSET 65535
+
+static inline uint32_t
+quantum_lz_read32(const unsigned char *p)
+{
+  uint32_t n;
+
+  memcpy(&n, p, 4);
+
+  return n;
+}
+
+static inline int
+quantum_lz_hash(uint32_t n)
+{
+  return (n * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+/* Write the extension bytes of a length field */
+
+static inline unsigned char *
+quantum_lz_length(unsigned char *p, int len)
+{
+  for(; len >= 255; len -= 255)
+    *p++ = 255;
+
+  *p++ = len;
+
+  return p;
+}
+
+/* Emit a token with LIT literal bytes from SRC and a match of length
+   MLEN (0 for none) at distance OFFSET */
+
+static unsigned char *
+quantum_lz_token(unsigned char *p, const unsigned char *src, int lit, 
+		 int mlen, int offset)
+{
+  unsigned char *token = p++;
+  int m = mlen ? mlen - LZ_MINMATCH : 0;
+
+  *token = ((lit < 15 ? lit : 15) << 4) | (m < 15 ? m : 15);
+
+  if(lit >= 15)
+    p = quantum_lz_length(p, lit - 15);
+
+  memcpy(p, src, lit);
+  p += lit;
+
+  if(mlen)
+    {
+      *p++ = offset;
+      *p++ = offset >> 8;
+
+      if(m >= 15)
+	p = quantum_lz_length(p, m - 15);
+    }
+
+  return p;
+}
+
+/* Compress N bytes from SRC to DST, which must be able to hold
+   QUANTUM_LZ_BOUND(N) bytes. Returns the size of the compressed
+   data. */
+
+int
+quantum_lz_compress(const unsigned char *src, int n, unsigned char *dst)
+{
+  int i, j, anchor = 0, len;
+  int table[1 << LZ_HASHBITS];
+  uint32_t seq;
+  unsigned char *p = dst;
+
+  for(i=0; i<(1 << LZ_HASHBITS); i++)
+    table[i] = -1;
+
+  i = 0;
+
+  while(i + LZ_MINMATCH <= n)
+    {
+      seq = quantum_lz_read32(&src[i]);
+      j = table[quantum_lz_hash(seq)];
+      table[quantum_lz_hash(seq)] = i;
+
+      if((j < 0) || (i - j > LZ_MAXOFFSET) 
+	 || (quantum_lz_read32(&src[j]) != seq))
+	{
+	  i++;
+	  continue;
+	}
+
+      for(len=LZ_MINMATCH; (i + len < n) && (src[i+len] == src[j+len]); 
+	  len++);
+
+      p = quantum_lz_token(p, &src[anchor], i - anchor, len, i - j);
+
+      /* Index a few positions inside the match to find repetitions
+	 with a shorter period */
+
+      if(i + len + LZ_MINMATCH <= n)
+	{
+	  table[quantum_lz_hash(quantum_lz_read32(&src[i+len-2]))] 
+	    = i + len - 2;
+	}
+
+      i += len;
+      anchor = i;
+    }
+
+  p = quantum_lz_token(p, &src[anchor], n - anchor, 0, 0);
+
+  return p - dst;
+}
+
+/* Decompress N bytes from SRC to DST, which can hold CAP bytes.
+   Returns the size of the decompressed data or -1 if the input is
+   corrupt. */
+
+int
+quantum_lz_decompress(const unsigned char *src, int n, unsigned char *dst,
+		      int cap)
+{
+  const unsigned char *in = src, *end = src + n;
+  int i, lit, mlen, offset, out = 0;
+
+  while(in < end)
+    {
+      lit = *in >> 4;
+      mlen = *in++ & 15;
+
+      if(lit == 15)
+	do
+	  {
+	    if(in >= end)
+	      return -1;
+	    lit += *in;
+	  } while(*in++ == 255);
+
+      if((lit > end - in) || (lit > cap - out))
+	return -1;
+
+      memcpy(&dst[out], in, lit);
+      in += lit;
+      out += lit;
+
+      if(in == end)
+	break;
+
+      if(end - in < 2)
+	return -1;
+
+      offset = in[0] | (in[1] << 8);
+      in += 2;
+
+      if(mlen == 15)
+	do
+	  {
+	    if(in >= end)
+	      return -1;
+	    mlen += *in;
+	  } while(*in++ == 255);
+
+      mlen += LZ_MINMATCH;
+
+      if(!offset || (offset > out) || (mlen > cap - out))
+	return -1;
+
+      /* Matches may overlap their own output */
+
+      for(i=0; i<mlen; i++, out++)
+	dst[out] = dst[out - offset];
+    }
+
+  return out;
+}
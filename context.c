@@ -0,0 +1,132 @@
+/* context.c: Independent simulations within one process
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+
+#include "context.h"
+#include "objcode.h"
+#include "matrix.h"
+#include "error.h"
+
+/* The current context is kept per thread where the compiler supports
+   it. Otherwise all threads share it. */
+
+#if defined(__GNUC__)
+#define QUANTUM_THREAD __thread
+#else
+#define QUANTUM_THREAD
+#endif
+
+/* Initial values of a context */
+
+#define QUANTUM_CONTEXT_INIT { .qec_freq = 1 << 30, \
+      .opformat = OBJCODE_COMPACT | OBJCODE_LZ, .renormalize = 32 }
+
+/* Context of all threads that never called quantum_set_context(),
+   which makes the library behave like before contexts existed */
+
+static quantum_context quantum_default_context = QUANTUM_CONTEXT_INIT;
+
+static QUANTUM_THREAD quantum_context *current = 0;
+
+/* Create a new context with the default settings. Registers used
+   with different contexts can be simulated in different threads at
+   the same time. */
+
+quantum_context *
+quantum_new_context()
+{
+  quantum_context *ctx;
+  quantum_context init = QUANTUM_CONTEXT_INIT;
+
+  ctx = malloc(sizeof(quantum_context));
+
+  if(!ctx)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OTHER, sizeof(quantum_context));
+
+  *ctx = init;
+
+  return ctx;
+}
+
+/* Create a new context with the settings of CTX. Counters, the
+   object code recorder and the accumulated loss are not copied. */
+
+quantum_context *
+quantum_clone_context(quantum_context *ctx)
+{
+  quantum_context *c = quantum_new_context();
+
+  c->status = ctx->status;
+  c->lambda = ctx->lambda;
+  c->qec_type = ctx->qec_type;
+  c->qec_width = ctx->qec_width;
+  c->qec_freq = ctx->qec_freq;
+  c->errfunc = ctx->errfunc;
+  c->opformat = ctx->opformat;
+  c->renormalize = ctx->renormalize;
+
+  return c;
+}
+
+/* Finish the object code recorded in CTX and free it. A thread that
+   still uses CTX returns to the default context. */
+
+void
+quantum_delete_context(quantum_context *ctx)
+{
+  quantum_context *old;
+
+  if(!ctx || ctx == &quantum_default_context)
+    return;
+
+  old = quantum_set_context(ctx);
+  quantum_objcode_stop();
+  quantum_set_context((old == ctx) ? 0 : old);
+
+  free(ctx);
+  quantum_memman_category(QUANTUM_MEM_OTHER, -sizeof(quantum_context));
+}
+
+/* Make CTX the current context of the calling thread, NULL selects
+   the default context. Returns the previous context. */
+
+quantum_context *
+quantum_set_context(quantum_context *ctx)
+{
+  quantum_context *old = quantum_get_context();
+
+  current = ctx;
+
+  return old;
+}
+
+/* Return the current context of the calling thread */
+
+quantum_context *
+quantum_get_context()
+{
+  return current ? current : &quantum_default_context;
+}
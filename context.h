@@ -0,0 +1,68 @@
+/* context.h: Declarations for context.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __CONTEXT_H
+
+#define __CONTEXT_H
+
+#include "objcode.h"
+
+/* State of a simulation that used to be kept in global variables.
+   Each thread works with its current context, which is the default
+   context unless quantum_set_context() has been called. */
+
+struct quantum_context_struct
+{
+  int status;                /* non-zero if decoherence is simulated */
+  float lambda;              /* decoherence parameter */
+  int qec_type;              /* type of the QEC, 0 for none */
+  int qec_width;             /* number of qubits protected by the QEC */
+  int qec_counter;           /* gates since the last error correction */
+  int qec_freq;              /* gates between error corrections */
+  int gate_counter;          /* number of gates applied */
+  void *errfunc;             /* error handler */
+  quantum_objcode_recorder recorder;  /* default object code recorder */
+  int opformat;              /* encoding of the next recording */
+  char *objfile;             /* file set by quantum_objcode_file() */
+  int renormalize;           /* gates between renormalizations */
+  double loss;               /* error caused by bfloat16 amplitudes */
+};
+
+typedef struct quantum_context_struct quantum_context;
+
+/* Apply FUNCTION with the given arguments within the context CTX */
+
+#define quantum_context_operation(ctx, function, ...) \
+do { \
+  quantum_context *quantum_ctx = quantum_set_context(ctx); \
+  function(__VA_ARGS__); \
+  quantum_set_context(quantum_ctx); \
+} while(0)
+
+extern quantum_context *quantum_new_context();
+extern quantum_context *quantum_clone_context(quantum_context *ctx);
+extern void quantum_delete_context(quantum_context *ctx);
+extern quantum_context *quantum_set_context(quantum_context *ctx);
+extern quantum_context *quantum_get_context();
+
+#endif
@@ -27,24 +27,21 @@
 
 #include "measure.h"
 #include "qureg.h"
+#include "precision.h"
 #include "gates.h"
 #include "qcomplex.h"
 #include "error.h"
+#include "context.h"
 
-/* Status of the decoherence simulation. Non-zero means enabled and
-   decoherence effects will be simulated. */
-
-int quantum_status = 0;
-
-/* Decoherence parameter. The higher the value, the greater the
-   decoherence impact. */
-
-float quantum_lambda = 0;
+/* The status of the decoherence simulation and the decoherence
+   parameter are kept in the current context. Non-zero status means
+   that decoherence effects will be simulated. The higher the
+   parameter, the greater the decoherence impact. */
 
 float
 quantum_get_decoherence()
 {
-  return quantum_lambda;
+  return quantum_get_context()->lambda;
 }
 
 /* Initialize the decoherence simulation and set the decoherence
@@ -53,13 +50,15 @@ quantum_get_decoherence()
 void 
 quantum_set_decoherence(float l)
 {
+  quantum_context *ctx = quantum_get_context();
+
   if(l)
     {
-      quantum_status = 1;
-      quantum_lambda = l;
+      ctx->status = 1;
+      ctx->lambda = l;
     }
   else
-    quantum_status = 0;
+    ctx->status = 0;
 }
 
 /* Perform the actual decoherence of a quantum register for a single
@@ -73,12 +72,13 @@ quantum_decohere(quantum_reg *reg)
   float *nrands;
   float angle;
   int i, j;
+  quantum_context *ctx = quantum_get_context();
 
   /* Increase the gate counter */
 
   quantum_gate_counter(1);
 
-  if(quantum_status)
+  if(ctx->status)
     {
       
       nrands = calloc(reg->width, sizeof(float));
@@ -100,7 +100,7 @@ quantum_decohere(quantum_reg *reg)
 
 	  x = u * sqrt(-2 * log(s) / s);
 
-	  x *= sqrt(2 * quantum_lambda);
+	  x *= sqrt(2 * ctx->lambda);
 
 	  nrands[i] = x/2;
 	}
@@ -120,7 +120,8 @@ quantum_decohere(quantum_reg *reg)
 		angle -= nrands[j];
 	    }
 
-	  reg->amplitude[i] *= quantum_cexp(angle);
+	  quantum_set_amplitude(reg, i, quantum_get_amplitude(reg, i)
+				* quantum_cexp(angle));
 	  
 	}
       free(nrands);
@@ -0,0 +1,1171 @@
+/* dense.c: Out-of-core dense state vectors
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "dense.h"
+#include "objcode.h"
+#include "matrix.h"
+#include "qureg.h"
+#include "measure.h"
+#include "qcomplex.h"
+#include "defs.h"
+#include "config.h"
+#include "error.h"
+#include "parallel.h"
+
+/* Maximum number of gates applied in a single pass over the blocks */
+
+#define DENSE_BATCH 4096
+
+/* Number of operations considered when choosing the qubit that has to
+   leave the block */
+
+#define DENSE_LOOKAHEAD 4096
+
+/* Largest hash table of a register converted from a dense state
+   vector that has room for all of its basis states */
+
+#define DENSE_HASHW 26
+
+/* Kinds of gates */
+
+enum {
+  DENSE_DIAG,  /* multiplies each amplitude with a phase */
+  DENSE_PAIR,  /* applies a 2x2 matrix to pairs of amplitudes */
+  DENSE_SWAP   /* exchanges pairs of amplitudes */
+};
+
+/* A gate translated to bit masks of the amplitude index */
+
+struct quantum_dense_gate_struct
+{
+  int kind;
+  MAX_UNSIGNED control;  /* bits that have to be set */
+  MAX_UNSIGNED target;   /* bit distinguishing the amplitudes of a pair,
+			    or selecting the phase of a DENSE_DIAG gate */
+  COMPLEX_FLOAT m[4];
+};
+
+typedef struct quantum_dense_gate_struct quantum_dense_gate;
+
+/* A process working on the slice of the state vector selected by the
+   highest bits of the amplitude index */
+
+struct quantum_dense_worker_struct
+{
+  int rank;                    /* number of the slice */
+  int procs;                   /* number of processes, a power of two */
+  pthread_barrier_t *barrier;  /* shared by all processes */
+};
+
+typedef struct quantum_dense_worker_struct quantum_dense_worker;
+
+/* Width of the blocks, which cannot be larger than the register */
+
+static int
+quantum_dense_blockw(quantum_dense *d)
+{
+  return d->blockw < d->width ? d->blockw : d->width;
+}
+
+/* Map a state vector of WIDTH qubits. The contents of the file are
+   kept as far as they fit. */
+
+static void
+quantum_dense_map(quantum_dense *d, int width)
+{
+  size_t length;
+  long pages;
+
+  length = sizeof(COMPLEX_FLOAT) << width;
+
+  if(d->amplitude)
+    munmap(d->amplitude, d->length);
+
+  d->amplitude = 0;
+
+  if(ftruncate(d->fd, length))
+    {
+      perror("ftruncate");
+      quantum_error(QUANTUM_ENOMEM);
+    }
+
+  d->amplitude = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd,
+		      0);
+
+  if(d->amplitude == MAP_FAILED)
+    {
+      perror("mmap");
+      quantum_error(QUANTUM_ENOMEM);
+    }
+
+  d->length = length;
+  d->width = width;
+
+  /* If the vector does not fit comfortably into memory, tell the
+     kernel which blocks are no longer needed */
+
+  pages = sysconf(_SC_PHYS_PAGES);
+  d->evict = (pages > 0)
+    && (length > (double) pages * sysconf(_SC_PAGESIZE) / 2);
+}
+
+/* Set the state vector to the basis state INITVAL of WIDTH qubits */
+
+static void
+quantum_dense_init(quantum_dense *d, MAX_UNSIGNED initval, int width)
+{
+  int i;
+
+  /* Truncating the file discards the old contents without touching
+     them */
+
+  if(d->amplitude)
+    munmap(d->amplitude, d->length);
+
+  d->amplitude = 0;
+
+  if(ftruncate(d->fd, 0))
+    {
+      perror("ftruncate");
+      quantum_error(QUANTUM_ENOMEM);
+    }
+
+  quantum_dense_map(d, width);
+
+  for(i=0; i<8*sizeof(MAX_UNSIGNED); i++)
+    d->phys[i] = i;
+
+  d->amplitude[initval & (((MAX_UNSIGNED) 1 << width) - 1)] = 1;
+}
+
+/* Create a dense state vector of WIDTH qubits in the basis state
+   INITVAL. It is stored in FILE, or in an anonymous temporary file if
+   FILE is NULL. Returns NULL if the file could not be created. */
+
+quantum_dense *
+quantum_new_dense(MAX_UNSIGNED initval, int width, char *file)
+{
+  quantum_dense *d;
+  char *tmp = 0, *dir;
+
+  d = calloc(1, sizeof(quantum_dense));
+
+  if(!d)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(sizeof(quantum_dense));
+
+  if(file)
+    d->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  else
+    {
+      dir = getenv("TMPDIR");
+
+      if(!dir)
+	dir = "/tmp";
+
+      tmp = malloc(strlen(dir) + 20);
+
+      if(!tmp)
+	quantum_error(QUANTUM_ENOMEM);
+
+      sprintf(tmp, "%s/libquantum-XXXXXX", dir);
+      file = tmp;
+      d->fd = mkstemp(tmp);
+
+      /* The file disappears as soon as it is closed */
+
+      if(d->fd >= 0)
+	unlink(tmp);
+    }
+
+  if(d->fd < 0)
+    {
+      fprintf(stderr, "Could not open %s: ", file);
+      perror(0);
+      free(tmp);
+      free(d);
+      quantum_memman(-sizeof(quantum_dense));
+      return 0;
+    }
+
+  free(tmp);
+
+  d->blockw = QUANTUM_DENSE_BLOCK;
+  quantum_dense_init(d, initval, width);
+
+  return d;
+}
+
+/* Delete a dense state vector */
+
+void
+quantum_delete_dense(quantum_dense *d)
+{
+  if(d->amplitude)
+    munmap(d->amplitude, d->length);
+
+  close(d->fd);
+  free(d);
+  quantum_memman(-sizeof(quantum_dense));
+}
+
+/* Convert the amplitude index I into a basis state */
+
+static MAX_UNSIGNED
+quantum_dense_state(quantum_dense *d, MAX_UNSIGNED i)
+{
+  int q;
+  MAX_UNSIGNED s = 0;
+
+  for(q=0; q<d->width; q++)
+    {
+      if(i & ((MAX_UNSIGNED) 1 << d->phys[q]))
+	s |= (MAX_UNSIGNED) 1 << q;
+    }
+
+  return s;
+}
+
+/* Return the qubit whose two values are mixed by OP, or -1 if OP only
+   changes phases or is no gate */
+
+static int
+quantum_dense_mixes(quantum_objcode_op *op)
+{
+  switch(op->operation)
+    {
+    case TOFFOLI:
+      return op->arg[2];
+    case CNOT:
+      return op->arg[1];
+    case SIGMA_X:
+    case SIGMA_Y:
+    case HADAMARD:
+    case ROT_X:
+    case ROT_Y:
+      return op->arg[0];
+    }
+
+  return -1;
+}
+
+/* Translate OP into bit masks for the current qubit layout, using the
+   same matrices as gates.c. Returns 0 if OP is no gate. */
+
+static int
+quantum_dense_translate(quantum_dense *d, quantum_objcode_op *op, 
+			quantum_dense_gate *g)
+{
+  float gamma = op->d;
+
+#define BIT(q) ((MAX_UNSIGNED) 1 << d->phys[q])
+
+  g->kind = DENSE_DIAG;
+  g->control = 0;
+  g->target = 0;
+  g->m[0] = 1; g->m[1] = 0;
+  g->m[2] = 0; g->m[3] = 1;
+
+  switch(op->operation)
+    {
+    case TOFFOLI:
+      g->control = BIT(op->arg[0]) | BIT(op->arg[1]);
+      g->target = BIT(op->arg[2]);
+      g->kind = DENSE_SWAP;
+      break;
+    case CNOT:
+      g->control = BIT(op->arg[0]);
+      g->target = BIT(op->arg[1]);
+      g->kind = DENSE_SWAP;
+      break;
+    case SIGMA_X:
+      g->target = BIT(op->arg[0]);
+      g->kind = DENSE_SWAP;
+      break;
+    case SIGMA_Y:
+      g->target = BIT(op->arg[0]);
+      g->kind = DENSE_PAIR;
+      g->m[0] = 0;          g->m[1] = -IMAGINARY;
+      g->m[2] = IMAGINARY;  g->m[3] = 0;
+      break;
+    case HADAMARD:
+      g->target = BIT(op->arg[0]);
+      g->kind = DENSE_PAIR;
+      g->m[0] = sqrt(1.0/2);  g->m[1] = sqrt(1.0/2);
+      g->m[2] = sqrt(1.0/2);  g->m[3] = -sqrt(1.0/2);
+      break;
+    case ROT_X:
+      g->target = BIT(op->arg[0]);
+      g->kind = DENSE_PAIR;
+      g->m[0] = cos(gamma / 2);
+      g->m[1] = -IMAGINARY * sin(gamma / 2);
+      g->m[2] = -IMAGINARY * sin(gamma / 2);
+      g->m[3] = cos(gamma / 2);
+      break;
+    case ROT_Y:
+      g->target = BIT(op->arg[0]);
+      g->kind = DENSE_PAIR;
+      g->m[0] = cos(gamma / 2);  g->m[1] = -sin(gamma / 2);
+      g->m[2] = sin(gamma / 2);  g->m[3] = cos(gamma / 2);
+      break;
+
+      /* Diagonal gates multiply with m[1] if the target bit is set and
+	 with m[0] otherwise */
+
+    case SIGMA_Z:
+      g->target = BIT(op->arg[0]);
+      g->m[1] = -1;
+      break;
+    case ROT_Z:
+      g->target = BIT(op->arg[0]);
+      g->m[1] = quantum_cexp(gamma / 2);
+      g->m[0] = 1 / g->m[1];
+      break;
+    case PHASE_SCALE:
+      g->m[0] = quantum_cexp(gamma);
+      g->m[1] = g->m[0];
+      break;
+    case PHASE_KICK:
+      g->target = BIT(op->arg[0]);
+      g->m[1] = quantum_cexp(gamma);
+      break;
+    case COND_PHASE:
+      g->control = BIT(op->arg[0]);
+      g->target = BIT(op->arg[1]);
+      g->m[1] = quantum_cexp(pi / ((MAX_UNSIGNED) 1 
+				   << (op->arg[0] - op->arg[1])));
+      break;
+    case CPHASE_KICK:
+      g->control = BIT(op->arg[0]);
+      g->target = BIT(op->arg[1]);
+      g->m[1] = quantum_cexp(gamma);
+      break;
+    case CPHASE_SHIFT:
+      g->control = BIT(op->arg[0]);
+      g->target = BIT(op->arg[1]);
+      g->m[1] = quantum_cexp(gamma / 2);
+      g->m[0] = 1 / g->m[1];
+      break;
+    default:
+      return 0;
+    }
+
+#undef BIT
+
+  return 1;
+}
+
+/* Apply the gate G to the block A of 2^BLOCKW amplitudes, whose
+   indices start at BASE */
+
+static void
+quantum_dense_apply(quantum_dense_gate *g, COMPLEX_FLOAT *a, 
+		    MAX_UNSIGNED base, int blockw)
+{
+  MAX_UNSIGNED i, i0, i1, n, t, high, low;
+  COMPLEX_FLOAT t0, t1;
+
+  n = (MAX_UNSIGNED) 1 << blockw;
+
+  /* Controls outside the block are the same for all its amplitudes */
+
+  high = g->control & ~(n - 1);
+  low = g->control & (n - 1);
+
+  if((base & high) != high)
+    return;
+
+  if(g->kind == DENSE_DIAG)
+    {
+      if((g->m[0] == 1) && g->target)
+	{
+	  if((base & g->target) == g->target)
+	    t = 0;
+	  else
+	    t = g->target;
+
+	  /* Only the amplitudes with the target bit set change */
+
+	  for(i=0; i<n; i++)
+	    {
+	      if(((i & low) == low) && ((i & t) == t))
+		a[i] *= g->m[1];
+	    }
+	}
+
+      else
+	{
+	  for(i=0; i<n; i++)
+	    {
+	      if((i & low) == low)
+		a[i] *= ((i | base) & g->target) ? g->m[1] : g->m[0];
+	    }
+	}
+
+      return;
+    }
+
+  t = g->target;
+
+  for(i=0; i<n/2; i++)
+    {
+      /* Insert a zero at the target bit */
+
+      i0 = ((i & ~(t - 1)) << 1) | (i & (t - 1));
+      i1 = i0 | t;
+
+      if((i0 & low) != low)
+	continue;
+
+      t0 = a[i0];
+      t1 = a[i1];
+
+      if(g->kind == DENSE_SWAP)
+	{
+	  a[i0] = t1;
+	  a[i1] = t0;
+	}
+      else
+	{
+	  a[i0] = g->m[0] * t0 + g->m[1] * t1;
+	  a[i1] = g->m[2] * t0 + g->m[3] * t1;
+	}
+    }
+}
+
+/* Determine the blocks FIRST to LAST (exclusive) belonging to the
+   process W */
+
+static void
+quantum_dense_range(quantum_dense *d, quantum_dense_worker *w, long *first,
+		    long *last)
+{
+  long per;
+
+  per = (1L << (d->width - quantum_dense_blockw(d))) / w->procs;
+
+  *first = w->rank * per;
+  *last = *first + per;
+}
+
+/* Apply the N gates G to block K */
+
+static void
+quantum_dense_block(quantum_dense *d, quantum_dense_gate *g, int n, long k)
+{
+  int j, b;
+  MAX_UNSIGNED size;
+  COMPLEX_FLOAT *a;
+
+  b = quantum_dense_blockw(d);
+  size = (MAX_UNSIGNED) 1 << b;
+  a = &d->amplitude[k * size];
+
+  for(j=0; j<n; j++)
+    quantum_dense_apply(&g[j], a, (MAX_UNSIGNED) k << b, b);
+
+  if(d->evict)
+    madvise(a, size * sizeof(COMPLEX_FLOAT), MADV_DONTNEED);
+}
+
+/* Apply the N gates G to every block of the process W, paging each
+   block in once */
+
+static void
+quantum_dense_pass(quantum_dense *d, quantum_dense_gate *g, int n,
+		   quantum_dense_worker *w)
+{
+  long k, first, last;
+
+  quantum_dense_range(d, w, &first, &last);
+
+#ifdef _OPENMP
+  if(w->procs == 1)
+    {
+#pragma omp parallel for schedule (dynamic)
+      for(k=first; k<last; k++)
+	quantum_dense_block(d, g, n, k);
+
+      return;
+    }
+#endif
+
+  for(k=first; k<last; k++)
+    quantum_dense_block(d, g, n, k);
+}
+
+/* Exchange the amplitudes with bit PB set in block K0 with those with
+   bit PB cleared in block K1. Only the pairs LO to HI (exclusive) are
+   exchanged. */
+
+static void
+quantum_dense_exchange(quantum_dense *d, long k0, long k1, MAX_UNSIGNED pb,
+		       MAX_UNSIGNED lo, MAX_UNSIGNED hi)
+{
+  MAX_UNSIGNED i, m, size;
+  COMPLEX_FLOAT t, *a0, *a1;
+
+  size = (MAX_UNSIGNED) 1 << quantum_dense_blockw(d);
+  a0 = &d->amplitude[k0 * size];
+  a1 = &d->amplitude[k1 * size];
+
+  for(m=lo; m<hi; m++)
+    {
+      /* Insert a zero at bit PB */
+
+      i = ((m & ~(pb - 1)) << 1) | (m & (pb - 1));
+
+      t = a0[i | pb];
+      a0[i | pb] = a1[i];
+      a1[i] = t;
+    }
+
+  if(d->evict)
+    {
+      madvise(a0, size * sizeof(COMPLEX_FLOAT), MADV_DONTNEED);
+      madvise(a1, size * sizeof(COMPLEX_FLOAT), MADV_DONTNEED);
+    }
+}
+
+/* Exchange the bits P (inside a block) and H (outside) of all
+   amplitude indices */
+
+static void
+quantum_dense_swap(quantum_dense *d, int p, int h, quantum_dense_worker *w)
+{
+  long k, first, last;
+  int q;
+  MAX_UNSIGNED half, hb, pb;
+
+  half = (MAX_UNSIGNED) 1 << (quantum_dense_blockw(d) - 1);
+  hb = (MAX_UNSIGNED) 1 << (h - quantum_dense_blockw(d));
+  pb = (MAX_UNSIGNED) 1 << p;
+
+  quantum_dense_range(d, w, &first, &last);
+
+  if(hb >= last - first)
+    {
+      /* The other block of each pair belongs to a partner process,
+	 and each of them moves half of the amplitudes */
+
+      pthread_barrier_wait(w->barrier);
+
+      for(k=first; k<last; k++)
+	{
+	  if(k & hb)
+	    quantum_dense_exchange(d, k ^ hb, k, pb, half / 2, half);
+	  else
+	    quantum_dense_exchange(d, k, k | hb, pb, 0, half / 2);
+	}
+
+      pthread_barrier_wait(w->barrier);
+    }
+
+  else if(w->procs > 1)
+    {
+      for(k=first; k<last; k++)
+	{
+	  if(!(k & hb))
+	    quantum_dense_exchange(d, k, k | hb, pb, 0, half);
+	}
+    }
+
+  else
+    {
+#ifdef _OPENMP
+#pragma omp parallel for schedule (dynamic)
+#endif
+      for(k=first; k<last; k++)
+	{
+	  if(!(k & hb))
+	    quantum_dense_exchange(d, k, k | hb, pb, 0, half);
+	}
+    }
+
+  for(q=0; q<d->width; q++)
+    {
+      if(d->phys[q] == p)
+	d->phys[q] = h;
+      else if(d->phys[q] == h)
+	d->phys[q] = p;
+    }
+}
+
+/* Choose the bit inside a block whose qubit is needed there again
+   last, looking at the next N instructions */
+
+static int
+quantum_dense_victim(quantum_dense *d, quantum_objcode_insn *insn, int n)
+{
+  int i, q, b, best = -1, left = 0;
+  int next[8 * sizeof(MAX_UNSIGNED)];
+
+  b = quantum_dense_blockw(d);
+
+  for(q=0; q<d->width; q++)
+    {
+      next[q] = INT_MAX;
+
+      if(d->phys[q] < b)
+	left++;
+    }
+
+  for(i=0; (i<n) && (i<DENSE_LOOKAHEAD) && left; i++)
+    {
+      q = quantum_dense_mixes(&insn[i].op);
+
+      if((q >= 0) && (q < d->width) && (d->phys[q] < b) 
+	 && (next[q] == INT_MAX))
+	{
+	  next[q] = i;
+	  left--;
+	}
+    }
+
+  for(q=0; q<d->width; q++)
+    {
+      if((d->phys[q] < b) && ((best < 0) || (next[q] > next[best])))
+	best = q;
+    }
+
+  return d->phys[best];
+}
+
+/* Measure the contents of a dense state vector */
+
+MAX_UNSIGNED
+quantum_dense_measure(quantum_dense *d)
+{
+  MAX_UNSIGNED i, n;
+  double r;
+
+  n = (MAX_UNSIGNED) 1 << d->width;
+  r = quantum_frand();
+
+  for(i=0; i<n; i++)
+    {
+      r -= quantum_prob_inline(d->amplitude[i]);
+
+      if(0 >= r)
+	return quantum_dense_state(d, i);
+    }
+
+  return -1;
+}
+
+/* Determine the result of measuring qubit POS and the probability of
+   this result */
+
+static int
+quantum_dense_collapse(int pos, quantum_dense *d, double *prob)
+{
+  long i, n;
+  double pa = 0, pb = 0;
+  MAX_UNSIGNED bit;
+
+  n = 1L << d->width;
+  bit = (MAX_UNSIGNED) 1 << d->phys[pos];
+
+#ifdef _OPENMP
+#pragma omp parallel for reduction (+:pa, pb) if (quantum_parallel(n))
+#endif
+  for(i=0; i<n; i++)
+    {
+      if(i & bit)
+	pb += quantum_prob_inline(d->amplitude[i]);
+      else
+	pa += quantum_prob_inline(d->amplitude[i]);
+    }
+
+  if(quantum_frand() > pa)
+    {
+      *prob = pb;
+      return 1;
+    }
+
+  *prob = pa;
+  return 0;
+}
+
+/* Measure qubit POS and remove it from the state vector */
+
+int
+quantum_dense_bmeasure(int pos, quantum_dense *d)
+{
+  int q, p, result;
+  double prob;
+  MAX_UNSIGNED i, j, n, bit;
+  COMPLEX_FLOAT f;
+
+  result = quantum_dense_collapse(pos, d, &prob);
+
+  n = (MAX_UNSIGNED) 1 << d->width;
+  p = d->phys[pos];
+  bit = (MAX_UNSIGNED) 1 << p;
+  f = 1 / (float) sqrt(prob);
+
+  /* An amplitude only ever moves to a lower index, so the remaining
+     amplitudes can be moved together in place */
+
+  for(i=0, j=0; i<n; i++)
+    {
+      if(((i & bit) != 0) == result)
+	d->amplitude[j++] = d->amplitude[i] * f;
+    }
+
+  /* The qubits above POS move down by one, and so do their bits */
+
+  for(q=0; q<d->width; q++)
+    {
+      if(d->phys[q] > p)
+	d->phys[q]--;
+    }
+
+  for(q=pos; q<8*sizeof(MAX_UNSIGNED)-1; q++)
+    d->phys[q] = d->phys[q+1];
+
+  for(q=d->width-1; q<8*sizeof(MAX_UNSIGNED); q++)
+    d->phys[q] = q;
+
+  quantum_dense_map(d, d->width - 1);
+
+  return result;
+}
+
+/* Measure qubit POS, but keep it in the state vector */
+
+int
+quantum_dense_bmeasure_bitpreserve(int pos, quantum_dense *d)
+{
+  int result;
+  long i, n;
+  double prob;
+  MAX_UNSIGNED bit;
+  COMPLEX_FLOAT f;
+
+  result = quantum_dense_collapse(pos, d, &prob);
+
+  n = 1L << d->width;
+  bit = (MAX_UNSIGNED) 1 << d->phys[pos];
+  f = 1 / (float) sqrt(prob);
+
+#ifdef _OPENMP
+#pragma omp parallel for if (quantum_parallel(n))
+#endif
+  for(i=0; i<n; i++)
+    {
+      if(((i & bit) != 0) == result)
+	d->amplitude[i] *= f;
+      else
+	d->amplitude[i] = 0;
+    }
+
+  return result;
+}
+
+/* Swap the first WIDTH qubits with the following WIDTH qubits. This
+   only renames the bits. */
+
+static void
+quantum_dense_swapleads(int width, quantum_dense *d)
+{
+  int i, t;
+
+  for(i=0; i<width; i++)
+    {
+      t = d->phys[i];
+      d->phys[i] = d->phys[width+i];
+      d->phys[width+i] = t;
+    }
+}
+
+/* Return the number of qubits used by the operations of PROG */
+
+static int
+quantum_dense_width(quantum_objcode_program *prog)
+{
+  int i, j, width = 0;
+  quantum_objcode_op *op;
+
+  for(i=0; i<prog->num; i++)
+    {
+      op = &prog->insn[i].op;
+
+      switch(op->operation)
+	{
+	case INIT:
+	  if(op->arg[0] > width)
+	    width = op->arg[0];
+	  continue;
+	case SWAPLEADS:
+	  if(2 * op->arg[0] > width)
+	    width = 2 * op->arg[0];
+	  continue;
+	case TOFFOLI:
+	  j = 3;
+	  break;
+	case CNOT:
+	case COND_PHASE:
+	case CPHASE_KICK:
+	case CPHASE_SHIFT:
+	  j = 2;
+	  break;
+	case MEASURE:
+	case NOP:
+	  j = 0;
+	  break;
+	default:
+	  j = 1;
+	}
+
+      while(j--)
+	{
+	  if(op->arg[j] >= width)
+	    width = op->arg[j] + 1;
+	}
+    }
+
+  return width;
+}
+
+/* Apply the gates of PROG starting at instruction I, up to the next
+   operation that is no gate. Gates are collected into batches that
+   only act within the blocks, which are then applied in a single
+   pass. Before a gate mixes the values of a qubit outside the blocks,
+   this qubit is exchanged with the qubit inside that is needed there
+   again last. Returns the number of the first instruction not
+   executed. */
+
+static int
+quantum_dense_segment(quantum_objcode_program *prog, int i, quantum_dense *d,
+		      quantum_dense_gate *g, quantum_dense_worker *w)
+{
+  int j, n, q;
+  quantum_objcode_op *op;
+
+  for(;;)
+    {
+      for(n=0, j=i; (j<prog->num) && (n<DENSE_BATCH); j++)
+	{
+	  op = &prog->insn[j].op;
+
+	  if(op->operation == SWAPLEADS)
+	    {
+	      quantum_dense_swapleads(op->arg[0], d);
+	      continue;
+	    }
+
+	  if(op->operation == NOP)
+	    continue;
+
+	  q = quantum_dense_mixes(op);
+
+	  if((q >= 0) && (d->phys[q] >= quantum_dense_blockw(d)))
+	    {
+	      if(n)
+		break;
+
+	      quantum_dense_swap(d, quantum_dense_victim(d, &prog->insn[j], 
+							 prog->num - j),
+				 d->phys[q], w);
+	    }
+
+	  if(!quantum_dense_translate(d, op, &g[n]))
+	    break;
+
+	  n++;
+	}
+
+      if(!n)
+	return j;
+
+      quantum_dense_pass(d, g, n, w);
+      i = j;
+    }
+}
+
+/* Run a segment of PROCS processes. The other processes are forked
+   and work on the state vector through the shared file mapping. Every
+   process makes the same decisions, so the qubit layout of D is
+   correct afterwards. */
+
+static int
+quantum_dense_spawn(quantum_objcode_program *prog, int i, quantum_dense *d,
+		    quantum_dense_gate *g, int procs, 
+		    pthread_barrier_t *barrier)
+{
+  int j, r, status;
+  pid_t *pid;
+  pthread_barrierattr_t attr;
+  quantum_dense_worker w;
+
+  w.rank = 0;
+  w.procs = procs;
+  w.barrier = barrier;
+
+  if(procs == 1)
+    return quantum_dense_segment(prog, i, d, g, &w);
+
+  pid = malloc(procs * sizeof(pid_t));
+
+  if(!pid)
+    quantum_error(QUANTUM_ENOMEM);
+
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(barrier, &attr, procs);
+  pthread_barrierattr_destroy(&attr);
+
+  fflush(0);
+
+  for(r=1; r<procs; r++)
+    {
+      pid[r] = fork();
+
+      if(!pid[r])
+	{
+	  /* Nothing may be changed before all processes exist */
+
+	  pthread_barrier_wait(barrier);
+
+	  w.rank = r;
+	  quantum_dense_segment(prog, i, d, g, &w);
+	  _exit(0);
+	}
+
+      if(pid[r] < 0)
+	{
+	  perror("fork");
+
+	  /* Stop the processes waiting for the missing ones and continue
+	     on our own */
+
+	  while(--r > 0)
+	    {
+	      kill(pid[r], SIGKILL);
+	      waitpid(pid[r], 0, 0);
+	    }
+
+	  pthread_barrier_destroy(barrier);
+	  free(pid);
+
+	  w.procs = 1;
+	  return quantum_dense_segment(prog, i, d, g, &w);
+	}
+    }
+
+  pthread_barrier_wait(barrier);
+
+  j = quantum_dense_segment(prog, i, d, g, &w);
+
+  for(r=1; r<procs; r++)
+    {
+      waitpid(pid[r], &status, 0);
+
+      if(!WIFEXITED(status) || WEXITSTATUS(status))
+	quantum_error(QUANTUM_FAILURE);
+    }
+
+  pthread_barrier_destroy(barrier);
+  free(pid);
+
+  return j;
+}
+
+/* Execute a loaded program on a dense state vector using PROCS
+   processes, or one per processor if PROCS is 0. Each process works
+   on the slice of the state vector selected by the highest bits of
+   the amplitude index. Gates on qubits inside the slices run
+   independently, while a gate on a qubit selecting the slice makes
+   pairs of processes exchange half of their amplitudes. */
+
+void
+quantum_dense_run_procs(quantum_objcode_program *prog, quantum_dense *d,
+			int procs)
+{
+  int i, j, n, width;
+  quantum_objcode_op *op;
+  quantum_dense_gate *g;
+  pthread_barrier_t *barrier = 0;
+
+  if(procs <= 0)
+    procs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  /* Circuits may use more qubits than they initialize, such as
+     scratch space added later on */
+
+  width = quantum_dense_width(prog);
+
+  if(width > d->width)
+    quantum_dense_map(d, width);
+
+  g = malloc(DENSE_BATCH * sizeof(quantum_dense_gate));
+
+  if(!g)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(DENSE_BATCH * sizeof(quantum_dense_gate));
+
+  if(procs > 1)
+    {
+      barrier = mmap(0, sizeof(pthread_barrier_t), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+      if(barrier == MAP_FAILED)
+	{
+	  perror("mmap");
+	  barrier = 0;
+	  procs = 1;
+	}
+    }
+
+  for(i=0; i<prog->num; )
+    {
+      op = &prog->insn[i].op;
+
+      switch(op->operation)
+	{
+	case INIT:
+	  quantum_dense_init(d, op->mu, op->arg[0] > width ? op->arg[0] 
+			     : width);
+	  i++;
+	  continue;
+	case BMEASURE:
+	  quantum_dense_bmeasure(op->arg[0], d);
+	  i++;
+	  continue;
+	case BMEASURE_P:
+	  quantum_dense_bmeasure_bitpreserve(op->arg[0], d);
+	  i++;
+	  continue;
+	case MEASURE:
+	  quantum_dense_measure(d);
+	  i++;
+	  continue;
+	}
+
+      /* Use as many processes as there are blocks, up to PROCS, and
+	 always a power of two */
+
+      for(n=1; (2*n <= procs) 
+	    && (2*n <= (1L << (d->width - quantum_dense_blockw(d)))); n*=2);
+
+      j = quantum_dense_spawn(prog, i, d, g, n, barrier);
+
+      if(j == i)
+	quantum_error(QUANTUM_EOPCODE);
+
+      i = j;
+    }
+
+  if(barrier)
+    munmap(barrier, sizeof(pthread_barrier_t));
+
+  free(g);
+  quantum_memman(-DENSE_BATCH * sizeof(quantum_dense_gate));
+}
+
+/* Execute a loaded program on a dense state vector */
+
+void
+quantum_dense_run(quantum_objcode_program *prog, quantum_dense *d)
+{
+  quantum_dense_run_procs(prog, d, 1);
+}
+
+/* Convert a dense state vector into a sparse quantum register holding
+   its nonzero amplitudes */
+
+quantum_reg
+quantum_dense2qureg(quantum_dense *d)
+{
+  int j, hashw;
+  MAX_UNSIGNED i, n, size = 0;
+  quantum_reg reg;
+
+  n = (MAX_UNSIGNED) 1 << d->width;
+
+  for(i=0; i<n; i++)
+    {
+      if(d->amplitude[i])
+	size++;
+    }
+
+  /* Like that of a new register, the hash table has room for all
+     basis states. Beyond DENSE_HASHW, it is sized for four times the
+     states present instead, as far as its int entries allow. */
+
+  hashw = d->width + 2;
+
+  if(hashw > DENSE_HASHW)
+    {
+      for(hashw=2; (hashw < 8 * sizeof(int) - 2) 
+	    && (((MAX_UNSIGNED) 1 << hashw) < 4 * size); hashw++);
+    }
+
+  if((size > INT_MAX) || (((MAX_UNSIGNED) 1 << hashw) <= size))
+    quantum_error(QUANTUM_EHASHFULL);
+
+  reg = quantum_new_qureg_sparse(size, d->width);
+
+  for(i=0, j=0; i<n; i++)
+    {
+      if(d->amplitude[i])
+	{
+	  reg.state[j] = quantum_dense_state(d, i);
+	  reg.amplitude[j] = d->amplitude[i];
+	  j++;
+	}
+    }
+
+  /* Give the register a hash table, so that gates can be applied */
+
+  reg.hashw = hashw;
+  reg.hash = calloc((size_t) 1 << reg.hashw, sizeof(int));
+
+  if(!reg.hash)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_HASH, 
+			  ((size_t) 1 << reg.hashw) * sizeof(int));
+
+  quantum_reconstruct_hash(&reg);
+
+  return reg;
+}
@@ -0,0 +1,68 @@
+/* dense.h: Declarations for dense.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __DENSE_H
+
+#define __DENSE_H
+
+#include <stddef.h>
+
+#include "config.h"
+#include "qureg.h"
+#include "objcode.h"
+
+/* By default, a block holds 2^QUANTUM_DENSE_BLOCK amplitudes */
+
+#define QUANTUM_DENSE_BLOCK 18
+
+/* A dense state vector of 2^WIDTH amplitudes, kept in a memory-mapped
+   file. The gates are applied to one block of 2^BLOCKW amplitudes at a
+   time. Qubit Q is stored at bit PHYS[Q] of the amplitude index, so
+   that qubits can be moved into the block without renaming them. */
+
+struct quantum_dense_struct
+{
+  int width;
+  int blockw;
+  int phys[8 * sizeof(MAX_UNSIGNED)];
+  COMPLEX_FLOAT *amplitude;
+  size_t length;    /* size of the mapping in bytes */
+  int fd;
+  int evict;        /* drop blocks from memory after each pass */
+};
+
+typedef struct quantum_dense_struct quantum_dense;
+
+extern quantum_dense *quantum_new_dense(MAX_UNSIGNED initval, int width, 
+					char *file);
+extern void quantum_delete_dense(quantum_dense *d);
+extern void quantum_dense_run(quantum_objcode_program *prog, 
+			      quantum_dense *d);
+extern void quantum_dense_run_procs(quantum_objcode_program *prog,
+				    quantum_dense *d, int procs);
+extern MAX_UNSIGNED quantum_dense_measure(quantum_dense *d);
+extern int quantum_dense_bmeasure(int pos, quantum_dense *d);
+extern int quantum_dense_bmeasure_bitpreserve(int pos, quantum_dense *d);
+extern quantum_reg quantum_dense2qureg(quantum_dense *d);
+
+#endif
@@ -23,13 +23,16 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "density.h"
 #include "qureg.h"
+#include "precision.h"
 #include "config.h"
 #include "matrix.h"
 #include "qcomplex.h"
 #include "error.h"
+#include "parallel.h"
 
 /* Build a new density operator from multiple state vectors */
 
@@ -57,6 +60,12 @@ quantum_new_density_op(int num, float *prob, quantum_reg *reg)
 
   /* Take the hash table from the first quantum register */
 
+  /* The state vectors are compared bit by bit, so the qubits have to
+     be in their own bits */
+
+  for(i=0; i<num; i++)
+    quantum_unmap(&reg[i]);
+
   rho.prob[0] = prob[0];
   phash = reg[0].hash;
   hashw = reg[0].hashw;
@@ -69,6 +78,7 @@ quantum_new_density_op(int num, float *prob, quantum_reg *reg)
   reg[0].state = 0;
   reg[0].amplitude = 0;
   reg[0].hash = 0;
+  reg[0].map = 0;
 
   for(i=1; i<num; i++)
     {
@@ -82,6 +92,7 @@ quantum_new_density_op(int num, float *prob, quantum_reg *reg)
       reg[i].state = 0;
       reg[i].amplitude = 0;
       reg[i].hash = 0;
+      reg[i].map = 0;
     }
 
   return rho;
@@ -105,7 +116,7 @@ quantum_qureg2density_op(quantum_reg *reg)
 void
 quantum_reduced_density_op(int pos, quantum_density_op *rho)
 {
-  int i, j;
+  int i;
   double p0=0, ptmp;
   MAX_UNSIGNED pos2;
   quantum_reg rtmp;
@@ -128,16 +139,11 @@ quantum_reduced_density_op(int pos, quantum_density_op *rho)
     {
       ptmp = rho->prob[i];
       rtmp = rho->reg[i];
-      p0 = 0;
 
       /* Sum up the probability for 0 being the result for this state
 	 vector */
   
-      for(j=0; j<rho->reg[i].size; j++)
-	{
-	  if(!(rho->reg[i].state[j] & pos2))
-	    p0 += quantum_prob_inline(rho->reg[i].amplitude[j]);
-	}
+      p0 = quantum_kernel_probsum(&rho->reg[i], pos2, 0);
 
       rho->prob[i] = ptmp * p0;
       rho->prob[rho->num + i] = ptmp * (1-p0);
@@ -178,8 +184,9 @@ quantum_density_matrix(quantum_density_op *rho)
 	      l1 = quantum_get_state(i, rho->reg[k]);
 	      l2 = quantum_get_state(j, rho->reg[k]);
 	      if((l1 > -1) && (l2 > -1))
-		M(m, i, j) += rho->prob[k] * rho->reg[k].amplitude[l2]
-		  * quantum_conj(rho->reg[k].amplitude[l1]);
+		M(m, i, j) += rho->prob[k]
+		  * quantum_get_amplitude(&rho->reg[k], l2)
+		  * quantum_conj(quantum_get_amplitude(&rho->reg[k], l1));
 	    }
 	}
     }
@@ -223,19 +230,20 @@ quantum_delete_density_op(quantum_density_op *rho)
 
 }
 
-/* Compute the purity of a density operator */
+/* Compute the purity of a density operator. The sums over the basis
+   states are compensated like those of quantum_kernel_probsum(). */
 
 float
 quantum_purity(quantum_density_op *rho)
 {
-  int i, j , k, l;
-  float f = 0;
-  COMPLEX_FLOAT g, dp;
+  int i, j, t, n = quantum_threads();
+  quantum_sum f = {0, 0}, s, part[n];
+  complex double dp;
   
   /* Diagonal elements */
 
   for(i=0; i<rho->num; i++)
-    f += rho->prob[i]*rho->prob[i];
+    quantum_sum_add(&f, rho->prob[i]*rho->prob[i]);
 
   for(i=0; i<rho->num; i++)
     {
@@ -243,28 +251,52 @@ quantum_purity(quantum_density_op *rho)
 	{
 	  dp = quantum_dot_product(&rho->reg[i], &rho->reg[j]);
 
-	  for(k=0; k<rho->reg[i].size; k++)
-	    {
-	      /* quantum_dot_product makes sure that rho->reg[j] has a
-		 correct hash table */
+	  memset(part, 0, sizeof(part));
+
+#ifdef _OPENMP
+#pragma omp parallel private (t) if (quantum_parallel(rho->reg[i].size))
+#endif
+	  {
+	    long k, lo, hi;
+	    int l;
+	    complex double g;
+	    quantum_sum q = {0, 0};
 
-	      l = quantum_get_state(rho->reg[i].state[k], rho->reg[j]);
+	    t = quantum_thread_range(rho->reg[i].size, &lo, &hi);
 
-	      /* Compute p_i p_j <k|\psi_iX\psi_i|\psi_jX\psi_j|k> */
+	    for(k=lo; k<hi; k++)
+	      {
+		/* quantum_dot_product makes sure that rho->reg[j] has a
+		   correct hash table */
+
+		l = quantum_get_state(rho->reg[i].state[k], rho->reg[j]);
+
+		/* Compute p_i p_j <k|\psi_iX\psi_i|\psi_jX\psi_j|k> */
 	      
-	      if(l > -1)
-		g = rho->prob[i] * rho->prob[j] * dp 
-		  * rho->reg[i].amplitude[k]
-		  * quantum_conj(rho->reg[j].amplitude[l]);
-	      else
-		g = 0;
+		if(l > -1)
+		  {
+		    g = rho->prob[i] * rho->prob[j] * dp 
+		      * quantum_get_amplitude(&rho->reg[i], k)
+		      * quantum_conj(quantum_get_amplitude(&rho->reg[j], l));
 
-	      f += 2 * quantum_real(g);
+		    quantum_sum_add(&q, quantum_real(g));
+		  }
+	      }
 
-	    }
+	    part[t] = q;
+	  }
+
+	  /* The parts are added in the order of the threads */
+
+	  s = (quantum_sum) {0, 0};
+
+	  for(t=0; t<n; t++)
+	    quantum_sum_add(&s, quantum_sum_get(&part[t]));
+
+	  quantum_sum_add(&f, 2 * quantum_sum_get(&s));
 	}
     }
 
-  return f;
+  return quantum_sum_get(&f);
 
 }
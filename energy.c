@@ -30,6 +30,7 @@
 #include "qureg.h"
 #include "qtime.h"
 #include "qcomplex.h"
+#include "precision.h"
 
 extern void dstevd_(char *jobz, int *n, double *d, double *e, double *z, 
 		    int *ldz, double *work, int *lwork, int *iwork, int *liwork,
@@ -47,7 +48,7 @@ quantum_lanczos_modified(quantum_reg H(MAX_UNSIGNED, double), double epsilon,
   double E0=DBL_MAX, Eold=DBL_MAX, E1, E2, t;
   quantum_reg tmp, tmp2;
   int i;
-  COMPLEX_FLOAT h01;
+  complex double h01;
   double h00, h11;
 
   for(i=0; i<reg->size; i++)
@@ -119,6 +120,7 @@ quantum_lanczos(quantum_reg H(MAX_UNSIGNED, double), double epsilon,
   int n, i, j;
   char jobz = 'V';
   int lwork, *iwork, liwork, info;
+  complex double z;
 
   phi = calloc(2, sizeof(quantum_reg));
   a = calloc(2, sizeof(double));
@@ -235,9 +237,10 @@ quantum_lanczos(quantum_reg H(MAX_UNSIGNED, double), double epsilon,
 
   for(i=0; i<reg->size; i++)
     {
-      reg->amplitude[i] = 0;
+      z = 0;
       for(j=0; j<n; j++)
-	reg->amplitude[i] += eig[j]*phi[j].amplitude[i];
+	z += eig[j] * quantum_get_amplitude(&phi[j], i);
+      quantum_set_amplitude(reg, i, z);
     }
 
   quantum_delete_qureg(&tmp);
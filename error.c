@@ -25,16 +25,17 @@
 #include <stdio.h>
 
 #include "error.h"
+#include "context.h"
 
 void *
 quantum_error_handler(void *f(int))
 {
-  static void *errfunc = 0;
+  quantum_context *ctx = quantum_get_context();
   
   if(f)
-    errfunc = f;
+    ctx->errfunc = f;
 
-  return errfunc;
+  return ctx->errfunc;
 }
 
 const char *
@@ -58,6 +59,12 @@ quantum_strerr(int errno)
       return "matrix not Hermitian";
     case QUANTUM_ENOCONVERGE:
       return "method failed to converge";
+    case QUANTUM_EBUDGET:
+      return "memory budget exceeded";
+    case QUANTUM_EQUBITMAP:
+      return "invalid qubit mapping";
+    case QUANTUM_EPRECISION:
+      return "unsupported precision";
     case QUANTUM_ENOLAPACK:
       return "LAPACK support not compiled in";
     case QUANTUM_ELAPACKARG:
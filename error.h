@@ -35,6 +35,9 @@ enum {
   QUANTUM_EHERMITIAN   = 6, 
   QUANTUM_ENOCONVERGE  = 7,
   QUANTUM_ENOSOLVER    = 8,
+  QUANTUM_EBUDGET      = 9,
+  QUANTUM_EQUBITMAP    = 10,
+  QUANTUM_EPRECISION   = 11,
   QUANTUM_ENOLAPACK    = 32768, /* LAPACK errors start at 32768 */
   QUANTUM_ELAPACKARG   = 32769,
   QUANTUM_ELAPACKCONV  = 32770,
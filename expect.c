@@ -0,0 +1,287 @@
+/* expect.c: Expectation values of Pauli operators
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+
+#include "expect.h"
+#include "qureg.h"
+#include "precision.h"
+#include "qcomplex.h"
+#include "config.h"
+#include "error.h"
+#include "parallel.h"
+
+/* A Pauli string is given by two bitmasks. Bits set in XMASK carry a
+   sigma_x, bits set in ZMASK a sigma_z and bits set in both a
+   sigma_y. Using sigma_y = i sigma_x sigma_z, the operator acts on a
+   basis state as
+
+   P|s> = i^ny (-1)^|s & zmask| |s ^ xmask>
+
+   where ny is the number of sigma_y factors. */
+
+/* Return the parity of the bits set in A */
+
+static inline int
+quantum_parity(MAX_UNSIGNED a)
+{
+  a ^= a >> 32;
+  a ^= a >> 16;
+  a ^= a >> 8;
+  a ^= a >> 4;
+  a ^= a >> 2;
+  a ^= a >> 1;
+
+  return a & 1;
+}
+
+/* Multiply the sum RE + i IM by i^ny, where ny is the number of
+   sigma_y factors, and return the (real) expectation value */
+
+static inline double
+quantum_pauli_phase(double re, double im, MAX_UNSIGNED xmask,
+		    MAX_UNSIGNED zmask)
+{
+  int ny;
+  MAX_UNSIGNED y = xmask & zmask;
+
+  for(ny=0; y; ny++)
+    y &= y - 1;
+
+  switch(ny % 4)
+    {
+    case 0: return re;
+    case 1: return -im;
+    case 2: return -re;
+    default: return im;
+    }
+}
+
+/* Compute the expectation value <psi|P|psi> of the Pauli string given
+   by XMASK and ZMASK. The register is not modified apart from its
+   hash table. */
+
+double
+quantum_expect_pauli(quantum_reg *reg, MAX_UNSIGNED xmask,
+		     MAX_UNSIGNED zmask)
+{
+  int i, j;
+  double re = 0, im = 0;
+  MAX_UNSIGNED a;
+  complex double z;
+
+  /* The phase only depends on the overlap of the masks, so it does not
+     matter which bits hold the qubits */
+
+  xmask = quantum_map_state(xmask, reg);
+  zmask = quantum_map_state(zmask, reg);
+
+  /* Diagonal strings need no partner states at all */
+
+  if(!xmask)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for private (a) reduction (+:re) \
+  if (quantum_parallel(reg->size))
+#endif
+      for(i=0; i<reg->size; i++)
+	{
+	  a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+
+	  if(quantum_parity(a & zmask))
+	    re -= quantum_prob_inline(quantum_get_amplitude(reg, i));
+	  else
+	    re += quantum_prob_inline(quantum_get_amplitude(reg, i));
+	}
+
+      return re;
+    }
+
+  if(reg->hashw)
+    quantum_reconstruct_hash(reg);
+
+#ifdef _OPENMP
+#pragma omp parallel for private (a, j, z) reduction (+:re, im) \
+  if (quantum_parallel(reg->size))
+#endif
+  for(i=0; i<reg->size; i++)
+    {
+      a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+
+      j = quantum_get_state(a ^ xmask, *reg);
+
+      if((j < 0) || (j >= reg->size)) /* partner state does not exist */
+	continue;
+
+      z = quantum_conj(quantum_get_amplitude(reg, j))
+	* quantum_get_amplitude(reg, i);
+
+      if(quantum_parity(a & zmask))
+	z = -z;
+
+      re += quantum_real(z);
+      im += quantum_imag(z);
+    }
+
+  return quantum_pauli_phase(re, im, xmask, zmask);
+}
+
+/* Compute the expectation values of N Pauli strings in a single sweep
+   over the register. Strings sharing the same XMASK also share the
+   hash lookup of the partner state, and only the strings of a group
+   are visited for it. The results are stored in RESULT. */
+
+void
+quantum_expect_pauli_batch(quantum_reg *reg, int n, MAX_UNSIGNED *xmask,
+			   MAX_UNSIGNED *zmask, double *result)
+{
+  int i, j, k, l, m, groups=0;
+  MAX_UNSIGNED a;
+  int *group, *first, *term;
+  MAX_UNSIGNED *xunique, *zbits;
+  double *sum;
+
+  if(n <= 0)
+    return;
+
+  /* Map each term to a group of terms with identical XMASK */
+
+  group = calloc(n, sizeof(int));
+  first = calloc(n + 1, sizeof(int));
+  term = calloc(n, sizeof(int));
+  xunique = calloc(n, sizeof(MAX_UNSIGNED));
+  zbits = calloc(n, sizeof(MAX_UNSIGNED));
+  sum = calloc(2*n, sizeof(double));
+
+  if(!(group && first && term && xunique && zbits && sum))
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman((3 * n + 1) * sizeof(int) + n * (2 * sizeof(MAX_UNSIGNED)
+						  + 2 * sizeof(double)));
+
+  for(k=0; k<n; k++)
+    {
+      a = quantum_map_state(xmask[k], reg);
+      zbits[k] = quantum_map_state(zmask[k], reg);
+
+      for(l=0; (l < groups) && (xunique[l] != a); l++);
+
+      if(l == groups)
+	xunique[groups++] = a;
+
+      group[k] = l;
+      first[l+1]++;
+    }
+
+  /* The terms of group L are TERM[FIRST[L]] to TERM[FIRST[L+1]-1] */
+
+  for(l=0; l<groups; l++)
+    first[l+1] += first[l];
+
+  for(k=0; k<n; k++)
+    term[first[group[k]]++] = k;
+
+  for(l=groups; l>0; l--)
+    first[l] = first[l-1];
+
+  first[0] = 0;
+
+  if(reg->hashw)
+    quantum_reconstruct_hash(reg);
+
+#ifdef _OPENMP
+#pragma omp parallel private (i, j, k, l, m) \
+  if (quantum_parallel((long) reg->size * n))
+#endif
+  {
+    double *part;
+    MAX_UNSIGNED a;
+    complex double z;
+
+    part = calloc(2*n, sizeof(double));
+
+    if(!part)
+      quantum_error(QUANTUM_ENOMEM);
+
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for(i=0; i<reg->size; i++)
+      {
+	a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+
+	for(l=0; l<groups; l++)
+	  {
+	    if(xunique[l])
+	      {
+		j = quantum_get_state(a ^ xunique[l], *reg);
+
+		if((j < 0) || (j >= reg->size))
+		  continue;
+
+		z = quantum_conj(quantum_get_amplitude(reg, j))
+		  * quantum_get_amplitude(reg, i);
+	      }
+	    else
+	      z = quantum_prob_inline(quantum_get_amplitude(reg, i));
+
+	    for(m=first[l]; m<first[l+1]; m++)
+	      {
+		k = term[m];
+
+		if(quantum_parity(a & zbits[k]))
+		  {
+		    part[2*k] -= quantum_real(z);
+		    part[2*k+1] -= quantum_imag(z);
+		  }
+		else
+		  {
+		    part[2*k] += quantum_real(z);
+		    part[2*k+1] += quantum_imag(z);
+		  }
+	      }
+	  }
+      }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    for(k=0; k<2*n; k++)
+      sum[k] += part[k];
+
+    free(part);
+  }
+
+  for(k=0; k<n; k++)
+    result[k] = quantum_pauli_phase(sum[2*k], sum[2*k+1], xmask[k], zmask[k]);
+
+  free(group);
+  free(first);
+  free(term);
+  free(xunique);
+  free(zbits);
+  free(sum);
+
+  quantum_memman(-(3 * n + 1) * sizeof(int) 
+		 - n * (2 * sizeof(MAX_UNSIGNED) + 2 * sizeof(double)));
+}
@@ -0,0 +1,37 @@
+/* expect.h: Declarations for expect.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __EXPECT_H
+
+#define __EXPECT_H
+
+#include "config.h"
+#include "qureg.h"
+
+extern double quantum_expect_pauli(quantum_reg *reg, MAX_UNSIGNED xmask,
+				   MAX_UNSIGNED zmask);
+extern void quantum_expect_pauli_batch(quantum_reg *reg, int n,
+				       MAX_UNSIGNED *xmask,
+				       MAX_UNSIGNED *zmask, double *result);
+
+#endif
@@ -29,14 +29,18 @@
 #include "gates.h"
 #include "omuln.h"
 #include "qureg.h"
+#include "pool.h"
 
 void 
 quantum_exp_mod_n(int N, int x, int width_input, int width, quantum_reg *reg)
 {
 	
-	int i, j, f;
-	
+	int i, j, f, pool;
 	
+	/* All gates are permutations, so the pool can work through
+	   them without waiting in between */
+
+	pool = quantum_pool_begin(reg);
 
 	quantum_sigma_x(2*width+2, reg);
 	for (i=1; i<=width_input;i++){
@@ -48,4 +52,7 @@ quantum_exp_mod_n(int N, int x, int width_input, int width, quantum_reg *reg)
 		  }
 		mul_mod_n(N,f,3*width+1+i, width, reg);
 		}
+
+	if(pool)
+	  quantum_pool_end(reg);
 	}
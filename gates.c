@@ -30,16 +30,25 @@
 #include "defs.h"
 #include "qcomplex.h"
 #include "qureg.h"
+#include "gates.h"
 #include "decoherence.h"
 #include "qec.h"
 #include "objcode.h"
+#include "profile.h"
+#include "trace.h"
 #include "error.h"
+#include "numa.h"
+#include "precision.h"
+#include "context.h"
+#include "parallel.h"
+#include "pool.h"
 
 /* Apply a controlled-not gate */
 
 void
 quantum_cnot(int control, int target, quantum_reg *reg)
 {
+  quantum_profile_timer prof;
   int i;
   int qec;
 
@@ -49,20 +58,31 @@ quantum_cnot(int control, int target, quantum_reg *reg)
     quantum_cnot_ft(control, target, reg);
   else
     {
-      if(quantum_objcode_put(CNOT, control, target))
+      if(quantum_objcode_put(CNOT, reg, control, target))
 	return;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-      for(i=0; i<reg->size; i++)
+      quantum_profile_enter(&prof, reg);
+
+      control = quantum_qubit(control, reg);
+      target = quantum_qubit(target, reg);
+
+      if(!quantum_pool_permute(reg, (MAX_UNSIGNED) 1 << control,
+			       (MAX_UNSIGNED) 1 << target))
 	{
-	  /* Flip the target bit of a basis state if the control bit is set */
-      
-	  if((reg->state[i] & ((MAX_UNSIGNED) 1 << control)))
-	    reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+#ifdef _OPENMP
+#pragma omp parallel for if (quantum_parallel(reg->size))
+#endif
+	  for(i=0; i<reg->size; i++)
+	    {
+	      /* Flip the target bit of a basis state if the control bit
+		 is set */
+
+	      if((reg->state[i] & ((MAX_UNSIGNED) 1 << control)))
+		reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+	    }
 	}
       quantum_decohere(reg);
+      quantum_profile_leave(&prof, CNOT, reg);
     }
 }
 
@@ -71,6 +91,7 @@ quantum_cnot(int control, int target, quantum_reg *reg)
 void
 quantum_toffoli(int control1, int control2, int target, quantum_reg *reg)
 {
+  quantum_profile_timer prof;
   int i;
   int qec;
 
@@ -80,26 +101,38 @@ quantum_toffoli(int control1, int control2, int target, quantum_reg *reg)
     quantum_toffoli_ft(control1, control2, target, reg);
   else
     {
-      if(quantum_objcode_put(TOFFOLI, control1, control2, target))
+      if(quantum_objcode_put(TOFFOLI, reg, control1, control2, target))
 	return;
 
+      quantum_profile_enter(&prof, reg);
+
+      control1 = quantum_qubit(control1, reg);
+      control2 = quantum_qubit(control2, reg);
+      target = quantum_qubit(target, reg);
+
+      if(!quantum_pool_permute(reg, ((MAX_UNSIGNED) 1 << control1)
+			       | ((MAX_UNSIGNED) 1 << control2),
+			       (MAX_UNSIGNED) 1 << target))
+	{
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp parallel for if (quantum_parallel(reg->size))
 #endif
-      for(i=0; i<reg->size; i++)
-	{
-	  /* Flip the target bit of a basis state if both control bits are
-	     set */
-
-	  if(reg->state[i] & ((MAX_UNSIGNED) 1 << control1))
+	  for(i=0; i<reg->size; i++)
 	    {
-	      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control2))
+	      /* Flip the target bit of a basis state if both control
+		 bits are set */
+
+	      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control1))
 		{
-		  reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+		  if(reg->state[i] & ((MAX_UNSIGNED) 1 << control2))
+		    {
+		      reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+		    }
 		}
 	    }
 	}
       quantum_decohere(reg);
+      quantum_profile_leave(&prof, TOFFOLI, reg);
     }
 }
 
@@ -115,6 +148,7 @@ quantum_unbounded_toffoli(int controlling, quantum_reg *reg, ...)
   int target;
   int *controls;
   int i, j;
+  MAX_UNSIGNED cmask = 0;
 
   controls = malloc(controlling * sizeof(int));
 
@@ -132,16 +166,27 @@ quantum_unbounded_toffoli(int controlling, quantum_reg *reg, ...)
 
   va_end(bits);
 
-#ifdef _OPENMP
-#pragma omp parallel for private (j)
-#endif      
-  for(i=0; i<reg->size; i++)
+  for(i=0; i<controlling; i++)
     {
-      for(j=0; (j < controlling) && 
-	    (reg->state[i] & (MAX_UNSIGNED) 1 << controls[j]); j++);
-      
-      if(j == controlling) /* all control bits are set */
-	reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+      controls[i] = quantum_qubit(controls[i], reg);
+      cmask |= (MAX_UNSIGNED) 1 << controls[i];
+    }
+
+  target = quantum_qubit(target, reg);
+
+  if(!quantum_pool_permute(reg, cmask, (MAX_UNSIGNED) 1 << target))
+    {
+#ifdef _OPENMP
+#pragma omp parallel for private (j) if (quantum_parallel(reg->size))
+#endif
+      for(i=0; i<reg->size; i++)
+	{
+	  for(j=0; (j < controlling) &&
+		(reg->state[i] & (MAX_UNSIGNED) 1 << controls[j]); j++);
+
+	  if(j == controlling) /* all control bits are set */
+	    reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+	}
     }
 
   free(controls);
@@ -157,6 +202,7 @@ quantum_unbounded_toffoli(int controlling, quantum_reg *reg, ...)
 void
 quantum_sigma_x(int target, quantum_reg *reg)
 {
+  quantum_profile_timer prof;
   int i;
   int qec;
 
@@ -166,19 +212,27 @@ quantum_sigma_x(int target, quantum_reg *reg)
     quantum_sigma_x_ft(target, reg);
   else
     {
-      if(quantum_objcode_put(SIGMA_X, target))
+      if(quantum_objcode_put(SIGMA_X, reg, target))
 	return;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-      for(i=0; i<reg->size; i++)
+      quantum_profile_enter(&prof, reg);
+
+      target = quantum_qubit(target, reg);
+
+      if(!quantum_pool_permute(reg, 0, (MAX_UNSIGNED) 1 << target))
 	{
-	  /* Flip the target bit of each basis state */
+#ifdef _OPENMP
+#pragma omp parallel for if (quantum_parallel(reg->size))
+#endif
+	  for(i=0; i<reg->size; i++)
+	    {
+	      /* Flip the target bit of each basis state */
 
-	  reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
-	} 
+	      reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
+	    }
+	}
       quantum_decohere(reg);
+      quantum_profile_leave(&prof, SIGMA_X, reg);
     }
 }
 
@@ -187,28 +241,23 @@ quantum_sigma_x(int target, quantum_reg *reg)
 void
 quantum_sigma_y(int target, quantum_reg *reg)
 {
-  int i;
+  quantum_profile_timer prof;
 
-  if(quantum_objcode_put(SIGMA_Y, target))
+  if(quantum_objcode_put(SIGMA_Y, reg, target))
     return;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif        
-  for(i=0; i<reg->size;i++)
-    {
-      /* Flip the target bit of each basis state and multiply with 
-	 +/- i */
+  quantum_profile_enter(&prof, reg);
 
-      reg->state[i] ^= ((MAX_UNSIGNED) 1 << target);
-      
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	reg->amplitude[i] *= IMAGINARY;
-      else
-	reg->amplitude[i] *= -IMAGINARY;
-    }
+  target = quantum_qubit(target, reg);
+
+  /* Flip the target bit of each basis state and multiply with +/- i */
+
+  quantum_kernel_phase(reg, (MAX_UNSIGNED) 1 << target, 0,
+		       (MAX_UNSIGNED) 1 << target, IMAGINARY, -IMAGINARY);
 
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, SIGMA_Y, reg);
 }
 
 /* Apply a sigma_y gate */
@@ -216,30 +265,31 @@ quantum_sigma_y(int target, quantum_reg *reg)
 void
 quantum_sigma_z(int target, quantum_reg *reg)
 {
-  int i;
+  quantum_profile_timer prof;
 
-  if(quantum_objcode_put(SIGMA_Z, target))
+  if(quantum_objcode_put(SIGMA_Z, reg, target))
     return;
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-  for(i=0; i<reg->size; i++)
-    {
-      /* Multiply with -1 if the target bit is set */
+  quantum_profile_enter(&prof, reg);
+
+  target = quantum_qubit(target, reg);
+
+  /* Multiply with -1 if the target bit is set */
+
+  quantum_kernel_phase(reg, 0, 0, (MAX_UNSIGNED) 1 << target, -1, 1);
 
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	reg->amplitude[i] *= -1;
-    }
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, SIGMA_Z, reg);
 }
 
 /* Swap the first WIDTH bits of the quantum register. This is done
-   classically by renaming the bits, unless QEC is enabled. */
+   classically by renaming the qubits, unless QEC is enabled. */
 
 void
 quantum_swaptheleads(int width, quantum_reg *reg)
 {
+  quantum_profile_timer prof;
   int i, j;
   int pat1, pat2;
   int qec;
@@ -256,12 +306,37 @@ quantum_swaptheleads(int width, quantum_reg *reg)
 	  quantum_cnot(i, width+i, reg);
 	}
     }
+  else if(2 * width <= reg->width)
+    {
+      if(quantum_objcode_put(SWAPLEADS, reg, width))
+	return;
+
+      quantum_profile_enter(&prof, reg);
+
+      /* Only the positions of the qubits have to be exchanged */
+
+      if(!reg->map)
+	quantum_new_map(reg);
+
+      for(i=0; i<width; i++)
+	{
+	  j = reg->map[i];
+	  reg->map[i] = reg->map[width+i];
+	  reg->map[width+i] = j;
+	}
+
+      quantum_profile_leave(&prof, SWAPLEADS, reg);
+    }
   else
     {
+      quantum_pool_sync(reg);
+      quantum_unmap(reg);
+      quantum_profile_enter(&prof, reg);
+
       for(i=0; i<reg->size; i++)
 	{
 
-	  if(quantum_objcode_put(SWAPLEADS, width))
+	  if(quantum_objcode_put(SWAPLEADS, reg, width))
 	    return;
 
 	  /* calculate left bit pattern */
@@ -282,6 +357,8 @@ quantum_swaptheleads(int width, quantum_reg *reg)
 	  l += (pat2 >> width);
 	  reg->state[i] = l;
 	}
+
+      quantum_profile_leave(&prof, SWAPLEADS, reg);
     }
 }
 
@@ -301,166 +378,222 @@ quantum_swaptheleads_omuln_controlled(int control, int width, quantum_reg *reg)
     }
 }
 
-/* Apply the 2x2 matrix M to the target bit. M should be unitary. */
+/* Release the memory of DECSIZE basis states dropped from the end of
+   REG. Returns DECSIZE. */
 
-void 
-quantum_gate1(int target, quantum_matrix m, quantum_reg *reg)
+static int
+quantum_shrink(quantum_reg *reg, int decsize)
+{
+  if(decsize)
+    {
+      reg->size -= decsize;
+      reg->amplitude = realloc(reg->amplitude, 
+			       reg->size * quantum_amplitude_size(reg));
+      reg->state = realloc(reg->state, 
+			   reg->size * sizeof(MAX_UNSIGNED));
+	  
+      if(reg->size && !(reg->state && reg->amplitude)) 
+	quantum_error(QUANTUM_ENOMEM);
+
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      -decsize * quantum_amplitude_size(reg));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      -decsize * sizeof(MAX_UNSIGNED));
+
+      if(quantum_trace_status)
+	quantum_trace_prune(decsize);
+    }
+
+  return decsize;
+}
+
+/* Remove the basis states with a probability below LIMIT from REG.
+   Returns the number of states removed. */
+
+static int
+quantum_prune(quantum_reg *reg, float limit)
+{
+  return quantum_shrink(reg, quantum_kernel_prune(reg, limit));
+}
+
+/* Check whether ADDSIZE new basis states fit into the memory budget.
+   If they do not, REG is pruned with a raised threshold and 1 is
+   returned, so that the caller counts the new states again. Gives up
+   with QUANTUM_EBUDGET once the threshold cannot be raised further. */
+
+static int
+quantum_make_room(quantum_reg *reg, int addsize)
 {
-  int i, j, k, iset;
-  int addsize=0, decsize=0;
-  COMPLEX_FLOAT t, tnot=0;
   float limit;
-  char *done;
 
-  if((m.cols != 2) || (m.rows != 2))
-    quantum_error(QUANTUM_EMSIZE);
+  if(!addsize || !quantum_memman_exceeds(addsize
+					 * (quantum_amplitude_size(reg)
+					    + sizeof(MAX_UNSIGNED))))
+    return 0;
 
-  if(reg->hashw)
+  if(!quantum_memman_degrade())
+    quantum_error(QUANTUM_EBUDGET);
+
+  limit = (1.0 / ((MAX_UNSIGNED) 1 << reg->width)) * epsilon
+    * quantum_memman_prune_factor();
+
+  quantum_prune(reg, limit);
+
+  return 1;
+}
+
+/* Rebuild the hash table of REG like quantum_reconstruct_hash(). The
+   threads claim free slots with an atomic compare and swap, which
+   gives a valid table for linear probing in any order. */
+
+static void
+quantum_gate_hash(quantum_reg *reg)
+{
+#if defined(_OPENMP) && defined(__GNUC__)
+  int i, j, n, size = 1 << reg->hashw;
+
+  if(!quantum_parallel(reg->size))
     {
       quantum_reconstruct_hash(reg);
+      return;
+    }
 
-      /* calculate the number of basis states to be added */
+#pragma omp parallel for
+  for(i=0; i<size; i++)
+    reg->hash[i] = 0;
 
-      for(i=0; i<reg->size; i++)
+#pragma omp parallel for private (j, n)
+  for(i=0; i<reg->size; i++)
+    {
+      j = quantum_hash64(reg->state[i], reg->hashw);
+
+      for(n=0; !__sync_bool_compare_and_swap(&reg->hash[j], 0, i+1); n++)
+	{
+	  if(n == size)
+	    quantum_error(QUANTUM_EHASHFULL);
+
+	  if(++j == size)
+	    j = 0;
+	}
+    }
+#else
+  quantum_reconstruct_hash(reg);
+#endif
+}
+
+/* Count the basis states of REG whose partner with respect to TARGET
+   does not exist yet. FIRST[B] is set to the number of such states
+   before block B, as used by quantum_kernel_gate1(). Returns the total
+   number. */
+
+static long
+quantum_gate1_count(int target, long *first, quantum_reg *reg)
+{
+  int b, blocks = QUANTUM_KERNEL_BLOCKS(reg->size);
+  long i, n, end;
+
+#ifdef _OPENMP
+#pragma omp parallel for private (i, n, end) if (quantum_parallel(reg->size))
+#endif
+  for(b=0; b<blocks; b++)
+    {
+      end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
+
+      if(end > reg->size)
+	end = reg->size;
+
+      for(i=(long) b*QUANTUM_KERNEL_BLOCK, n=0; i<end; i++)
 	{
 	  /* determine whether XORed basis state already exists */
 
 	  if(quantum_get_state(reg->state[i] 
 			       ^ ((MAX_UNSIGNED) 1 << target), *reg) == -1)
-	    addsize++;
+	    n++;
 	}
-      
-      /* allocate memory for the new basis states */
-  
-      reg->state = realloc(reg->state, 
-			       (reg->size + addsize) * sizeof(MAX_UNSIGNED));
-      reg->amplitude = realloc(reg->amplitude, 
-			       (reg->size + addsize) * sizeof(COMPLEX_FLOAT));
-      
-      if(reg->size && !(reg->state && reg->amplitude)) 
-	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(addsize*(sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
-      
-      for(i=0; i<addsize; i++)
-	{
-	  reg->state[i+reg->size] = 0;
-	  reg->amplitude[i+reg->size] = 0;
-	}
-       
+      first[b+1] = n;
     }
 
-  done = calloc(reg->size + addsize, sizeof(char));
+  first[0] = 0;
 
-  if(!done)
-    quantum_error(QUANTUM_ENOMEM);
-
-  quantum_memman(reg->size + addsize * sizeof(char));
+  for(b=0; b<blocks; b++)
+    first[b+1] += first[b];
 
-  k = reg->size;
+  return first[blocks];
+}
 
-  limit = (1.0 / ((MAX_UNSIGNED) 1 << reg->width)) * epsilon;
+/* Apply the 2x2 matrix M, stored by rows, to the target bit. The
+   entries are passed in double precision, so that registers with
+   double precision amplitudes keep their accuracy in any build. */
 
-  /* perform the actual matrix multiplication */
+static void
+quantum_gate1_rows(int target, complex double *m, quantum_reg *reg)
+{
+  int addsize=0, blocks;
+  float limit;
+  long *first;
 
-  for(i=0; i<reg->size; i++)
-    {
-      if(!done[i])
-	{
-	  /* determine if the target of the basis state is set */
-	  
-	  iset = reg->state[i] & ((MAX_UNSIGNED) 1 << target);
+  quantum_pool_sync(reg);
 
-	  tnot = 0;
-	  j = quantum_get_state(reg->state[i] 
-				^ ((MAX_UNSIGNED) 1<<target), *reg);
-	  if(j >= 0)
-	    tnot = reg->amplitude[j];
+  target = quantum_qubit(target, reg);
 
-	  t = reg->amplitude[i];
+  /* The register only shrinks until the new states are allocated */
 
-	  if(iset)
-	    reg->amplitude[i] = m.t[2] * tnot + m.t[3] * t;
+  blocks = QUANTUM_KERNEL_BLOCKS(reg->size);
+  first = calloc(blocks + 1, sizeof(long));
 
-	  else
-	    reg->amplitude[i] = m.t[0] * t + m.t[1] * tnot;
+  if(!first)
+    quantum_error(QUANTUM_ENOMEM);
 
-	  if(j >= 0)
-	    {
-	      if(iset)
-		reg->amplitude[j] = m.t[0] * tnot + m.t[1] * t;
+  quantum_memman((blocks + 1) * sizeof(long));
 
-	      else
-		reg->amplitude[j] = m.t[2] * t + m.t[3] * tnot;
-	    }
+  if(reg->hashw)
+    {
+      do
+	{
+	  quantum_gate_hash(reg);
 
-	  
-	  else /* new basis state will be created */
-	    {
-	      
-	      if((m.t[1] == 0) && (iset))
-		break;
-	      if((m.t[2] == 0) && !(iset))
-		 break; 
+	  /* calculate the number of basis states to be added */
 
-	      reg->state[k] = reg->state[i] 
-		^ ((MAX_UNSIGNED) 1 << target);
+	  addsize = quantum_gate1_count(target, first, reg);
 
-	      if(iset)
-		reg->amplitude[k] = m.t[1] * t;
+	} while(quantum_make_room(reg, addsize));
+      
+      /* allocate memory for the new basis states, which start out
+	 zeroed */
+  
+      reg->state = quantum_numa_realloc(reg->state, reg->size,
+					reg->size + addsize,
+					sizeof(MAX_UNSIGNED));
+      reg->amplitude = quantum_numa_realloc(reg->amplitude, reg->size,
+					    reg->size + addsize,
+					    quantum_amplitude_size(reg));
+      
+      if(reg->size && !(reg->state && reg->amplitude)) 
+	quantum_error(QUANTUM_ENOMEM);
 
-	      else
-		reg->amplitude[k] = m.t[2] * t;
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      addsize * quantum_amplitude_size(reg));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      addsize * sizeof(MAX_UNSIGNED));
+    }
 
-	      k++;
-	    }
+  limit = (1.0 / ((MAX_UNSIGNED) 1 << reg->width)) * epsilon
+    * quantum_memman_prune_factor();
 
-	  if(j >= 0)
-	    done[j] = 1;
+  /* perform the actual matrix multiplication */
 
-	}
-    }
+  quantum_kernel_gate1(reg, target, m, first);
 
   reg->size += addsize;
 
-  free(done);
-  quantum_memman(-reg->size * sizeof(char));
+  free(first);
+  quantum_memman(-(blocks + 1) * sizeof(long));
 
   /* remove basis states with extremely small amplitude */
 
   if(reg->hashw)
-    {
-      for(i=0, j=0; i<reg->size; i++)
-	{
-	  if(quantum_prob_inline(reg->amplitude[i]) < limit)
-	    {
-	      j++;
-	      decsize++;
-	    }
-	  
-	  else if(j)
-	    {
-	      reg->state[i-j] = reg->state[i];
-	      reg->amplitude[i-j] = reg->amplitude[i];
-	    }
-	}
-    
-      if(decsize)
-	{
-	  reg->size -= decsize;
-	  reg->amplitude = realloc(reg->amplitude, 
-				   reg->size * sizeof(COMPLEX_FLOAT));
-	  reg->state = realloc(reg->state, 
-			       reg->size * sizeof(MAX_UNSIGNED));
-	  
-	  
-	  if(reg->size && !(reg->state && reg->amplitude)) 
-	    quantum_error(QUANTUM_ENOMEM);
-
-	  quantum_memman(-decsize * (sizeof(MAX_UNSIGNED) 
-				     + sizeof(COMPLEX_FLOAT)));
-	}
-    }
+    quantum_prune(reg, limit);
 
   if(reg->size > (1 << (reg->hashw-1)))
     fprintf(stderr, "Warning: inefficient hash table (size %i vs hash %i)\n", 
@@ -470,181 +603,256 @@ quantum_gate1(int target, quantum_matrix m, quantum_reg *reg)
   quantum_decohere(reg);
 }
 
-/* Apply the 4x4 matrix M to the bits TARGET1 and TARGET2. M should be
-   unitary. 
-
-   Warning: code is mostly untested.*/
+/* Apply the 2x2 matrix M to the target bit. M should be unitary. */
 
 void 
-quantum_gate2(int target1, int target2, quantum_matrix m, quantum_reg *reg)
+quantum_gate1(int target, quantum_matrix m, quantum_reg *reg)
 {
-  int i, j, k, l;
-  int addsize=0, decsize=0;
-  COMPLEX_FLOAT psi_sub[4];
-  int base[4];
-  int bits[2];
-  float limit;
-  char *done;
+  complex double rows[4];
+  int i;
 
-  if((m.cols != 4) || (m.rows != 4))
+  if((m.cols != 2) || (m.rows != 2))
     quantum_error(QUANTUM_EMSIZE);
-  
-  /* Build hash table */
 
-  for(i=0; i<(1 << reg->hashw); i++)
-    reg->hash[i] = 0;
-      
-  for(i=0; i<reg->size; i++)
-    quantum_add_hash(reg->state[i], i, reg);
+  for(i=0; i<4; i++)
+    rows[i] = m.t[i];
 
-  /* calculate the number of basis states to be added */
+  quantum_gate1_rows(target, rows, reg);
+}
 
-  for(i=0; i<reg->size; i++)
+/* Group the basis states of REG into tuples that differ only in the
+   bits of MASK. OWNER[i] is set if state i is the member of its tuple
+   with the lowest index. FIRST[B] is set to the number of members
+   missing from the tuples owned by the blocks before B. Returns the
+   total number of missing members. */
+
+static long
+quantum_gatek_count(MAX_UNSIGNED *off, int n, long *first, char *owner,
+		    quantum_reg *reg)
+{
+  int b, l, blocks = QUANTUM_KERNEL_BLOCKS(reg->size);
+  long i, j, c, miss, end;
+  MAX_UNSIGNED a, base;
+
+#ifdef _OPENMP
+#pragma omp parallel for private (i, j, c, miss, end, l, a, base) \
+  if (quantum_parallel((long) reg->size * n))
+#endif
+  for(b=0; b<blocks; b++)
     {
-      if(quantum_get_state(reg->state[i] ^ ((MAX_UNSIGNED) 1 << target1),
-			   *reg) == -1)
-	addsize++;
-      if(quantum_get_state(reg->state[i] ^ ((MAX_UNSIGNED) 1 << target2),
-			   *reg) == -1)
-	addsize++;
-    }
+      end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
 
-  /* allocate memory for the new basis states */
+      if(end > reg->size)
+	end = reg->size;
 
-  reg->state = realloc(reg->state, 
-		       (reg->size + addsize) * sizeof(MAX_UNSIGNED));
-  reg->amplitude = realloc(reg->amplitude, 
-			   (reg->size + addsize) * sizeof(COMPLEX_FLOAT));
-      
-  if(reg->size && !(reg->state && reg->amplitude)) 
-    quantum_error(QUANTUM_ENOMEM);
+      for(i=(long) b*QUANTUM_KERNEL_BLOCK, c=0; i<end; i++)
+	{
+	  a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+	  base = a & ~off[n-1];
+	  owner[i] = 1;
 
-  quantum_memman(addsize*(sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+	  for(l=0, miss=0; l<n; l++)
+	    {
+	      if((base | off[l]) == a)
+		continue;
 
-  for(i=0; i<addsize; i++)
-    {
-      reg->state[i+reg->size] = 0;
-      reg->amplitude[i+reg->size] = 0;
+	      j = quantum_find_state(base | off[l], reg);
+
+	      if(j < 0)
+		miss++;
+
+	      else if(j < i)
+		{
+		  owner[i] = 0;
+		  break;
+		}
+	    }
+
+	  /* Only the owner creates the missing members */
+
+	  if(owner[i])
+	    c += miss;
+	}
+
+      first[b+1] = reg->hashw ? c : 0;
     }
 
-  done = calloc(reg->size + addsize, sizeof(char));
+  first[0] = 0;
 
-  if(!done)
-    quantum_error(QUANTUM_EMSIZE);
+  for(b=0; b<blocks; b++)
+    first[b+1] += first[b];
 
-  quantum_memman(reg->size + addsize * sizeof(char));
+  return first[blocks];
+}
 
-  l = reg->size;
+/* Apply the 2^K x 2^K matrix M to the qubits TARGETS. Bit L of a row
+   or column number of M refers to TARGETS[L]. M should be unitary.
+   Basis states created by the gate are added to sparse registers,
+   those with a negligible probability afterwards are removed in the
+   same sweep. */
 
-  limit = (1.0 / ((MAX_UNSIGNED) 1 << reg->width)) / 1000000;
+void
+quantum_gatek(int *targets, int k, quantum_matrix m, quantum_reg *reg)
+{
+  int i, j, n, blocks, bits[QUANTUM_GATEK_MAX];
+  long addsize = 0, size, total;
+  float limit;
+  long *first;
+  char *owner, *keep;
+  complex double *rows;
+  MAX_UNSIGNED *off;
 
-  bits[0] = target1;
-  bits[1] = target2;
+  if((k < 1) || (k > QUANTUM_GATEK_MAX))
+    quantum_error(QUANTUM_EMSIZE);
 
-  /* perform the actual matrix multiplication */
+  n = 1 << k;
 
-  for(i=0; i<reg->size; i++)
-    {
-      if(!done[i])
-	{
-	  j = quantum_bitmask(reg->state[i], 2, bits);
-	  base[j] = i;
-	  base[j ^ 1] = quantum_get_state(reg->state[i] 
-					  ^ ((MAX_UNSIGNED) 1 << target2),
-					  *reg);
-	  base[j ^ 2] = quantum_get_state(reg->state[i]
-					  ^ ((MAX_UNSIGNED) 1 << target1), 
-					  *reg);
-	  base[j ^ 3] = quantum_get_state(reg->state[i]
-					  ^ ((MAX_UNSIGNED) 1 << target1)
-					  ^ ((MAX_UNSIGNED) 1 << target2),
-					  *reg);
-
-	  for(j=0; j<4; j++)
-	    {
-	      if(base[j] == -1)
-		{
-		  base[j] = l;
-		  //		  reg->node[l].state = reg->state[i]
-		  l++;
-		}
-	      psi_sub[j] = reg->amplitude[base[j]];
-	    }
+  if((m.cols != n) || (m.rows != n))
+    quantum_error(QUANTUM_EMSIZE);
 
-	  for(j=0; j<4; j++)
-	    {
-	      reg->amplitude[base[j]] = 0;
-	      for(k=0; k<4; k++)
-		reg->amplitude[base[j]] += M(m, k, j) * psi_sub[k];
+  quantum_pool_sync(reg);
 
-	      done[base[j]] = 1;
-	    }
+  for(i=0; i<k; i++)
+    {
+      bits[i] = quantum_qubit(targets[i], reg);
 
+      for(j=0; j<i; j++)
+	{
+	  if(bits[j] == bits[i])
+	    quantum_error(QUANTUM_EQUBITMAP);
 	}
     }
 
-  reg->size += addsize;
+  /* OFF[L] holds the bits set in the members of a tuple with number
+     L */
 
-  free(done);
+  off = calloc(n, sizeof(MAX_UNSIGNED));
+  rows = calloc(n * n, sizeof(complex double));
 
-  quantum_memman(-reg->size * sizeof(char));
+  if(!(off && rows))
+    quantum_error(QUANTUM_ENOMEM);
 
-  /* remove basis states with extremely small amplitude */
+  quantum_memman(n * sizeof(MAX_UNSIGNED) + n * n * sizeof(complex double));
 
-  for(i=0, j=0; i<reg->size; i++)
+  for(i=0; i<n; i++)
     {
-      if(quantum_prob_inline(reg->amplitude[i]) < limit)
+      for(j=0; j<k; j++)
 	{
-	  j++;
-	  decsize++;
-	}
-      
-      else if(j)
-	{
-	  reg->state[i-j] = reg->state[i];
-	  reg->amplitude[i-j] = reg->amplitude[i];
+	  if(i & (1 << j))
+	    off[i] |= (MAX_UNSIGNED) 1 << bits[j];
 	}
     }
 
-  if(decsize)
+  for(i=0; i<n*n; i++)
+    rows[i] = m.t[i];
+
+  /* The register only shrinks until the new states are allocated */
+
+  size = reg->size;
+  blocks = QUANTUM_KERNEL_BLOCKS(size);
+  first = calloc(blocks + 1, sizeof(long));
+  owner = calloc(size, sizeof(char));
+
+  if(!first || (size && !owner))
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman((blocks + 1) * sizeof(long) + size * sizeof(char));
+
+  do
     {
-      reg->size -= decsize;
-      reg->amplitude = realloc(reg->amplitude, 
-			       reg->size * sizeof(COMPLEX_FLOAT));
-      reg->state = realloc(reg->state, 
-			   reg->size * sizeof(MAX_UNSIGNED));
-	  
-	  
-      if(reg->size && !(reg->state && reg->amplitude)) 
+      if(reg->hashw)
+	quantum_gate_hash(reg);
+
+      addsize = quantum_gatek_count(off, n, first, owner, reg);
+
+    } while(quantum_make_room(reg, addsize));
+
+  /* allocate memory for the new basis states */
+
+  if(addsize)
+    {
+      reg->state = quantum_numa_realloc(reg->state, reg->size,
+					reg->size + addsize,
+					sizeof(MAX_UNSIGNED));
+      reg->amplitude = quantum_numa_realloc(reg->amplitude, reg->size,
+					    reg->size + addsize,
+					    quantum_amplitude_size(reg));
+
+      if(!(reg->state && reg->amplitude))
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(-decsize * (sizeof(MAX_UNSIGNED) 
-				 + sizeof(COMPLEX_FLOAT)));
-      
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      addsize * quantum_amplitude_size(reg));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      addsize * sizeof(MAX_UNSIGNED));
     }
 
+  total = reg->size + addsize;
+  keep = malloc(total * sizeof(char));
+
+  if(total && !keep)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(total * sizeof(char));
+
+  limit = (1.0 / ((MAX_UNSIGNED) 1 << reg->width)) * epsilon
+    * quantum_memman_prune_factor();
+
+  quantum_kernel_gatek(reg, bits, k, rows, first, owner, keep, limit);
+
+  free(owner);
+  quantum_memman(-size * sizeof(char));
+
+  reg->size += addsize;
+
+  if(reg->hashw)
+    quantum_shrink(reg, quantum_kernel_compact(reg, keep));
+
+  free(keep);
+  quantum_memman(-total * sizeof(char));
+
+  free(first);
+  free(rows);
+  free(off);
+  quantum_memman(-(blocks + 1) * sizeof(long) - n * sizeof(MAX_UNSIGNED)
+		 - n * n * sizeof(complex double));
+
   quantum_decohere(reg);
 }
 
+/* Apply the 4x4 matrix M to the bits TARGET1 and TARGET2. Bit 0 of a
+   row or column number refers to TARGET1. M should be unitary. */
+
+void 
+quantum_gate2(int target1, int target2, quantum_matrix m, quantum_reg *reg)
+{
+  int targets[2];
+
+  targets[0] = target1;
+  targets[1] = target2;
+
+  quantum_gatek(targets, 2, m, reg);
+}
+
 /* Apply a hadamard gate */
 
 void
 quantum_hadamard(int target, quantum_reg *reg)
 {
-  quantum_matrix m;
+  quantum_profile_timer prof;
+  complex double m[4];
   
-  if(quantum_objcode_put(HADAMARD, target))
+  if(quantum_objcode_put(HADAMARD, reg, target))
     return;
-  
-  m = quantum_new_matrix(2, 2);
 
-  m.t[0] = sqrt(1.0/2);  m.t[1] = sqrt(1.0/2);
-  m.t[2] = sqrt(1.0/2);  m.t[3] = -sqrt(1.0/2);
-
-  quantum_gate1(target, m, reg);
+  quantum_profile_enter(&prof, reg);
   
-  quantum_delete_matrix(&m);
+  m[0] = sqrt(1.0/2);  m[1] = sqrt(1.0/2);
+  m[2] = sqrt(1.0/2);  m[3] = -sqrt(1.0/2);
+
+  quantum_gate1_rows(target, m, reg);
 
+  quantum_profile_leave(&prof, HADAMARD, reg);
 }
 
 /* Apply a walsh-hadamard transform */
@@ -664,20 +872,20 @@ quantum_walsh(int width, quantum_reg *reg)
 void
 quantum_r_x(int target, float gamma, quantum_reg *reg)
 {
-  quantum_matrix m;
+  quantum_profile_timer prof;
+  complex double m[4];
   
-  if(quantum_objcode_put(ROT_X, target, (double) gamma))
+  if(quantum_objcode_put(ROT_X, reg, target, (double) gamma))
     return;
 
-  m = quantum_new_matrix(2, 2);
-
-  m.t[0] = cos(gamma / 2);              m.t[1] = -IMAGINARY * sin(gamma / 2);
-  m.t[2] = -IMAGINARY * sin(gamma / 2); m.t[3] = cos(gamma / 2);
+  quantum_profile_enter(&prof, reg);
 
-  quantum_gate1(target, m, reg);
+  m[0] = cos(gamma / 2);              m[1] = -IMAGINARY * sin(gamma / 2);
+  m[2] = -IMAGINARY * sin(gamma / 2); m[3] = cos(gamma / 2);
 
-  quantum_delete_matrix(&m);
+  quantum_gate1_rows(target, m, reg);
 
+  quantum_profile_leave(&prof, ROT_X, reg);
 }
 
 /* Apply a rotation about the y-axis by the angle GAMMA */
@@ -685,20 +893,20 @@ quantum_r_x(int target, float gamma, quantum_reg *reg)
 void
 quantum_r_y(int target, float gamma, quantum_reg *reg)
 {
-  quantum_matrix m;
+  quantum_profile_timer prof;
+  complex double m[4];
 
-  if(quantum_objcode_put(ROT_Y, target, (double) gamma))
+  if(quantum_objcode_put(ROT_Y, reg, target, (double) gamma))
     return;
 
-  m = quantum_new_matrix(2, 2);
+  quantum_profile_enter(&prof, reg);
 
-  m.t[0] = cos(gamma / 2);  m.t[1] = -sin(gamma / 2);
-  m.t[2] = sin(gamma / 2);  m.t[3] = cos(gamma / 2);
+  m[0] = cos(gamma / 2);  m[1] = -sin(gamma / 2);
+  m[2] = sin(gamma / 2);  m[3] = cos(gamma / 2);
 
-  quantum_gate1(target, m, reg);
-
-  quantum_delete_matrix(&m);
+  quantum_gate1_rows(target, m, reg);
 
+  quantum_profile_leave(&prof, ROT_Y, reg);
 }
 
 /* Apply a rotation about the z-axis by the angle GAMMA */
@@ -706,23 +914,23 @@ quantum_r_y(int target, float gamma, quantum_reg *reg)
 void
 quantum_r_z(int target, float gamma, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(ROT_Z, target, (double) gamma))
+  if(quantum_objcode_put(ROT_Z, reg, target, (double) gamma))
     return;
 
+  quantum_profile_enter(&prof, reg);
+
+  target = quantum_qubit(target, reg);
+
   z = quantum_cexp(gamma/2);
-  
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	reg->amplitude[i] *= z;
-      else
-	reg->amplitude[i] /= z;
-    }
+
+  quantum_kernel_phase(reg, 0, 0, (MAX_UNSIGNED) 1 << target, z, 1 / z);
 
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, ROT_Z, reg);
 }
 
 /* Scale the phase of qubit */
@@ -730,23 +938,21 @@ quantum_r_z(int target, float gamma, quantum_reg *reg)
 void
 quantum_phase_scale(int target, float gamma, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(PHASE_SCALE, target, (double) gamma))
+  if(quantum_objcode_put(PHASE_SCALE, reg, target, (double) gamma))
     return;
 
+  quantum_profile_enter(&prof, reg);
+
   z = quantum_cexp(gamma);
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif        
-  for(i=0; i<reg->size; i++)
-    {
-      reg->amplitude[i] *= z;
-    }
+  quantum_kernel_phase(reg, 0, 0, 0, z, 1);
 
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, PHASE_SCALE, reg);
 }
 
 
@@ -755,24 +961,23 @@ quantum_phase_scale(int target, float gamma, quantum_reg *reg)
 void
 quantum_phase_kick(int target, float gamma, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(PHASE_KICK, target, (double) gamma))
+  if(quantum_objcode_put(PHASE_KICK, reg, target, (double) gamma))
     return;
 
+  quantum_profile_enter(&prof, reg);
+
+  target = quantum_qubit(target, reg);
+
   z = quantum_cexp(gamma);
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif        
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	reg->amplitude[i] *= z;
-    }
+  quantum_kernel_phase(reg, 0, 0, (MAX_UNSIGNED) 1 << target, z, 1);
 
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, PHASE_KICK, reg);
 }
 
 /* Apply a conditional phase shift by PI / 2^(CONTROL - TARGET) */
@@ -780,49 +985,40 @@ quantum_phase_kick(int target, float gamma, quantum_reg *reg)
 void
 quantum_cond_phase(int control, int target, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(COND_PHASE, control, target))
+  if(quantum_objcode_put(COND_PHASE, reg, control, target))
     return;
 
+  quantum_profile_enter(&prof, reg);
+
   z = quantum_cexp(pi / ((MAX_UNSIGNED) 1 << (control - target)));
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control))
-	{
-	  if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	    reg->amplitude[i] *= z;
-	}
-    }
+  control = quantum_qubit(control, reg);
+  target = quantum_qubit(target, reg);
+
+  quantum_kernel_phase(reg, 0, (MAX_UNSIGNED) 1 << control,
+		       (MAX_UNSIGNED) 1 << target, z, 1);
 
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, COND_PHASE, reg);
 }
 
 
 void
 quantum_cond_phase_inv(int control, int target, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  complex double z;
 
   z = quantum_cexp(-pi / ((MAX_UNSIGNED) 1 << (control - target)));
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control))
-	{
-	  if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	    reg->amplitude[i] *= z;
-	}
-    }
+  control = quantum_qubit(control, reg);
+  target = quantum_qubit(target, reg);
+
+  quantum_kernel_phase(reg, 0, (MAX_UNSIGNED) 1 << control,
+		       (MAX_UNSIGNED) 1 << target, z, 1);
 
   quantum_decohere(reg);
 }
@@ -831,53 +1027,51 @@ quantum_cond_phase_inv(int control, int target, quantum_reg *reg)
 void
 quantum_cond_phase_kick(int control, int target, float gamma, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(COND_PHASE, control, target, (double) gamma))
+  if(quantum_objcode_put(CPHASE_KICK, reg, control, target, 
+			 (double) gamma))
     return;  
 
+  quantum_profile_enter(&prof, reg);
+
   z = quantum_cexp(gamma);
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control))
-	{
-	  if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	    reg->amplitude[i] *= z;
-	}
-     }
+  control = quantum_qubit(control, reg);
+  target = quantum_qubit(target, reg);
+
+  quantum_kernel_phase(reg, 0, (MAX_UNSIGNED) 1 << control,
+		       (MAX_UNSIGNED) 1 << target, z, 1);
+
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, CPHASE_KICK, reg);
 }
 
 void
 quantum_cond_phase_shift(int control, int target, float gamma, quantum_reg *reg)
 {
-  int i;
-  COMPLEX_FLOAT z;
+  quantum_profile_timer prof;
+  complex double z;
 
-  if(quantum_objcode_put(COND_PHASE, control, target, (double) gamma))
+  if(quantum_objcode_put(CPHASE_SHIFT, reg, control, target, 
+			 (double) gamma))
     return;  
 
+  quantum_profile_enter(&prof, reg);
+
   z = quantum_cexp(gamma/2);
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif      
-  for(i=0; i<reg->size; i++)
-    {
-      if(reg->state[i] & ((MAX_UNSIGNED) 1 << control))
-	{
-	  if(reg->state[i] & ((MAX_UNSIGNED) 1 << target))
-	    reg->amplitude[i] *= z;
-	  else
-	    reg->amplitude[i] /= z;
-	}
-     }
+  control = quantum_qubit(control, reg);
+  target = quantum_qubit(target, reg);
+
+  quantum_kernel_phase(reg, 0, (MAX_UNSIGNED) 1 << control,
+		       (MAX_UNSIGNED) 1 << target, z, 1 / z);
+
   quantum_decohere(reg);
+
+  quantum_profile_leave(&prof, CPHASE_SHIFT, reg);
 }
 
 
@@ -889,12 +1083,12 @@ quantum_cond_phase_shift(int control, int target, float gamma, quantum_reg *reg)
 int
 quantum_gate_counter(int inc)
 {
-  static int counter = 0;
+  quantum_context *ctx = quantum_get_context();
 
   if(inc > 0)
-    counter += inc;
+    ctx->gate_counter += inc;
   else if(inc < 0)
-    counter = 0;
+    ctx->gate_counter = 0;
 
-  return counter;
+  return ctx->gate_counter;
 }
@@ -41,9 +41,15 @@ extern void quantum_swaptheleads(int width, quantum_reg *reg);
 extern void quantum_swaptheleads_omuln_controlled(int control, int width,
 						  quantum_reg *);
 
+/* Largest number of qubits quantum_gatek() can be applied to */
+
+#define QUANTUM_GATEK_MAX 10
+
 extern void quantum_gate1(int target, quantum_matrix m, quantum_reg *reg);
 extern void quantum_gate2(int target1, int target2, quantum_matrix m, 
 			  quantum_reg *reg);
+extern void quantum_gatek(int *targets, int k, quantum_matrix m,
+			  quantum_reg *reg);
 
 extern void quantum_r_x(int target, float gamma, quantum_reg *reg);
 extern void quantum_r_y(int target, float gamma, quantum_reg *reg);
@@ -60,6 +66,8 @@ extern void quantum_cond_phase_inv(int control, int target, quantum_reg *reg);
 
 extern void quantum_cond_phase_kick(int control, int target, float gamma, 
 				    quantum_reg *reg);
+extern void quantum_cond_phase_shift(int control, int target, float gamma, 
+				     quantum_reg *reg);
 
 extern int quantum_gate_counter(int inc);
 
@@ -0,0 +1,485 @@
+/* kernels.h: Amplitude kernels for a single precision
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+/* This file has no include guard. precision.c includes it once for
+   each type of amplitudes, with QUANTUM_S defined as the type in
+   memory, QUANTUM_T as the complex type used for arithmetic and
+   QUANTUM_K(name) giving the name of the kernel for this type.
+   QUANTUM_LOAD(a, i) and QUANTUM_STORE(a, i, z) convert between the
+   two. */
+
+/* Multiply the amplitudes of the basis states that contain all bits of
+   CMASK with Z1 if they also contain all bits of TMASK and with Z0
+   otherwise. The bits of XMASK are flipped first. */
+
+static void
+QUANTUM_K(quantum_kernel_phase)(quantum_reg *reg, MAX_UNSIGNED xmask,
+				MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+				complex double z1, complex double z0)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude;
+  QUANTUM_T y1 = z1, y0 = z0;
+  MAX_UNSIGNED a;
+  int i;
+
+#ifdef _OPENMP
+#pragma omp parallel for private (a) if (quantum_parallel(reg->size))
+#endif
+  for(i=0; i<reg->size; i++)
+    {
+      a = reg->state ? reg->state[i] : i;
+
+      if(xmask)
+	reg->state[i] = a ^= xmask;
+
+      if((a & cmask) != cmask)
+	continue;
+
+      if((a & tmask) == tmask)
+	QUANTUM_STORE(amplitude, i, QUANTUM_LOAD(amplitude, i) * y1);
+      else if(z0 != 1)
+	QUANTUM_STORE(amplitude, i, QUANTUM_LOAD(amplitude, i) * y0);
+    }
+}
+
+/* Apply the 2x2 matrix M to the bit TARGET of the hashed register REG.
+   Each pair of partner states is handled by the state with the target
+   bit cleared, or by the only state of the pair present. The new
+   partner states of block B have already been allocated from
+   REG->SIZE + FIRST[B] on and are filled in the order of the old
+   ones, so the blocks can be processed in parallel. */
+
+static void
+QUANTUM_K(quantum_kernel_gate1)(quantum_reg *reg, int target,
+				complex double *m, long *first)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude;
+  QUANTUM_T m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+  QUANTUM_T t, tnot;
+  MAX_UNSIGNED a, bit = (MAX_UNSIGNED) 1 << target;
+  long i, k, end;
+  int b, j;
+
+#ifdef _OPENMP
+#pragma omp parallel for private (a, i, j, k, end, t, tnot) \
+  if (quantum_parallel(reg->size))
+#endif
+  for(b=0; b<QUANTUM_KERNEL_BLOCKS(reg->size); b++)
+    {
+      k = reg->size + first[b];
+      end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
+
+      if(end > reg->size)
+	end = reg->size;
+
+      for(i=(long) b*QUANTUM_KERNEL_BLOCK; i<end; i++)
+	{
+	  a = reg->state[i];
+	  j = quantum_get_state(a ^ bit, *reg);
+	  t = QUANTUM_LOAD(amplitude, i);
+
+	  if(j < 0) /* new basis state will be created */
+	    {
+	      reg->state[k] = a ^ bit;
+
+	      if(a & bit)
+		{
+		  QUANTUM_STORE(amplitude, i, m3 * t);
+		  QUANTUM_STORE(amplitude, k, m1 * t);
+		}
+	      else
+		{
+		  QUANTUM_STORE(amplitude, i, m0 * t);
+		  QUANTUM_STORE(amplitude, k, m2 * t);
+		}
+
+	      k++;
+	    }
+
+	  else if(!(a & bit))
+	    {
+	      tnot = QUANTUM_LOAD(amplitude, j);
+	      QUANTUM_STORE(amplitude, i, m0 * t + m1 * tnot);
+	      QUANTUM_STORE(amplitude, j, m2 * t + m3 * tnot);
+	    }
+	}
+    }
+}
+
+/* Multiply the N amplitudes in PSI with the matrix Y, stored by rows.
+   The kernel below calls it with constant N for up to four qubits, so
+   that the loops can be unrolled and vectorized for each size. */
+
+static inline void
+QUANTUM_K(quantum_kernel_mul)(QUANTUM_T *y, QUANTUM_T *psi, QUANTUM_T *out,
+			      int n)
+{
+  QUANTUM_T z;
+  int j, l;
+
+  for(j=0; j<n; j++)
+    {
+      z = 0;
+
+      for(l=0; l<n; l++)
+	z += y[n*j+l] * psi[l];
+
+      out[j] = z;
+    }
+}
+
+/* Apply the 2^K x 2^K matrix M, stored by rows, to the qubits at the
+   bit positions BITS. Bit L of a row or column number refers to
+   BITS[L]. The basis states are grouped into tuples differing only in
+   these bits. Each tuple is handled by its member with the lowest
+   index, marked in OWNER. The members missing from the tuples of block
+   B have been allocated from REG->SIZE + FIRST[B] on. KEEP is cleared
+   for the members whose probability drops below LIMIT, so that they
+   can be removed without looking at the amplitudes again. */
+
+static void
+QUANTUM_K(quantum_kernel_gatek)(quantum_reg *reg, int *bits, int k,
+				complex double *m, long *first, char *owner,
+				char *keep, double limit)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude;
+  QUANTUM_T y[256];
+  MAX_UNSIGNED off[1 << k];
+  long i, e, end;
+  int b, j, l, n = 1 << k;
+
+  for(l=0; l<n; l++)
+    {
+      off[l] = 0;
+
+      for(j=0; j<k; j++)
+	{
+	  if(l & (1 << j))
+	    off[l] |= (MAX_UNSIGNED) 1 << bits[j];
+	}
+    }
+
+  if(n <= 16)
+    {
+      for(j=0; j<n*n; j++)
+	y[j] = m[j];
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for private (i, e, end, j, l) \
+  if (quantum_parallel((long) reg->size << k))
+#endif
+  for(b=0; b<QUANTUM_KERNEL_BLOCKS(reg->size); b++)
+    {
+      QUANTUM_T psi[n], out[n];
+      complex double z;
+      MAX_UNSIGNED a, base;
+      long idx[n];
+
+      e = reg->size + first[b];
+      end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
+
+      if(end > reg->size)
+	end = reg->size;
+
+      for(i=(long) b*QUANTUM_KERNEL_BLOCK; i<end; i++)
+	{
+	  if(!owner[i])
+	    continue;
+
+	  a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+	  base = a & ~off[n-1];
+
+	  /* Gather the members of the tuple, creating the missing ones */
+
+	  for(l=0; l<n; l++)
+	    {
+	      idx[l] = (base | off[l]) == a ? i
+		: quantum_find_state(base | off[l], reg);
+
+	      if(idx[l] < 0 && reg->hashw)
+		{
+		  idx[l] = e++;
+		  reg->state[idx[l]] = base | off[l];
+		}
+
+	      psi[l] = (idx[l] < 0) ? 0 : QUANTUM_LOAD(amplitude, idx[l]);
+	    }
+
+	  switch(k)
+	    {
+	    case 1: QUANTUM_K(quantum_kernel_mul)(y, psi, out, 2);
+	      break;
+	    case 2: QUANTUM_K(quantum_kernel_mul)(y, psi, out, 4);
+	      break;
+	    case 3: QUANTUM_K(quantum_kernel_mul)(y, psi, out, 8);
+	      break;
+	    case 4: QUANTUM_K(quantum_kernel_mul)(y, psi, out, 16);
+	      break;
+	    default:
+	      for(j=0; j<n; j++)
+		{
+		  z = 0;
+
+		  for(l=0; l<n; l++)
+		    z += m[n*j+l] * psi[l];
+
+		  out[j] = z;
+		}
+	    }
+
+	  /* Scatter the results */
+
+	  for(l=0; l<n; l++)
+	    {
+	      if(idx[l] < 0)
+		continue;
+
+	      QUANTUM_STORE(amplitude, idx[l], out[l]);
+	      keep[idx[l]] = !reg->hashw
+		|| quantum_prob_inline(QUANTUM_LOAD(amplitude, idx[l])) >= limit;
+	    }
+	}
+    }
+}
+
+/* Move the basis states with a probability of at least LIMIT to the
+   front of REG, or the states marked in KEEP if it is not NULL.
+   Returns the number of states dropped. Large registers are compacted
+   in parallel into new arrays if the memory budget allows, each block
+   copying its states to the position given by the number of states
+   kept in the blocks before. */
+
+#define QUANTUM_KEEP(i) (keep ? keep[i] \
+  : quantum_prob_inline(QUANTUM_LOAD(amplitude, i)) >= limit)
+
+static int
+QUANTUM_K(quantum_kernel_prune)(quantum_reg *reg, double limit, char *keep)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude, *amp2;
+  MAX_UNSIGNED *state2;
+  long i, j, k, end, *first;
+  int b, blocks = QUANTUM_KERNEL_BLOCKS(reg->size);
+
+  if(!quantum_parallel(reg->size)
+     || quantum_memman_exceeds(reg->size * (sizeof(QUANTUM_S)
+					    + sizeof(MAX_UNSIGNED))))
+    {
+      for(i=0, j=0; i<reg->size; i++)
+	{
+	  if(!QUANTUM_KEEP(i))
+	    j++;
+
+	  else if(j)
+	    {
+	      reg->state[i-j] = reg->state[i];
+	      amplitude[i-j] = amplitude[i];
+	    }
+	}
+
+      return j;
+    }
+
+  first = calloc(blocks + 1, sizeof(long));
+
+  if(!first)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman((blocks + 1) * sizeof(long));
+
+  /* Count the states kept in each block */
+
+#ifdef _OPENMP
+#pragma omp parallel for private (i, k, end)
+#endif
+  for(b=0; b<blocks; b++)
+    {
+      end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
+
+      if(end > reg->size)
+	end = reg->size;
+
+      for(i=(long) b*QUANTUM_KERNEL_BLOCK, k=0; i<end; i++)
+	{
+	  if(QUANTUM_KEEP(i))
+	    k++;
+	}
+
+      first[b+1] = k;
+    }
+
+  for(b=0; b<blocks; b++)
+    first[b+1] += first[b];
+
+  j = reg->size - first[blocks];
+
+  if(j)
+    {
+      k = first[blocks];
+      state2 = quantum_numa_calloc(k, sizeof(MAX_UNSIGNED), QUANTUM_NUMA_LOCAL);
+      amp2 = quantum_numa_calloc(k, sizeof(QUANTUM_S), QUANTUM_NUMA_LOCAL);
+
+      if(k && !(state2 && amp2))
+	quantum_error(QUANTUM_ENOMEM);
+
+      quantum_memman_category(QUANTUM_MEM_STATE, k * sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE, k * sizeof(QUANTUM_S));
+
+#ifdef _OPENMP
+#pragma omp parallel for private (i, k, end)
+#endif
+      for(b=0; b<blocks; b++)
+	{
+	  end = (long) (b + 1) * QUANTUM_KERNEL_BLOCK;
+
+	  if(end > reg->size)
+	    end = reg->size;
+
+	  for(i=(long) b*QUANTUM_KERNEL_BLOCK, k=first[b]; i<end; i++)
+	    {
+	      if(QUANTUM_KEEP(i))
+		{
+		  state2[k] = reg->state[i];
+		  amp2[k] = amplitude[i];
+		  k++;
+		}
+	    }
+	}
+
+      /* The caller accounts for the states dropped */
+
+      free(reg->state);
+      free(reg->amplitude);
+      reg->state = state2;
+      reg->amplitude = (COMPLEX_FLOAT *) amp2;
+
+      k = first[blocks];
+      quantum_memman_category(QUANTUM_MEM_STATE, -k * sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE, -k * sizeof(QUANTUM_S));
+    }
+
+  free(first);
+  quantum_memman(-(blocks + 1) * sizeof(long));
+
+  return j;
+}
+
+#undef QUANTUM_KEEP
+
+/* Sum up the probabilities of the basis states A with A & MASK equal
+   to VALUE. Each thread sums up its part of the register with
+   compensation, the parts are added in a fixed order. */
+
+static double
+QUANTUM_K(quantum_kernel_probsum)(quantum_reg *reg, MAX_UNSIGNED mask,
+				  MAX_UNSIGNED value)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude;
+  int t, k = quantum_threads();
+  quantum_sum part[k], p = {0, 0};
+
+  memset(part, 0, sizeof(part));
+
+#ifdef _OPENMP
+#pragma omp parallel private (t) if (quantum_parallel(reg->size))
+#endif
+  {
+    MAX_UNSIGNED a;
+    long i, lo, hi;
+    quantum_sum q = {0, 0};
+
+    t = quantum_thread_range(reg->size, &lo, &hi);
+
+    for(i=lo; i<hi; i++)
+      {
+	a = reg->state ? reg->state[i] : (MAX_UNSIGNED) i;
+
+	if((a & mask) == value)
+	  quantum_sum_add(&q, quantum_prob_inline(QUANTUM_LOAD(amplitude, i)));
+      }
+
+    part[t] = q;
+  }
+
+  for(t=0; t<k; t++)
+    quantum_sum_add(&p, quantum_sum_get(&part[t]));
+
+  return quantum_sum_get(&p);
+}
+
+/* Return the index of the basis state at which the cumulated
+   probability exceeds R, or -1 if the total probability is smaller.
+   The parts of the threads are summed up first, so only the part
+   containing the result needs to be scanned. */
+
+static int
+QUANTUM_K(quantum_kernel_select)(quantum_reg *reg, double r)
+{
+  QUANTUM_S *amplitude = (QUANTUM_S *) reg->amplitude;
+  int t, k = quantum_threads();
+  quantum_sum part[k];
+  long i, lo[k], hi[k];
+  double p;
+
+  memset(part, 0, sizeof(part));
+  memset(lo, 0, sizeof(lo));
+  memset(hi, 0, sizeof(hi));
+
+#ifdef _OPENMP
+#pragma omp parallel private (i, t) if (quantum_parallel(reg->size))
+#endif
+  {
+    long a, b;
+    quantum_sum q = {0, 0};
+
+    t = quantum_thread_range(reg->size, &a, &b);
+
+    for(i=a; i<b; i++)
+      quantum_sum_add(&q, quantum_prob_inline(QUANTUM_LOAD(amplitude, i)));
+
+    lo[t] = a;
+    hi[t] = b;
+    part[t] = q;
+  }
+
+  for(t=0; t<k; t++)
+    {
+      p = quantum_sum_get(&part[t]);
+
+      if(r > p)
+	{
+	  r -= p;
+	  continue;
+	}
+
+      for(i=lo[t]; i<hi[t]; i++)
+	{
+	  r -= quantum_prob_inline(QUANTUM_LOAD(amplitude, i));
+
+	  if(0 >= r)
+	    return i;
+	}
+    }
+
+  return -1;
+}
@@ -28,6 +28,7 @@
 #include "matrix.h"
 #include "qcomplex.h"
 #include "qureg.h"
+#include "precision.h"
 #include "error.h"
 #include "config.h"
 
@@ -71,15 +72,18 @@ quantum_diag_time(double t, quantum_reg *reg0, quantum_reg *regt,
 
       p = regt->amplitude;
       *regt = *reg0;
-      regt->amplitude = realloc(p, regt->size*sizeof(COMPLEX_FLOAT));
+      regt->amplitude = realloc(p, regt->size
+				* quantum_amplitude_size(reg0));
       
       p = tmp1->amplitude;
       *tmp1 = *reg0;
-      tmp1->amplitude = realloc(p, regt->size*sizeof(COMPLEX_FLOAT));
+      tmp1->amplitude = realloc(p, regt->size
+				* quantum_amplitude_size(reg0));
 
       p = tmp2->amplitude;
       *tmp2 = *reg0;
-      tmp2->amplitude = realloc(p, regt->size*sizeof(COMPLEX_FLOAT));
+      tmp2->amplitude = realloc(p, regt->size
+				* quantum_amplitude_size(reg0));
 
       if(!(regt->amplitude && tmp1->amplitude && tmp2->amplitude))
 	quantum_error(QUANTUM_ENOMEM);
@@ -129,11 +133,13 @@ quantum_diag_time(double t, quantum_reg *reg0, quantum_reg *regt,
     {
       p = regt->amplitude;
       *regt = *reg0;
-      regt->amplitude = realloc(p, regt->size*sizeof(COMPLEX_FLOAT));
+      regt->amplitude = realloc(p, regt->size
+				* quantum_amplitude_size(reg0));
 
       p = tmp1->amplitude;
       *tmp1 = *reg0;
-      tmp1->amplitude = realloc(p, regt->size*sizeof(COMPLEX_FLOAT));
+      tmp1->amplitude = realloc(p, regt->size
+				* quantum_amplitude_size(reg0));
 
       quantum_adjoint(&H);
       
@@ -143,7 +149,8 @@ quantum_diag_time(double t, quantum_reg *reg0, quantum_reg *regt,
     }
 
   for(i=0; i<dim; i++)
-    tmp2->amplitude[i] = quantum_cexp(-(*w)[i]*t)*tmp1->amplitude[i];
+    quantum_set_amplitude(tmp2, i, quantum_cexp(-(*w)[i]*t)
+			  * quantum_get_amplitude(tmp1, i));
 
   quantum_mvmult(regt, H, tmp2);
 
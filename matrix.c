@@ -23,24 +23,241 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 
 #include "matrix.h"
 #include "config.h"
 #include "qcomplex.h"
 #include "error.h"
 
-/* Statistics of the memory consumption */
+/* Statistics of the memory consumption. The counters are updated
+   from several threads at once, so all changes are atomic. */
 
-unsigned long quantum_memman(long change)
+static long mem[QUANTUM_MEM_CATEGORIES];
+static long memtotal = 0, memmax = 0;
+
+/* Memory budget in bytes (0 = unlimited) and the number of times the
+   pruning threshold has been raised to stay within it */
+
+static unsigned long budget = 0;
+static int prunelevel = 0;
+
+#if defined(__GNUC__)
+#define quantum_memman_add(x, n) __sync_add_and_fetch(x, n)
+#else
+
+/* Without atomic builtins, serialize the updates */
+
+static long
+quantum_memman_add(long *x, long n)
+{
+  long r;
+
+#ifdef _OPENMP
+#pragma omp critical (quantum_memman)
+#endif
+  r = (*x += n);
+
+  return r;
+}
+#endif
+
+/* Account a CHANGE of the memory used for CATEGORY. Returns the total
+   amount of memory in use. */
+
+unsigned long
+quantum_memman_category(int category, long change)
+{
+  long total, max;
+
+  if(category < 0 || category >= QUANTUM_MEM_CATEGORIES)
+    category = QUANTUM_MEM_OTHER;
+
+  quantum_memman_add(&mem[category], change);
+  total = quantum_memman_add(&memtotal, change);
+
+  /* Relax the pruning again once memory is plentiful */
+
+  if(prunelevel && total < budget / 2)
+    prunelevel--;
+
+  /* Raise the peak if no other thread has raised it further */
+
+  for(max = memmax; total > max; max = memmax)
+    {
+#if defined(__GNUC__)
+      if(__sync_bool_compare_and_swap(&memmax, max, total))
+	break;
+#else
+#ifdef _OPENMP
+#pragma omp critical (quantum_memman)
+#endif
+      if(total > memmax)
+	memmax = total;
+#endif
+    }
+
+  return total;
+}
+
+/* Account a change of memory that belongs to no particular category */
+
+unsigned long
+quantum_memman(long change)
 {
-  static long mem = 0, max = 0;
+  return quantum_memman_category(QUANTUM_MEM_OTHER, change);
+}
+
+/* Return the amount of memory currently used for CATEGORY, or in total
+   for QUANTUM_MEM_TOTAL */
 
-  mem += change;
+unsigned long
+quantum_memman_usage(int category)
+{
+  if(category < 0 || category >= QUANTUM_MEM_CATEGORIES)
+    return quantum_memman_add(&memtotal, 0);
+
+  return quantum_memman_add(&mem[category], 0);
+}
+
+/* Return the maximum amount of memory used so far */
+
+unsigned long
+quantum_memman_peak()
+{
+  return quantum_memman_add(&memmax, 0);
+}
+
+/* Start tracking the peak again from the current usage */
+
+void
+quantum_memman_reset()
+{
+  long total = quantum_memman_usage(QUANTUM_MEM_TOTAL);
+
+#if defined(__GNUC__)
+  __sync_lock_test_and_set(&memmax, total);
+#else
+  memmax = total;
+#endif
+}
+
+/* Set the memory budget to BYTES, with 0 meaning no limit. Returns the
+   previous budget. */
+
+unsigned long
+quantum_memman_budget(unsigned long bytes)
+{
+  unsigned long old = budget;
 
-  if(mem > max)
-    max = mem;
+  budget = bytes;
+  prunelevel = 0;
+
+  return old;
+}
+
+/* Set the function to be called when an allocation would exceed the
+   budget. It receives the memory that would be in use and the budget,
+   and may free memory, write a checkpoint or raise the budget. */
+
+void *
+quantum_memman_handler(void *f(unsigned long, unsigned long))
+{
+  static void *handler = 0;
+
+  if(f)
+    handler = f;
+
+  return handler;
+}
+
+/* Check whether allocating REQUEST more bytes would exceed the
+   budget. The budget handler gets a chance to resolve the situation
+   first. */
+
+int
+quantum_memman_exceeds(long request)
+{
+  unsigned long want;
+  void (*p)(unsigned long, unsigned long);
+
+  if(!budget)
+    return 0;
+
+  want = quantum_memman_usage(QUANTUM_MEM_TOTAL) + request;
+
+  if(want <= budget)
+    return 0;
+
+  p = quantum_memman_handler(0);
+
+  if(p)
+    {
+      p(want, budget);
+      want = quantum_memman_usage(QUANTUM_MEM_TOTAL) + request;
+    }
+
+  return budget && want > budget;
+}
+
+/* Raise the pruning threshold to reduce the memory consumption.
+   Returns 0 if it cannot be raised any further. */
+
+int
+quantum_memman_degrade()
+{
+  if(prunelevel >= QUANTUM_PRUNE_LEVELS)
+    return 0;
+
+  prunelevel++;
+
+  return 1;
+}
+
+/* Factor by which the pruning threshold of the gates is raised */
+
+double
+quantum_memman_prune_factor()
+{
+  return prunelevel ? pow(10, prunelevel) : 1;
+}
+
+/* Set the budget from the QUANTUM_MEMORY_BUDGET environment variable,
+   which holds a number of bytes with an optional suffix k, M or G */
+
+void
+quantum_memman_env()
+{
+  static int done = 0;
+  char *c, *end;
+  double bytes;
+
+  if(done)
+    return;
+
+  done = 1;
+  c = getenv("QUANTUM_MEMORY_BUDGET");
+
+  if(!c)
+    return;
+
+  bytes = strtod(c, &end);
+
+  switch(*end)
+    {
+    case 'g':
+    case 'G':
+      bytes *= 1024;
+    case 'm':
+    case 'M':
+      bytes *= 1024;
+    case 'k':
+    case 'K':
+      bytes *= 1024;
+    }
 
-  return mem;
+  if(bytes > 0)
+    quantum_memman_budget(bytes);
 }
 
 /* Create a new COLS x ROWS matrix */
@@ -62,7 +279,8 @@ quantum_new_matrix(int cols, int rows)
   if(!m.t)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(sizeof(COMPLEX_FLOAT) * cols * rows);
+  quantum_memman_category(QUANTUM_MEM_MATRIX, 
+			  sizeof(COMPLEX_FLOAT) * cols * rows);
 
   return m;
 }
@@ -79,7 +297,8 @@ quantum_delete_matrix(quantum_matrix *m)
 #endif  
 
   free(m->t);
-  quantum_memman(-sizeof(COMPLEX_FLOAT) * m->cols * m->rows);
+  quantum_memman_category(QUANTUM_MEM_MATRIX, 
+			  -sizeof(COMPLEX_FLOAT) * m->cols * m->rows);
   m->t=0;
 }
 
@@ -39,7 +39,33 @@ typedef struct quantum_matrix_struct quantum_matrix;
 
 #define M(m,x,y) m.t[(x)+(y)*m.cols]
 
+/* Categories of memory accounted by quantum_memman_category() */
+
+#define QUANTUM_MEM_TOTAL -1
+#define QUANTUM_MEM_AMPLITUDE 0
+#define QUANTUM_MEM_STATE 1
+#define QUANTUM_MEM_HASH 2
+#define QUANTUM_MEM_MATRIX 3
+#define QUANTUM_MEM_OBJCODE 4
+#define QUANTUM_MEM_OTHER 5
+#define QUANTUM_MEM_CATEGORIES 6
+
+/* The pruning threshold is raised by a factor of ten at most this many
+   times to stay within the memory budget */
+
+#define QUANTUM_PRUNE_LEVELS 6
+
 extern unsigned long quantum_memman(long change);
+extern unsigned long quantum_memman_category(int category, long change);
+extern unsigned long quantum_memman_usage(int category);
+extern unsigned long quantum_memman_peak();
+extern void quantum_memman_reset();
+extern unsigned long quantum_memman_budget(unsigned long bytes);
+extern void *quantum_memman_handler(void *f(unsigned long, unsigned long));
+extern int quantum_memman_exceeds(long request);
+extern int quantum_memman_degrade();
+extern double quantum_memman_prune_factor();
+extern void quantum_memman_env();
 
 extern quantum_matrix quantum_new_matrix(int cols, int rows);
 extern void quantum_delete_matrix(quantum_matrix *m);
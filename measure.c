@@ -33,7 +33,10 @@
 #include "qcomplex.h"
 #include "config.h"
 #include "objcode.h"
+#include "profile.h"
 #include "error.h"
+#include "numa.h"
+#include "precision.h"
 
 /* Generate a uniformly distributed random number between 0 and 1 */
 
@@ -48,31 +51,53 @@ quantum_frand()
 MAX_UNSIGNED
 quantum_measure(quantum_reg reg)
 {
-  double r;
-  int i;
+  quantum_profile_timer prof;
+  double r, total;
+  int i, j;
 
-  if(quantum_objcode_put(MEASURE))
+  if(quantum_objcode_put(MEASURE, &reg))
     return 0;
 
+  quantum_profile_enter(&prof, &reg);
+
   /* Get a random number between 0 and 1 */
   
   r = quantum_frand();
 
-  for (i=0; i<reg.size; i++)
+  /* Find the base state at which the cumulated probability exceeds
+     the random number and return it as the result */
+
+  i = quantum_kernel_select(&reg, r);
+
+  /* The sum of all probabilities is less than R. This happens after
+     applying a non-normalized matrix or when rounding errors have
+     reduced the norm. R is then uniformly distributed between the
+     actual sum and 1, so map it back to a fraction of the sum. */
+
+  total = (i < 0) ? quantum_kernel_probsum(&reg, 0, 0) : 0;
+
+  if(total > 0)
     {
-      /* If the random number is less than the probability of the
-	 given base state - r, return the base state as the
-	 result. Otherwise, continue with the next base state. */
+      if(total < 1)
+	r = (r > total) ? (r - total) / (1 - total) : 0;
+
+      i = quantum_kernel_select(&reg, r * total);
+
+      /* Still possible for R close to 1 due to rounding */
 
-      r -= quantum_prob_inline(reg.amplitude[i]);
-      if(0 >= r)
-	return reg.state[i];
+      for(j=reg.size-1; (i < 0) && (j >= 0); j--)
+	{
+	  if(quantum_prob(quantum_get_amplitude(&reg, j)) > 0)
+	    i = j;
+	}
     }
 
-  /* The sum of all probabilities is less than 1. Usually, the cause
-     for this is the application of a non-normalized matrix, but there
-     is a slim chance that rounding errors may lead to this as
-     well. */
+  quantum_profile_leave(&prof, MEASURE, &reg);
+
+  if(i >= 0)
+    return quantum_unmap_state(reg.state[i], &reg);
+
+  /* The register is empty */
 
   return -1;
 }
@@ -85,24 +110,22 @@ quantum_measure(quantum_reg reg)
 int
 quantum_bmeasure(int pos, quantum_reg *reg)
 {
-  int i;
+  quantum_profile_timer prof;
   int result=0;
   double pa=0, r;
   MAX_UNSIGNED pos2;
   quantum_reg out;
   
-  if(quantum_objcode_put(BMEASURE, pos))
+  if(quantum_objcode_put(BMEASURE, reg, pos))
      return 0;
 
-  pos2 = (MAX_UNSIGNED) 1 << pos;
+  quantum_profile_enter(&prof, reg);
+
+  pos2 = (MAX_UNSIGNED) 1 << quantum_qubit(pos, reg);
 
   /* Sum up the probability for 0 being the result */
 
-  for(i=0; i<reg->size; i++)
-    {
-      if(!(reg->state[i] & pos2))
-	pa += quantum_prob_inline(reg->amplitude[i]);
-    }
+  pa = quantum_kernel_probsum(reg, pos2, 0);
 
   /* Compare the probability for 0 with a random number and determine
      the result of the measurement */
@@ -117,6 +140,8 @@ quantum_bmeasure(int pos, quantum_reg *reg)
   quantum_delete_qureg_hashpreserve(reg);
   *reg = out;
 
+  quantum_profile_leave(&prof, BMEASURE, reg);
+
   return result;
 }
 
@@ -126,24 +151,23 @@ quantum_bmeasure(int pos, quantum_reg *reg)
 int
 quantum_bmeasure_bitpreserve(int pos, quantum_reg *reg)
 {
+  quantum_profile_timer prof;
   int i, j;
   int size=0, result=0;
   double d=0, pa=0, r;
   MAX_UNSIGNED pos2;
   quantum_reg out;
 
-  if(quantum_objcode_put(BMEASURE_P, pos))
+  if(quantum_objcode_put(BMEASURE_P, reg, pos))
      return 0;
 
-  pos2 = (MAX_UNSIGNED) 1 << pos;
+  quantum_profile_enter(&prof, reg);
+
+  pos2 = (MAX_UNSIGNED) 1 << quantum_qubit(pos, reg);
 
   /* Sum up the probability for 0 being the result */
 
-  for(i=0; i<reg->size; i++)
-    {
-      if(!(reg->state[i] & pos2))
-	pa += quantum_prob_inline(reg->amplitude[i]);
-    }
+  pa = quantum_kernel_probsum(reg, pos2, 0);
 
   /* Compare the probability for 0 with a random number and determine
      the result of the measurement */
@@ -156,54 +180,49 @@ quantum_bmeasure_bitpreserve(int pos, quantum_reg *reg)
   /* Eradicate all amplitudes of base states which have been ruled out
      by the measurement and get the absolute of the new register */
 
-  for(i=0;i<reg->size;i++)
+  quantum_kernel_phase(reg, 0, 0, pos2, result, !result);
+  d = quantum_kernel_probsum(reg, pos2, result ? pos2 : 0);
+
+  for(i=0; i<reg->size; i++)
     {
-      if(reg->state[i] & pos2)
-	{
-	  if(!result)
-	    reg->amplitude[i] = 0;
-	  else
-	    {
-	      d += quantum_prob_inline(reg->amplitude[i]);
-	      size++;
-	    }
-	}
-      else
-	{
-	  if(result)
-	    reg->amplitude[i] = 0;
-	  else
-	    {
-	      d += quantum_prob_inline(reg->amplitude[i]);
-	      size++;
-	    }
-	}
+      if(quantum_get_amplitude(reg, i))
+	size++;
     }
 
   /* Build the new quantum register */
 
   out.size = size;
-  out.state = calloc(size, sizeof(MAX_UNSIGNED));
-  out.amplitude = calloc(size, sizeof(COMPLEX_FLOAT));
+  out.state = quantum_numa_calloc(size, sizeof(MAX_UNSIGNED),
+				  QUANTUM_NUMA_LOCAL);
+  out.amplitude = quantum_numa_calloc(size, quantum_amplitude_size(reg),
+				      QUANTUM_NUMA_LOCAL);
 
   if(!(out.state && out.amplitude))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(size * (sizeof(MAX_UNSIGNED) + sizeof(COMPLEX_FLOAT)));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  size * quantum_amplitude_size(reg));
+  quantum_memman_category(QUANTUM_MEM_STATE, size * sizeof(MAX_UNSIGNED));
 
   out.hashw = reg->hashw;
   out.hash = reg->hash;
   out.width = reg->width;
+  out.recorder = reg->recorder;
+  out.map = reg->map;
+  out.precision = reg->precision;
+  out.renormalized = reg->renormalized;
+  reg->map = 0;
 
   /* Determine the numbers of the new base states and norm the quantum
      register */
   
   for(i=0, j=0; i<reg->size; i++)
     {
-      if(reg->amplitude[i])
+      if(quantum_get_amplitude(reg, i))
 	{
 	  out.state[j] = reg->state[i];
-	  out.amplitude[j] = reg->amplitude[i] * 1 / (float) sqrt(d);
+	  quantum_set_amplitude(&out, j, quantum_get_amplitude(reg, i)
+				* 1 / (float) sqrt(d));
 	
 	  j++;
 	}
@@ -211,5 +230,8 @@ quantum_bmeasure_bitpreserve(int pos, quantum_reg *reg)
 
   quantum_delete_qureg_hashpreserve(reg);
   *reg = out;
+
+  quantum_profile_leave(&prof, BMEASURE_P, reg);
+
   return result;
 }
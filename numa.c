@@ -0,0 +1,328 @@
+/* numa.c: Placement of quantum registers on NUMA machines
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "numa.h"
+
+/* Linux places a page on the node of the thread that first writes to
+   it. The gates run `omp parallel for' loops with a static schedule
+   over the index of the register, so large arrays are zeroed with the
+   same schedule. Each thread then finds its part of the register in
+   local memory. */
+
+/* Maximum number of nodes and the memory policy understood by the
+   mbind system call */
+
+#define QUANTUM_NUMA_MAXNODES 1024
+#define QUANTUM_MPOL_INTERLEAVE 3
+
+static int policy = QUANTUM_NUMA_AUTO;
+static int nodes = 0;
+static unsigned long nodemask[QUANTUM_NUMA_MAXNODES
+			      / (8 * sizeof(unsigned long))];
+
+/* Set the placement policy for large arrays. Returns the previous
+   policy. */
+
+int
+quantum_numa_policy(int p)
+{
+  int old = policy;
+
+  quantum_numa_env();
+  policy = p;
+
+  return old;
+}
+
+/* Return the number of online NUMA nodes */
+
+int
+quantum_numa_nodes()
+{
+  FILE *f;
+  int a, b, c, w = 8 * sizeof(unsigned long);
+
+  if(nodes)
+    return nodes;
+
+  /* The list looks like "0-1" or "0,2-3" */
+
+  f = fopen("/sys/devices/system/node/online", "r");
+
+  while(f && fscanf(f, "%i", &a) == 1)
+    {
+      b = a;
+      c = fgetc(f);
+
+      if(c == '-')
+	{
+	  if(fscanf(f, "%i", &b) != 1)
+	    break;
+	  c = fgetc(f);
+	}
+
+      for(; a <= b && a < QUANTUM_NUMA_MAXNODES; a++)
+	{
+	  nodemask[a / w] |= 1UL << (a % w);
+	  nodes++;
+	}
+
+      if(c != ',')
+	break;
+    }
+
+  if(f)
+    fclose(f);
+
+  if(!nodes)
+    {
+      nodemask[0] = 1;
+      nodes = 1;
+    }
+
+  return nodes;
+}
+
+/* The policy in effect for the next allocation */
+
+static int
+quantum_numa_current()
+{
+  quantum_numa_env();
+
+  if(policy == QUANTUM_NUMA_AUTO)
+    return (quantum_numa_nodes() > 1) ? QUANTUM_NUMA_FIRSTTOUCH
+      : QUANTUM_NUMA_OFF;
+
+  return policy;
+}
+
+/* Spread the pages of LEN bytes at P over all nodes. This is only a
+   hint, so failures are ignored. */
+
+static void
+quantum_numa_interleave(void *p, size_t len)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+  if(quantum_numa_nodes() > 1)
+    syscall(SYS_mbind, p, len, QUANTUM_MPOL_INTERLEAVE, nodemask,
+	    (unsigned long) QUANTUM_NUMA_MAXNODES, 0);
+#endif
+}
+
+/* Copy the elements LO to HI-1 of SRC that are below OLDN into DST and
+   zero the others */
+
+static void
+quantum_numa_part(char *dst, char *src, long oldn, long lo, long hi,
+		  size_t size)
+{
+  long m = (hi < oldn) ? hi : oldn;
+
+  if(lo < m)
+    memcpy(&dst[lo * size], &src[lo * size], (m - lo) * size);
+
+  if(m < lo)
+    m = lo;
+
+  if(m < hi)
+    memset(&dst[m * size], 0, (hi - m) * size);
+}
+
+/* Fill the N elements of DST with the OLDN elements of SRC followed by
+   zeros. The threads split the index range like `schedule(static)'. */
+
+static void
+quantum_numa_fill(void *dst, void *src, long oldn, long n, size_t size)
+{
+#ifdef _OPENMP
+#pragma omp parallel
+  {
+    int t = omp_get_thread_num(), k = omp_get_num_threads();
+    long q = n / k, r = n % k, lo;
+
+    lo = q * t + ((t < r) ? t : r);
+    quantum_numa_part(dst, src, oldn, lo, lo + q + (t < r), size);
+  }
+#else
+  quantum_numa_part(dst, src, oldn, 0, n, size);
+#endif
+}
+
+/* Allocate N zeroed elements of SIZE bytes. ACCESS tells how the array
+   will be used, random accesses are always interleaved. */
+
+void *
+quantum_numa_calloc(long n, size_t size, int access)
+{
+  void *p;
+  int current = quantum_numa_current();
+
+  if(current == QUANTUM_NUMA_OFF || n * size < QUANTUM_NUMA_MIN)
+    return calloc(n, size);
+
+  if(posix_memalign(&p, sysconf(_SC_PAGESIZE), n * size))
+    return 0;
+
+  if(current == QUANTUM_NUMA_INTERLEAVE || access == QUANTUM_NUMA_RANDOM)
+    quantum_numa_interleave(p, n * size);
+
+  quantum_numa_fill(p, 0, 0, n, size);
+
+  return p;
+}
+
+/* Resize the array P of OLDN elements to N elements, zeroing the new
+   ones. A growing array is moved so that the threads touch their part
+   of it first. Returns 0 if there is not enough memory, leaving P
+   untouched. */
+
+void *
+quantum_numa_realloc(void *p, long oldn, long n, size_t size)
+{
+  void *q;
+  int current = quantum_numa_current();
+
+  if(current == QUANTUM_NUMA_OFF || n <= oldn || n * size < QUANTUM_NUMA_MIN)
+    {
+      q = realloc(p, n * size);
+
+      if(q && n > oldn)
+	memset((char *) q + oldn * size, 0, (n - oldn) * size);
+
+      return q;
+    }
+
+  if(posix_memalign(&q, sysconf(_SC_PAGESIZE), n * size))
+    return 0;
+
+  if(current == QUANTUM_NUMA_INTERLEAVE)
+    quantum_numa_interleave(q, n * size);
+
+  quantum_numa_fill(q, p, oldn, n, size);
+  free(p);
+
+  return q;
+}
+
+/* Bind each OpenMP thread to one of the CPUs the process may run on.
+   The threads are reused by later parallel regions of the same size,
+   so this only needs to be done once. Returns -1 if pinning is not
+   supported or failed for any thread. */
+
+int
+quantum_numa_pin(int mode)
+{
+#if defined(_OPENMP) && defined(CPU_SET)
+  static cpu_set_t allowed;
+  static int ncpu = 0;
+  static int cpus[CPU_SETSIZE];
+  int i, failed = 0;
+
+  if(mode == QUANTUM_PIN_NONE)
+    return 0;
+
+  /* Remember the original set, as the calling thread is pinned too */
+
+  if(!ncpu)
+    {
+      if(sched_getaffinity(0, sizeof(allowed), &allowed))
+	return -1;
+
+      for(i=0; i<CPU_SETSIZE; i++)
+	{
+	  if(CPU_ISSET(i, &allowed))
+	    cpus[ncpu++] = i;
+	}
+
+      if(!ncpu)
+	return -1;
+    }
+
+#pragma omp parallel reduction (+:failed)
+  {
+    int t = omp_get_thread_num(), k = omp_get_num_threads(), c;
+    cpu_set_t set;
+
+    if(mode == QUANTUM_PIN_SPREAD && k < ncpu)
+      c = cpus[(long) t * ncpu / k];
+    else
+      c = cpus[t % ncpu];
+
+    CPU_ZERO(&set);
+    CPU_SET(c, &set);
+
+    if(sched_setaffinity(0, sizeof(set), &set))
+      failed++;
+  }
+
+  return failed ? -1 : 0;
+#else
+  return (mode == QUANTUM_PIN_NONE) ? 0 : -1;
+#endif
+}
+
+/* Read the placement from the environment. QUANTUM_NUMA can be "off",
+   "firsttouch", "interleave" or "auto", QUANTUM_PIN can be "compact" or
+   "spread". */
+
+void
+quantum_numa_env()
+{
+  static int done = 0;
+  char *c;
+
+  if(done)
+    return;
+
+  done = 1;
+  c = getenv("QUANTUM_NUMA");
+
+  if(c)
+    {
+      if(!strcmp(c, "off"))
+	policy = QUANTUM_NUMA_OFF;
+      else if(!strcmp(c, "firsttouch"))
+	policy = QUANTUM_NUMA_FIRSTTOUCH;
+      else if(!strcmp(c, "interleave"))
+	policy = QUANTUM_NUMA_INTERLEAVE;
+    }
+
+  c = getenv("QUANTUM_PIN");
+
+  if(c && !strcmp(c, "compact"))
+    quantum_numa_pin(QUANTUM_PIN_COMPACT);
+  else if(c && !strcmp(c, "spread"))
+    quantum_numa_pin(QUANTUM_PIN_SPREAD);
+}
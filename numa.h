@@ -0,0 +1,59 @@
+/* numa.h: Declarations for numa.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __NUMA_H
+
+#define __NUMA_H
+
+#include <stddef.h>
+
+/* Placement of the pages of large arrays */
+
+#define QUANTUM_NUMA_AUTO 0        /* first touch if there are several nodes */
+#define QUANTUM_NUMA_OFF 1         /* plain calloc() */
+#define QUANTUM_NUMA_FIRSTTOUCH 2  /* each thread zeroes its own part */
+#define QUANTUM_NUMA_INTERLEAVE 3  /* pages spread round-robin over nodes */
+
+/* How an array is accessed */
+
+#define QUANTUM_NUMA_LOCAL 0   /* by parallel loops over the index */
+#define QUANTUM_NUMA_RANDOM 1  /* at random positions, like the hash table */
+
+/* Placement of the OpenMP threads */
+
+#define QUANTUM_PIN_NONE 0
+#define QUANTUM_PIN_COMPACT 1  /* thread i on the i-th allowed CPU */
+#define QUANTUM_PIN_SPREAD 2   /* threads evenly spaced over the CPUs */
+
+/* Arrays smaller than this are allocated with calloc() */
+
+#define QUANTUM_NUMA_MIN (1 << 20)
+
+extern int quantum_numa_policy(int policy);
+extern int quantum_numa_nodes();
+extern void *quantum_numa_calloc(long n, size_t size, int access);
+extern void *quantum_numa_realloc(void *p, long oldn, long n, size_t size);
+extern int quantum_numa_pin(int mode);
+extern void quantum_numa_env();
+
+#endif
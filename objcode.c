@@ -22,37 +22,38 @@
 */
 
 #include <stdarg.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-#include "objcode.h"
 #include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "objcode.h"
+#include "compress.h"
 #include "matrix.h"
 #include "qureg.h"
 #include "gates.h"
 #include "measure.h"
+#include "decoherence.h"
+#include "qec.h"
 #include "error.h"
+#include "context.h"
+#include "parallel.h"
+#include "pool.h"
 
-/* status of the objcode functionality (0 = disabled) */
-
-int opstatus = 0;
-
-/* Generated OBJCODE data */
-
-unsigned char *objcode = 0;
-
-/* Current POSITION of the last instruction in the OBJCODE array */
-
-unsigned long position = 0;
-
-/* Number of ALLOCATED pages */
-
-unsigned long allocated = 0;
-
-/* file to write the object code to, if not given */
-
-char *globalfile;
+/* The default recorder used by quantum_objcode_start and friends,
+   the encoding of the next recording and the file to write the object
+   code to are kept in the current context */
 
 /* Convert a big integer to a byte array */
 
@@ -126,25 +127,458 @@ int quantum_char2int(unsigned char *buf)
 
 double quantum_char2double(unsigned char *buf)
 {
-  double *d = (double *) buf;
+  double d;
+
+  memcpy(&d, buf, sizeof(double));
+
+  return d;
+}
+
+/* Store the lowest 32 bits of N as little-endian bytes */
+
+static void
+quantum_put32(uint32_t n, unsigned char *buf)
+{
+  int i;
+
+  for(i=0; i<4; i++)
+    buf[i] = n >> (8 * i);
+}
+
+/* Store a 64-bit integer as little-endian bytes */
+
+static void
+quantum_put64(uint64_t n, unsigned char *buf)
+{
+  int i;
+
+  for(i=0; i<8; i++)
+    buf[i] = n >> (8 * i);
+}
+
+/* Store a double as a little-endian IEEE 754 bit pattern */
+
+static void
+quantum_putdouble(double d, unsigned char *buf)
+{
+  uint64_t n;
+
+  memcpy(&n, &d, sizeof(double));
+  quantum_put64(n, buf);
+}
+
+static uint32_t
+quantum_get32(const unsigned char *buf)
+{
+  return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8)
+    | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+static uint64_t
+quantum_get64(const unsigned char *buf)
+{
+  return (uint64_t) quantum_get32(buf) 
+    | ((uint64_t) quantum_get32(&buf[4]) << 32);
+}
+
+static double
+quantum_getdouble(const unsigned char *buf)
+{
+  uint64_t n;
+  double d;
+
+  n = quantum_get64(buf);
+  memcpy(&d, &n, sizeof(double));
+
+  return d;
+}
+
+/* Store N as a variable-length integer. Returns the number of bytes
+   used. */
+
+static int
+quantum_putvarint(uint64_t n, unsigned char *buf)
+{
+  int i;
+
+  for(i=0; n >= 0x80; i++)
+    {
+      buf[i] = (n & 0x7F) | 0x80;
+      n >>= 7;
+    }
+
+  buf[i] = n;
+
+  return i + 1;
+}
+
+/* Read a variable-length integer from at most AVAIL bytes. Returns the
+   number of bytes used or 0 if the integer is incomplete. */
+
+static int
+quantum_getvarint(const unsigned char *buf, size_t avail, uint64_t *n)
+{
+  int i;
+
+  *n = 0;
+
+  for(i=0; (i<avail) && (i<10); i++)
+    {
+      *n |= (uint64_t) (buf[i] & 0x7F) << (7 * i);
+
+      if(!(buf[i] & 0x80))
+	return i + 1;
+    }
+
+  return 0;
+}
+
+/* Store the integer operand I at position SLOT of the current
+   operation. Returns the number of bytes used. */
+
+static int
+quantum_objcode_putint(quantum_objcode_recorder *rec, int i, int slot, 
+		       unsigned char *buf)
+{
+  int32_t diff;
+
+  if(!(rec->flags & OBJCODE_COMPACT))
+    {
+      quantum_put32(i, buf);
+      return 4;
+    }
+
+  diff = (uint32_t) i - (uint32_t) rec->last[slot];
+  rec->last[slot] = i;
+
+  return quantum_putvarint(((uint32_t) diff << 1) ^ (uint32_t) (diff >> 31),
+			   buf);
+}
+
+/* Build the file header for the recorded object code */
+
+static void
+quantum_objcode_header(quantum_objcode_recorder *rec, unsigned char *buf)
+{
+  memset(buf, 0, OBJCODE_HEADER);
+  memcpy(buf, OBJCODE_MAGIC, 4);
+  quantum_put32(OBJCODE_VERSION, &buf[4]);
+  quantum_put32(OBJCODE_BYTEORDER, &buf[8]);
+  quantum_put32(rec->flags, &buf[12]);
+  quantum_put32(rec->opwidth, &buf[16]);
+  quantum_put64(rec->opcount, &buf[24]);
+}
+
+/* Write LEN bytes of recorded operations to F, compressing them if
+   requested. Returns non-zero on errors. */
+
+static int
+quantum_objcode_block(quantum_objcode_recorder *rec, FILE *f, 
+		      unsigned char *buf, unsigned long len)
+{
+  unsigned long raw, n;
+  unsigned char lz[8 + QUANTUM_LZ_BOUND(OBJCODE_PAGE)];
+
+  if(!(rec->flags & OBJCODE_LZ))
+    return fwrite(buf, 1, len, f) != len;
+
+  for(; len; len-=raw, buf+=raw)
+    {
+      raw = len < OBJCODE_PAGE ? len : OBJCODE_PAGE;
+      n = quantum_lz_compress(buf, raw, &lz[8]);
+
+      /* Keep incompressible data as it is */
+
+      if(n >= raw)
+	{
+	  n = raw;
+	  memcpy(&lz[8], buf, raw);
+	}
+
+      quantum_put32(raw, lz);
+      quantum_put32(n, &lz[4]);
+
+      if(fwrite(lz, 1, n + 8, f) != n + 8)
+	return 1;
+    }
+
+  return 0;
+}
+
+/* Background thread writing the pages handed over by the recorder */
+
+#ifdef HAVE_LIBPTHREAD
+
+static void *
+quantum_objcode_writer(void *arg)
+{
+  quantum_objcode_recorder *rec = arg;
+  unsigned char *buf;
+  unsigned long len;
+
+  pthread_mutex_lock(&rec->lock);
+
+  for(;;)
+    {
+      while(!rec->pending && !rec->done)
+	pthread_cond_wait(&rec->cond, &rec->lock);
+
+      if(!rec->pending)
+	break;
+
+      buf = rec->pending;
+      len = rec->pendinglen;
+
+      pthread_mutex_unlock(&rec->lock);
+
+      if(quantum_objcode_block(rec, rec->file, buf, len))
+	rec->error = 1;
+
+      pthread_mutex_lock(&rec->lock);
+
+      /* The page may now be reused by the recorder */
+
+      rec->pending = 0;
+      pthread_cond_broadcast(&rec->cond);
+    }
+
+  pthread_mutex_unlock(&rec->lock);
+
+  return 0;
+}
+
+#endif
+
+/* Hand the current page over to the writer and continue recording in
+   the other buffer */
+
+static void
+quantum_objcode_flushpage(quantum_objcode_recorder *rec)
+{
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&rec->lock);
+
+  while(rec->pending)
+    pthread_cond_wait(&rec->cond, &rec->lock);
+
+  rec->pending = rec->objcode;
+  rec->pendinglen = rec->position;
+  pthread_cond_broadcast(&rec->cond);
+
+  pthread_mutex_unlock(&rec->lock);
+
+  rec->cur ^= 1;
+  rec->objcode = rec->buf[rec->cur];
+#else
+  if(quantum_objcode_block(rec, rec->file, rec->objcode, rec->position))
+    rec->error = 1;
+#endif
+
+  rec->position = 0;
+}
+
+/* Write out all recorded data and update the file header */
+
+static void
+quantum_objcode_sync(quantum_objcode_recorder *rec)
+{
+  unsigned char header[OBJCODE_HEADER];
+
+  if(rec->position)
+    quantum_objcode_flushpage(rec);
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&rec->lock);
+
+  while(rec->pending)
+    pthread_cond_wait(&rec->cond, &rec->lock);
+
+  pthread_mutex_unlock(&rec->lock);
+#endif
+
+  quantum_objcode_header(rec, header);
+
+  if(fseek(rec->file, 0, SEEK_SET)
+     || (fwrite(header, OBJCODE_HEADER, 1, rec->file) != 1)
+     || fseek(rec->file, 0, SEEK_END) || fflush(rec->file))
+    rec->error = 1;
+
+  if(rec->error)
+    {
+      fprintf(stderr, "Error while writing object code to %s\n", 
+	      rec->filename);
+      rec->error = 0;
+    }
+}
+
+/* Attach FILE to the recording and start streaming to it. Data
+   recorded so far is written out immediately. Only two pages are held
+   in memory from now on: recording continues in one of them while the
+   other one is written to disk by a background thread. */
+
+static int
+quantum_objcode_stream(quantum_objcode_recorder *rec, char *file)
+{
+  unsigned char header[OBJCODE_HEADER];
+
+  rec->file = fopen(file, "w");
+
+  if(!rec->file)
+    {
+      fprintf(stderr, "Could not open %s: ", file);
+      perror(0);
+      return -1;
+    }
+
+  /* FILE belongs to the caller and may not outlive the recording */
+
+  rec->filename = strdup(file);
+
+  if(!rec->filename)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman((strlen(file) + 1) * sizeof(char));
+
+  rec->error = 0;
+
+  /* The number of operations is not known yet and is filled in when
+     the recording is finished */
+
+  quantum_objcode_header(rec, header);
+  quantum_put64(0, &header[24]);
+
+  if((fwrite(header, OBJCODE_HEADER, 1, rec->file) != 1)
+     || quantum_objcode_block(rec, rec->file, rec->objcode, rec->position))
+    rec->error = 1;
+
+  rec->position = 0;
+
+  /* Switch to double buffering */
+
+  if(rec->allocated != 1)
+    {
+      rec->objcode = realloc(rec->objcode, OBJCODE_PAGE);
+
+      if(!rec->objcode)
+	quantum_error(QUANTUM_ENOMEM);
+
+      quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			      -(rec->allocated - 1) * OBJCODE_PAGE
+			      * sizeof(char));
+    }
+
+  rec->buf[0] = rec->objcode;
+  rec->buf[1] = malloc(OBJCODE_PAGE * sizeof(char));
+
+  if(!rec->buf[1])
+    quantum_error(QUANTUM_ENOMEM);
+
+  rec->allocated = 2;
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, OBJCODE_PAGE * sizeof(char));
+
+  rec->cur = 0;
+
+#ifdef HAVE_LIBPTHREAD
+  rec->pending = 0;
+  rec->done = 0;
+  pthread_mutex_init(&rec->lock, 0);
+  pthread_cond_init(&rec->cond, 0);
+
+  if(pthread_create(&rec->thread, 0, quantum_objcode_writer, rec))
+    quantum_error(QUANTUM_FAILURE);
+#endif
+
+  return 0;
+}
+
+/* Flush all data to the stream, stop the writer and close the file */
+
+static void
+quantum_objcode_endstream(quantum_objcode_recorder *rec)
+{
+  quantum_objcode_sync(rec);
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&rec->lock);
+  rec->done = 1;
+  pthread_cond_broadcast(&rec->cond);
+  pthread_mutex_unlock(&rec->lock);
+
+  pthread_join(rec->thread, 0);
+  pthread_mutex_destroy(&rec->lock);
+  pthread_cond_destroy(&rec->cond);
+#endif
+
+  fclose(rec->file);
+  rec->file = 0;
+
+  quantum_memman(-(strlen(rec->filename) + 1) * sizeof(char));
+  free(rec->filename);
+  rec->filename = 0;
+
+  /* Both pages are released by quantum_objcode_finish */
+
+  rec->objcode = rec->buf[0];
+  free(rec->buf[1]);
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, -OBJCODE_PAGE * sizeof(char));
+  rec->allocated = 1;
+  rec->buf[0] = 0;
+  rec->buf[1] = 0;
+}
+
+/* Start a recording. If FILE is given, the object code is streamed
+   to it. */
+
+static void
+quantum_objcode_begin(quantum_objcode_recorder *rec, char *file)
+{
+  rec->status = 1;
+  rec->allocated = 1;
+  rec->position = 0;
+  rec->opcount = 0;
+  rec->opwidth = 0;
+  rec->flags = quantum_get_context()->opformat;
+  memset(rec->last, 0, sizeof(rec->last));
+  rec->objcode = malloc(OBJCODE_PAGE * sizeof(char));
+
+  if(!rec->objcode)
+    quantum_error(QUANTUM_ENOMEM);
 
-  return *d;
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, OBJCODE_PAGE * sizeof(char));
+
+  if(file)
+    quantum_objcode_stream(rec, file);
 }
 
+/* Finish a recording and release its memory */
+
+static void
+quantum_objcode_finish(quantum_objcode_recorder *rec)
+{
+  if(rec->file)
+    quantum_objcode_endstream(rec);
+
+  rec->status = 0;
+  free(rec->objcode);
+  rec->objcode = 0;
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  - rec->allocated * OBJCODE_PAGE * sizeof(char));
+  rec->allocated = 0;
+  rec->position = 0;
+}
 
-/* Start object code recording */
+/* Start object code recording. If a file has already been set with
+   quantum_objcode_file, the object code is streamed to it. */
 
 void
 quantum_objcode_start()
 {
-  opstatus = 1;
-  allocated = 1;
-  objcode = malloc(OBJCODE_PAGE * sizeof(char));
+  quantum_context *ctx = quantum_get_context();
 
-  if(!objcode)
-    quantum_error(QUANTUM_ENOMEM);
+  if(ctx->recorder.status)
+    return;
 
-  quantum_memman(OBJCODE_PAGE * sizeof(char));
+  quantum_objcode_begin(&ctx->recorder, ctx->objfile);
 }
 
 /* Stop object code recording */
@@ -152,54 +586,49 @@ quantum_objcode_start()
 void
 quantum_objcode_stop()
 {
-  opstatus = 0;
-  free(objcode);
-  objcode = 0;
-  quantum_memman(- allocated * OBJCODE_PAGE * sizeof(char));
-  allocated = 0;
+  quantum_objcode_finish(&quantum_get_context()->recorder);
 }
 
-/* Store an operation with its arguments in the object code data */
+/* Store an operation with its arguments in the object code data of
+   REC. The INIT operation takes the initial basis state and the width
+   of the register. */
 
-int
-quantum_objcode_put(int operation, ...)
+static int
+quantum_objcode_vput(quantum_objcode_recorder *rec, int operation, 
+		     va_list args)
 {
   int i, size = 0;
-  va_list args;
-  unsigned char buf[80];
+  unsigned char buf[OBJBUF_SIZE];
   double d;
   MAX_UNSIGNED mu;
 
-  if(!opstatus)
-    return 0;
-
-  va_start(args, operation);
-  
   buf[0] = operation;
   
   switch(operation)
     {
     case INIT:
       mu = va_arg(args, MAX_UNSIGNED);
-      quantum_mu2char(mu, &buf[1]);
-      size = sizeof(MAX_UNSIGNED) + 1;
+      i = va_arg(args, int);
+      if(rec->flags & OBJCODE_COMPACT)
+	size = 1 + quantum_putvarint(mu, &buf[1]);
+      else
+	{
+	  quantum_put64(mu, &buf[1]);
+	  size = 9;
+	}
+      size += quantum_objcode_putint(rec, i, 0, &buf[size]);
+      if(!rec->opwidth)
+	rec->opwidth = i;
       break;
     case CNOT:
     case COND_PHASE:
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[1]);
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[sizeof(int)+1]);
-      size = 2 * sizeof(int) + 1;
+      size = 1 + quantum_objcode_putint(rec, va_arg(args, int), 0, &buf[1]);
+      size += quantum_objcode_putint(rec, va_arg(args, int), 1, &buf[size]);
       break;
     case TOFFOLI:
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[1]);
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[sizeof(int)+1]);
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[2*sizeof(int)+1]);
-      size = 3 * sizeof(int) + 1;
+      size = 1 + quantum_objcode_putint(rec, va_arg(args, int), 0, &buf[1]);
+      size += quantum_objcode_putint(rec, va_arg(args, int), 1, &buf[size]);
+      size += quantum_objcode_putint(rec, va_arg(args, int), 2, &buf[size]);
       break;
     case SIGMA_X:
     case SIGMA_Y:
@@ -208,29 +637,25 @@ quantum_objcode_put(int operation, ...)
     case BMEASURE:
     case BMEASURE_P:
     case SWAPLEADS:
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[1]);
-      size = sizeof(int) + 1;
+      size = 1 + quantum_objcode_putint(rec, va_arg(args, int), 0, &buf[1]);
       break;
     case ROT_X:
     case ROT_Y:
     case ROT_Z:
     case PHASE_KICK:
     case PHASE_SCALE:
-      i = va_arg(args, int);
+      size = 1 + quantum_objcode_putint(rec, va_arg(args, int), 0, &buf[1]);
       d = va_arg(args, double);
-      quantum_int2char(i, &buf[1]);
-      quantum_double2char(d, &buf[sizeof(int)+1]);
-      size = sizeof(int) + sizeof(double) + 1;
+      quantum_putdouble(d, &buf[size]);
+      size += 8;
       break;
     case CPHASE_KICK:
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[1]);
-      i = va_arg(args, int);
-      quantum_int2char(i, &buf[sizeof(int)+1]);
+    case CPHASE_SHIFT:
+      size = 1 + quantum_objcode_putint(rec, va_arg(args, int), 0, &buf[1]);
+      size += quantum_objcode_putint(rec, va_arg(args, int), 1, &buf[size]);
       d = va_arg(args, double);
-      quantum_double2char(d, &buf[2*sizeof(int)+1]);
-      size = 2 * sizeof(int) + sizeof(double) + 1;
+      quantum_putdouble(d, &buf[size]);
+      size += 8;
       break;
     case MEASURE:
     case NOP:
@@ -239,61 +664,151 @@ quantum_objcode_put(int operation, ...)
     default:
       quantum_error(QUANTUM_EOPCODE);
     }
+
+  if(rec->file)
+    {
+      if(rec->position + size > OBJCODE_PAGE)
+	quantum_objcode_flushpage(rec);
+    }
   
-  if((position+size) / OBJCODE_PAGE > position / OBJCODE_PAGE)
+  else if((rec->position + size) / OBJCODE_PAGE 
+	  > rec->position / OBJCODE_PAGE)
     {
-      allocated++;
-      objcode = realloc(objcode, allocated * OBJCODE_PAGE);
+      rec->allocated++;
+      rec->objcode = realloc(rec->objcode, rec->allocated * OBJCODE_PAGE);
 
-      if(!objcode)
+      if(!rec->objcode)
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(OBJCODE_PAGE * sizeof(char));
+      quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			      OBJCODE_PAGE * sizeof(char));
     }
 
   for(i=0; i<size; i++)
     {
-      objcode[position] = buf[i];
-      position++;
+      rec->objcode[rec->position] = buf[i];
+      rec->position++;
     }
 
+  rec->opcount++;
+
   return 1;
 }
 
-/* Save the recorded object code data to a file */
+/* Store an operation applied to REG. It is recorded by the recorder
+   attached to REG or, if there is none, by the default recorder.
+   Returns 1 if the operation has been recorded and must not be
+   executed. */
+
+int
+quantum_objcode_put(int operation, quantum_reg *reg, ...)
+{
+  int status;
+  va_list args;
+  quantum_objcode_recorder *rec = &quantum_get_context()->recorder;
+
+  if(reg && reg->recorder)
+    rec = reg->recorder;
+
+  if(!rec->status)
+    return 0;
+
+  va_start(args, reg);
+  status = quantum_objcode_vput(rec, operation, args);
+  va_end(args);
+
+  return status;
+}
+
+/* Store an operation in the object code data of REC */
+
+static int
+quantum_objcode_record(quantum_objcode_recorder *rec, int operation, ...)
+{
+  int status;
+  va_list args;
+
+  va_start(args, operation);
+  status = quantum_objcode_vput(rec, operation, args);
+  va_end(args);
+
+  return status;
+}
+
+/* Save the recorded object code data to a file. If the object code
+   is already streamed to FILE (or FILE is NULL), all pending data is
+   written out instead. */
 
 int
 quantum_objcode_write(char *file)
 {
   FILE *fhd;
+  unsigned char header[OBJCODE_HEADER];
+  quantum_objcode_recorder *rec = &quantum_get_context()->recorder;
 
-  if(!opstatus)
+  if(!rec->status)
     {
       fprintf(stderr, "Object code generation not active! Forgot to call quantum_objcode_start?\n");
       return 1;
     }
 
   if(!file)
-    file = globalfile;
+    file = quantum_get_context()->objfile;
+
+  if(rec->file)
+    {
+      if(strcmp(file, rec->filename))
+	{
+	  fprintf(stderr, "Object code is already being written to %s\n",
+		  rec->filename);
+	  return -1;
+	}
+
+      quantum_objcode_sync(rec);
+      return 0;
+    }
   
   fhd = fopen(file, "w");
 
   if (fhd == 0)
     return -1;
 
-  fwrite(objcode, position, 1, fhd);
+  quantum_objcode_header(rec, header);
+
+  fwrite(header, OBJCODE_HEADER, 1, fhd);
+  quantum_objcode_block(rec, fhd, rec->objcode, rec->position);
 
   fclose(fhd);
 
   return 0;
 }
 
-/* Set a global variable containing the file to write the data to */
+/* Set a global variable containing the file to write the data to. If
+   recording is active, the object code is streamed to this file from
+   now on. */
 
 void
 quantum_objcode_file(char *file)
 {
-  globalfile = file;
+  quantum_context *ctx = quantum_get_context();
+
+  if(ctx->recorder.file)
+    return;
+
+  ctx->objfile = file;
+
+  if(ctx->recorder.status && file)
+    quantum_objcode_stream(&ctx->recorder, file);
+}
+
+/* Select the encoding of recorded object code as a combination of
+   OBJCODE_COMPACT and OBJCODE_LZ. The setting takes effect when the
+   next recording is started. */
+
+void
+quantum_objcode_format(int flags)
+{
+  quantum_get_context()->opformat = flags & (OBJCODE_COMPACT | OBJCODE_LZ);
 }
 
 /* This function is used as a hook before exiting, as atexit(3) does
@@ -302,195 +817,1000 @@ quantum_objcode_file(char *file)
 void
 quantum_objcode_exit(char *file)
 {
+  if(!quantum_get_context()->recorder.status)
+    return;
+
   quantum_objcode_write(0);
   quantum_objcode_stop();
 }
 
-/* Execute the contents of an object code file */
+/* Create a recorder which streams the object code of the registers
+   attached to it to FILE. Independent recorders can be used from
+   different threads at the same time. Returns NULL if FILE cannot be
+   opened. */
 
-void
-quantum_objcode_run(char *file, quantum_reg *reg)
+quantum_objcode_recorder *
+quantum_new_recorder(char *file)
 {
-  int i, j, k, l;
-  FILE *fhd;
-  unsigned char operation;
-  unsigned char buf[OBJBUF_SIZE];
-  MAX_UNSIGNED mu;
-  double d;
+  quantum_objcode_recorder *rec;
+
+  rec = calloc(1, sizeof(quantum_objcode_recorder));
 
-  fhd = fopen(file, "r");
+  if(!rec)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  sizeof(quantum_objcode_recorder));
 
-  if(!fhd)
+  quantum_objcode_begin(rec, file);
+
+  if(!rec->file)
     {
-      fprintf(stderr, "quantum_objcode_run: Could not open %s: ", file);
-      perror(0);
-      return;
+      quantum_delete_recorder(rec);
+      return 0;
     }
 
-  for(i=0; !feof(fhd); i++)
+  return rec;
+}
+
+/* Finish the object code file of a recorder and free it. Registers
+   must be detached from the recorder before. */
+
+void
+quantum_delete_recorder(quantum_objcode_recorder *rec)
+{
+  if(!rec)
+    return;
+
+  quantum_objcode_finish(rec);
+  free(rec);
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  -sizeof(quantum_objcode_recorder));
+}
+
+/* Attach REG to the recorder REC, or detach it if REC is NULL. All
+   operations on REG are recorded by REC instead of being executed. If
+   REG is a single basis state, it is recorded as the initial state of
+   the object code. */
+
+void
+quantum_attach_recorder(quantum_reg *reg, quantum_objcode_recorder *rec)
+{
+  reg->recorder = rec;
+
+  if(!rec)
+    return;
+
+  if((reg->size == 1) && reg->state)
+    quantum_objcode_put(INIT, reg, quantum_unmap_state(reg->state[0], reg),
+			reg->width);
+
+  if(!rec->opwidth)
+    rec->opwidth = reg->width;
+}
+
+/* Return the name of an operation */
+
+const char *
+quantum_objcode_opname(int operation)
+{
+  switch(operation)
+    {
+    case INIT: return "init";
+    case CNOT: return "cnot";
+    case TOFFOLI: return "toffoli";
+    case SIGMA_X: return "sigma_x";
+    case SIGMA_Y: return "sigma_y";
+    case SIGMA_Z: return "sigma_z";
+    case HADAMARD: return "hadamard";
+    case ROT_X: return "rotate_x";
+    case ROT_Y: return "rotate_y";
+    case ROT_Z: return "rotate_z";
+    case PHASE_KICK: return "phase_kick";
+    case PHASE_SCALE: return "phase_scale";
+    case COND_PHASE: return "cond_phase";
+    case CPHASE_KICK: return "cond_phase_kick";
+    case CPHASE_SHIFT: return "cond_phase_shift";
+    case SWAPLEADS: return "swaptheleads";
+    case MEASURE: return "measure";
+    case BMEASURE: return "bmeasure";
+    case BMEASURE_P: return "bmeasure_preserve";
+    case NOP: return "nop";
+    default: return "unknown";
+    }
+}
+
+/* Open an object code file for reading. The file is mapped into
+   memory, so the operations can be decoded without any further
+   copying. Returns 0 on success. */
+
+int
+quantum_objcode_open(char *file, quantum_objcode_reader *r)
+{
+  int fd;
+  struct stat st;
+  ssize_t n;
+  size_t done;
+
+  memset(r, 0, sizeof(quantum_objcode_reader));
+
+  fd = open(file, O_RDONLY);
+
+  if(fd < 0)
     {
-      for(j=0; j<OBJBUF_SIZE; j++)
-	buf[j] = 0;
-      
-      operation = fgetc(fhd);
-      switch(operation)
+      fprintf(stderr, "Could not open %s: ", file);
+      perror(0);
+      return -1;
+    }
+
+  if(fstat(fd, &st))
+    {
+      perror("fstat");
+      close(fd);
+      return -1;
+    }
+
+  r->size = st.st_size;
+
+  if(r->size)
+    {
+      r->data = mmap(0, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if(r->data != MAP_FAILED)
 	{
-	case INIT:
-	  if(!fread(buf, sizeof(MAX_UNSIGNED), 1, fhd))
+	  r->mapped = 1;
+	  madvise(r->data, r->size, MADV_SEQUENTIAL);
+	}
+
+      else
+	{
+	  /* Not mappable (e.g. a pipe), read the contents instead */
+
+	  r->data = malloc(r->size);
+
+	  if(!r->data)
+	    quantum_error(QUANTUM_ENOMEM);
+
+	  for(done=0; done<r->size; done+=n)
 	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
+	      n = read(fd, r->data + done, r->size - done);
+	      if(n <= 0)
+		break;
 	    }
-	  mu = quantum_char2mu(buf);
-	  *reg = quantum_new_qureg(mu, 12);
 
-	  break;
+	  r->size = done;
+	}
+    }
+
+  close(fd);
+
+  /* Parse the header, if there is one */
+
+  r->version = 1;
+
+  if((r->size >= OBJCODE_HEADER) && !memcmp(r->data, OBJCODE_MAGIC, 4))
+    {
+      r->version = quantum_get32(&r->data[4]);
+
+      r->flags = quantum_get32(&r->data[12]);
+
+      if((r->version > OBJCODE_VERSION) 
+	 || (quantum_get32(&r->data[8]) != OBJCODE_BYTEORDER)
+	 || (r->flags & ~(OBJCODE_COMPACT | OBJCODE_LZ)))
+	{
+	  fprintf(stderr, "%s: unsupported object code format "
+		  "(version %i)\n", file, r->version);
+	  quantum_objcode_close(r);
+	  return -1;
+	}
+
+      r->width = quantum_get32(&r->data[16]);
+      r->ops = quantum_get64(&r->data[24]);
+      r->pos = OBJCODE_HEADER;
+    }
+
+  /* Room for one block and the remainder of an operation spanning two
+     blocks */
+
+  if(r->flags & OBJCODE_LZ)
+    {
+      r->block = malloc(OBJCODE_PAGE + OBJBUF_SIZE);
+
+      if(!r->block)
+	quantum_error(QUANTUM_ENOMEM);
+    }
+
+  return 0;
+}
+
+/* Decompress the next block of an OBJCODE_LZ file, keeping the
+   undecoded rest of the previous one. Returns 1 on success, 0 at the
+   end of the file and -1 if the block is corrupt. */
+
+static int
+quantum_objcode_refill(quantum_objcode_reader *r)
+{
+  size_t raw, n;
+
+  if(r->pos >= r->size)
+    return 0;
+
+  if(r->size - r->pos < 8)
+    return -1;
+
+  raw = quantum_get32(&r->data[r->pos]);
+  n = quantum_get32(&r->data[r->pos + 4]);
+
+  if((raw > OBJCODE_PAGE) || (n > raw) || (n > r->size - r->pos - 8)
+     || (r->blen - r->bpos > OBJBUF_SIZE))
+    return -1;
+
+  r->blen -= r->bpos;
+  memmove(r->block, &r->block[r->bpos], r->blen);
+  r->bpos = 0;
+
+  if(n == raw)
+    memcpy(&r->block[r->blen], &r->data[r->pos + 8], raw);
+
+  else if(quantum_lz_decompress(&r->data[r->pos + 8], n, 
+				&r->block[r->blen], raw) != raw)
+    return -1;
+
+  r->blen += raw;
+  r->pos += n + 8;
+
+  return 1;
+}
+
+/* Decode the operation at P, with AVAIL bytes of data available.
+   Returns the length of the operation, 0 if it is incomplete and -1
+   for an unknown opcode. */
+
+static int
+quantum_objcode_decode(quantum_objcode_reader *r, unsigned char *p,
+		       size_t avail, quantum_objcode_op *op)
+{
+  int i, n, nint = 0, nmu = 0, ndouble = 0;
+  int isize, musize, dsize;
+  int32_t last[3];
+  uint64_t v;
+  size_t len;
+
+  if(!avail)
+    return 0;
+
+  memset(op, 0, sizeof(quantum_objcode_op));
+
+  op->operation = p[0];
+
+  switch(op->operation)
+    {
+    case INIT:
+      nmu = 1;
+      nint = (r->version > 1);
+      break;
+    case CNOT:
+    case COND_PHASE:
+      nint = 2;
+      break;
+    case TOFFOLI:
+      nint = 3;
+      break;
+    case SIGMA_X:
+    case SIGMA_Y:
+    case SIGMA_Z:
+    case HADAMARD:
+    case BMEASURE:
+    case BMEASURE_P:
+    case SWAPLEADS:
+      nint = 1;
+      break;
+    case ROT_X:
+    case ROT_Y:
+    case ROT_Z:
+    case PHASE_KICK:
+    case PHASE_SCALE:
+      nint = 1;
+      ndouble = 1;
+      break;
+    case CPHASE_KICK:
+    case CPHASE_SHIFT:
+      nint = 2;
+      ndouble = 1;
+      break;
+    case MEASURE:
+    case NOP:
+      break;
+    default:
+      return -1;
+    }
+
+  dsize = sizeof(double);
+
+  if(r->flags & OBJCODE_COMPACT)
+    {
+      len = 1;
+
+      if(nmu)
+	{
+	  if(!(n = quantum_getvarint(&p[len], avail - len, &v)))
+	    return 0;
+	  op->mu = v;
+	  len += n;
+	}
+
+      /* Operands only become the new reference once the operation is
+	 complete */
+
+      for(i=0; i<nint; i++)
+	{
+	  if(!(n = quantum_getvarint(&p[len], avail - len, &v)))
+	    return 0;
+	  last[i] = (uint32_t) r->last[i] 
+	    + (uint32_t) ((v >> 1) ^ -(v & 1));
+	  op->arg[i] = last[i];
+	  len += n;
+	}
+
+      if(ndouble)
+	{
+	  if(len + 8 > avail)
+	    return 0;
+	  op->d = quantum_getdouble(&p[len]);
+	  len += 8;
+	}
+
+      for(i=0; i<nint; i++)
+	r->last[i] = last[i];
+
+      return len;
+    }
+
+  /* Version 1 files use the field sizes of the recording host */
+
+  if(r->version > 1)
+    {
+      isize = 4;
+      musize = 8;
+    }
+  else
+    {
+      isize = sizeof(int);
+      musize = sizeof(MAX_UNSIGNED);
+    }
+
+  len = 1 + nmu * musize + nint * isize + ndouble * dsize;
+
+  if(len > avail)
+    return 0;
+
+  p++;
+
+  if(nmu)
+    {
+      op->mu = (r->version > 1) ? quantum_get64(p) : quantum_char2mu(p);
+      p += musize;
+    }
+
+  for(i=0; i<nint; i++)
+    {
+      op->arg[i] = (r->version > 1) ? (int32_t) quantum_get32(p) 
+	: quantum_char2int(p);
+      p += isize;
+    }
+
+  if(ndouble)
+    op->d = (r->version > 1) ? quantum_getdouble(p) : quantum_char2double(p);
+
+  return len;
+}
+
+/* Decode the next operation. Returns 1 on success, 0 at the end of
+   the file and -1 if the file is truncated or corrupt. */
+
+int
+quantum_objcode_next(quantum_objcode_reader *r, quantum_objcode_op *op)
+{
+  int n, status;
+
+  if(!(r->flags & OBJCODE_LZ))
+    {
+      if(r->pos >= r->size)
+	return 0;
+
+      n = quantum_objcode_decode(r, &r->data[r->pos], r->size - r->pos, op);
+
+      if(n <= 0)
+	return -1;
+
+      r->pos += n;
+
+      return 1;
+    }
 
+  for(;;)
+    {
+      n = quantum_objcode_decode(r, &r->block[r->bpos], r->blen - r->bpos, 
+				 op);
+
+      if(n > 0)
+	{
+	  r->bpos += n;
+	  return 1;
+	}
+
+      if(n < 0)
+	return -1;
+
+      /* The operation continues in the next block */
+
+      status = quantum_objcode_refill(r);
+
+      if(!status)
+	return (r->bpos < r->blen) ? -1 : 0;
+
+      if(status < 0)
+	return -1;
+    }
+}
+
+/* Close an object code file */
+
+void
+quantum_objcode_close(quantum_objcode_reader *r)
+{
+  if(r->data)
+    {
+      if(r->mapped)
+	munmap(r->data, r->size);
+      else
+	free(r->data);
+    }
+
+  free(r->block);
+
+  r->data = 0;
+  r->size = 0;
+  r->pos = 0;
+  r->block = 0;
+  r->blen = 0;
+  r->bpos = 0;
+}
+
+/* Compute the permutation masks of the instructions of a program and
+   find the runs of basis permutations. This has to be done again
+   whenever the instructions are modified. */
+
+void
+quantum_objcode_prepare(quantum_objcode_program *prog)
+{
+  int i;
+  quantum_objcode_insn *insn;
+
+  for(i=prog->num-1; i>=0; i--)
+    {
+      insn = &prog->insn[i];
+      insn->control = 0;
+      insn->target = 0;
+
+      switch(insn->op.operation)
+	{
+	case TOFFOLI:
+	  insn->control = ((MAX_UNSIGNED) 1 << insn->op.arg[0]) 
+	    | ((MAX_UNSIGNED) 1 << insn->op.arg[1]);
+	  insn->target = (MAX_UNSIGNED) 1 << insn->op.arg[2];
+	  break;
 	case CNOT:
-	case COND_PHASE:
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  j = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  
-	  k = quantum_char2int(buf);
-	  switch(operation)
-	    {
-	    case CNOT: quantum_cnot(j, k, reg);
-	      break;
-	    case COND_PHASE: quantum_cond_phase(j, k, reg);
-	      break;
-	    }
+	  insn->control = (MAX_UNSIGNED) 1 << insn->op.arg[0];
+	  insn->target = (MAX_UNSIGNED) 1 << insn->op.arg[1];
+	  break;
+	case SIGMA_X:
+	  insn->target = (MAX_UNSIGNED) 1 << insn->op.arg[0];
 	  break;
+	}
 
-	case TOFFOLI:
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  j = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(int), 1, fhd))
+      if(!insn->target)
+	insn->run = 0;
+      else if(i == prog->num-1)
+	insn->run = 1;
+      else
+	insn->run = insn[1].run + 1;
+    }
+}
+
+/* Decode the next operations of R into PROG. If GROW is not set,
+   reading stops once the instructions of PROG are used up. Returns 1
+   if there may be more operations, 0 at the end of the file and -1
+   on error. */
+
+static int
+quantum_objcode_fill(quantum_objcode_reader *r, 
+		     quantum_objcode_program *prog, int grow)
+{
+  int status;
+  quantum_objcode_op op;
+
+  for(;;)
+    {
+      if((prog->num == prog->alloc) && !grow)
+	return 1;
+
+      if((status = quantum_objcode_next(r, &op)) <= 0)
+	break;
+
+      /* Version 1 files do not store the width of the register */
+
+      if((op.operation == INIT) && !op.arg[0])
+	op.arg[0] = r->width ? r->width : 12;
+
+      if(prog->num == prog->alloc)
+	{
+	  if(prog->alloc > INT_MAX / 2)
+	    quantum_error(QUANTUM_ENOMEM);
+
+	  prog->insn = realloc(prog->insn, 
+			       2 * prog->alloc * sizeof(quantum_objcode_insn));
+
+	  if(!prog->insn)
+	    quantum_error(QUANTUM_ENOMEM);
+
+	  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+				  prog->alloc * sizeof(quantum_objcode_insn));
+	  prog->alloc *= 2;
+	}
+
+      prog->insn[prog->num++].op = op;
+    }
+
+  if(status < 0)
+    fprintf(stderr, "%i: Unknown opcode or truncated operation 0x(%X)!\n",
+	    prog->num, op.operation);
+
+  return status;
+}
+
+/* Decode an object code file into memory. The program can then be
+   executed any number of times without parsing the file again.
+   Returns NULL if the file could not be read. */
+
+quantum_objcode_program *
+quantum_objcode_load(char *file)
+{
+  MAX_UNSIGNED ops;
+  quantum_objcode_reader r;
+  quantum_objcode_program *prog;
+
+  if(quantum_objcode_open(file, &r))
+    return 0;
+
+  prog = malloc(sizeof(quantum_objcode_program));
+
+  if(!prog)
+    quantum_error(QUANTUM_ENOMEM);
+
+  /* The header tells the number of operations, if it is known. Only
+     compressed files hold more operations than bytes, so a larger
+     count is not trusted. */
+
+  ops = (r.ops < r.size) ? r.ops : r.size;
+
+  prog->alloc = ((ops > 0) && (ops <= INT_MAX)) ? ops : 1024;
+  prog->insn = malloc(prog->alloc * sizeof(quantum_objcode_insn));
+  prog->num = 0;
+  prog->width = r.width;
+
+  if(!prog->insn)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  sizeof(quantum_objcode_program) 
+			  + prog->alloc * sizeof(quantum_objcode_insn));
+
+  quantum_objcode_fill(&r, prog, 1);
+
+  quantum_objcode_close(&r);
+
+  /* Release unused instructions */
+
+  if(prog->num && (prog->num < prog->alloc))
+    {
+      prog->insn = realloc(prog->insn, 
+			   prog->num * sizeof(quantum_objcode_insn));
+      quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			      ((long) prog->num - prog->alloc)
+			      * (long) sizeof(quantum_objcode_insn));
+      prog->alloc = prog->num;
+    }
+
+  quantum_objcode_prepare(prog);
+
+  return prog;
+}
+
+/* Apply N consecutive basis permutations to the register in a single
+   sweep */
+
+static void
+quantum_objcode_permute(quantum_objcode_insn *insn, int n, quantum_reg *reg)
+{
+  int i, j;
+  MAX_UNSIGNED a;
+  MAX_UNSIGNED *mask;
+
+  /* Move the bit masks to where the qubits are stored */
+
+  mask = malloc(2 * n * sizeof(MAX_UNSIGNED));
+
+  if(!mask)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, 2 * n * sizeof(MAX_UNSIGNED));
+
+  for(j=0; j<n; j++)
+    {
+      mask[2*j] = quantum_map_state(insn[j].control, reg);
+      mask[2*j+1] = quantum_map_state(insn[j].target, reg);
+    }
+
+  /* The pool takes either all or none of the permutations */
+
+  for(j=0; (j < n) && quantum_pool_permute(reg, mask[2*j], mask[2*j+1]); j++);
+
+  if(!j)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for private (j, a) \
+  if (quantum_parallel((long) reg->size * n))
+#endif
+      for(i=0; i<reg->size; i++)
+	{
+	  a = reg->state[i];
+
+	  for(j=0; j<n; j++)
 	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
+	      if((a & mask[2*j]) == mask[2*j])
+		a ^= mask[2*j+1];
 	    }
-	  k = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(int), 1, fhd))
+
+	  reg->state[i] = a;
+	}
+    }
+
+  free(mask);
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, -2 * n * sizeof(MAX_UNSIGNED));
+
+  quantum_gate_counter(n);
+}
+
+/* Permutations can only be merged if every gate applied to REG would
+   just reorder its basis states */
+
+static int
+quantum_objcode_mergeable(quantum_reg *reg)
+{
+  int qec;
+
+  quantum_qec_get_status(&qec, NULL);
+
+  return !(qec || quantum_get_context()->recorder.status 
+	   || quantum_get_decoherence())
+    && !(reg->recorder && reg->recorder->status) && reg->state;
+}
+
+/* Execute a loaded program. INIT operations are skipped if SKIPINIT
+   is set. VALID tells whether REG already holds a register, which is
+   also returned for the instructions that follow. */
+
+static int
+quantum_objcode_dispatch(quantum_objcode_program *prog, quantum_reg *reg,
+			 int skipinit, int valid)
+{
+  int i, merge, pool;
+  quantum_objcode_insn *insn;
+  quantum_objcode_op *op;
+
+  merge = valid ? quantum_objcode_mergeable(reg) : 0;
+
+  /* Permutations and phase gates are left to the pool, if one has been
+     started */
+
+  pool = valid ? quantum_pool_begin(reg) : 0;
+
+  for(i=0; i<prog->num; i++)
+    {
+      insn = &prog->insn[i];
+      op = &insn->op;
+
+      if(insn->run && merge)
+	{
+	  quantum_objcode_permute(insn, insn->run, reg);
+	  i += insn->run - 1;
+	  continue;
+	}
+
+      switch(op->operation)
+	{
+	case INIT:
+	  if(!skipinit)
 	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
+	      if(pool)
+		quantum_pool_end(reg);
+
+	      *reg = quantum_new_qureg(op->mu, op->arg[0]);
+	      merge = quantum_objcode_mergeable(reg);
+	      pool = quantum_pool_begin(reg);
+	      valid = 1;
 	    }
-	  l = quantum_char2int(buf);
-	  quantum_toffoli(j, k, l, reg);
 	  break;
+	case CNOT: quantum_cnot(op->arg[0], op->arg[1], reg);
+	  break;
+	case COND_PHASE: quantum_cond_phase(op->arg[0], op->arg[1], reg);
+	  break;
+	case TOFFOLI: 
+	  quantum_toffoli(op->arg[0], op->arg[1], op->arg[2], reg);
+	  break;
+	case SIGMA_X: quantum_sigma_x(op->arg[0], reg);
+	  break;
+	case SIGMA_Y: quantum_sigma_y(op->arg[0], reg);
+	  break;
+	case SIGMA_Z: quantum_sigma_z(op->arg[0], reg);
+	  break;
+	case HADAMARD: quantum_hadamard(op->arg[0], reg);
+	  break;
+	case BMEASURE: quantum_bmeasure(op->arg[0], reg);
+	  break;
+	case BMEASURE_P: quantum_bmeasure_bitpreserve(op->arg[0], reg);
+	  break;
+	case SWAPLEADS: quantum_swaptheleads(op->arg[0], reg);
+	  break;
+	case ROT_X: quantum_r_x(op->arg[0], op->d, reg);
+	  break;
+	case ROT_Y: quantum_r_y(op->arg[0], op->d, reg);
+	  break;
+	case ROT_Z: quantum_r_z(op->arg[0], op->d, reg);
+	  break;
+	case PHASE_KICK: quantum_phase_kick(op->arg[0], op->d, reg);
+	  break;
+	case PHASE_SCALE: quantum_phase_scale(op->arg[0], op->d, reg);
+	  break;
+	case CPHASE_KICK: 
+	  quantum_cond_phase_kick(op->arg[0], op->arg[1], op->d, reg);
+	  break;
+	case CPHASE_SHIFT: 
+	  quantum_cond_phase_shift(op->arg[0], op->arg[1], op->d, reg);
+	  break;
+	case MEASURE: quantum_measure(*reg);
+	  break;
+	case NOP:
+	  break;
+	}
+    }
+
+  if(pool)
+    quantum_pool_end(reg);
+
+  return valid;
+}
+
+/* Execute a loaded program. INIT operations create a new register in
+   REG. */
+
+void
+quantum_objcode_exec(quantum_objcode_program *prog, quantum_reg *reg)
+{
+  quantum_objcode_dispatch(prog, reg, 0, 0);
+}
+
+/* Apply the gates of a loaded program to an existing register,
+   ignoring its INIT operations. This allows to run the same circuit
+   on different initial states. */
+
+void
+quantum_objcode_apply(quantum_objcode_program *prog, quantum_reg *reg)
+{
+  quantum_objcode_dispatch(prog, reg, 1, 1);
+}
+
+/* Move the qubits that PROG mixes most often into the lowest bits of
+   REG, so that the partner states of its gates are close to each
+   other. Qubits used equally often keep their order. */
+
+void
+quantum_objcode_schedule(quantum_objcode_program *prog, quantum_reg *reg)
+{
+  int i, j, q, t;
+  long count[8*sizeof(MAX_UNSIGNED)];
+  int cur[8*sizeof(MAX_UNSIGNED)];
+  int order[8*sizeof(MAX_UNSIGNED)];
+  int perm[8*sizeof(MAX_UNSIGNED)];
+  quantum_objcode_op *op;
+
+  /* CUR[Q] is the qubit whose bit holds qubit Q at this point of the
+     program, since swaptheleads only renames the qubits */
+
+  for(q=0; q<8*sizeof(MAX_UNSIGNED); q++)
+    {
+      count[q] = 0;
+      cur[q] = q;
+      order[q] = q;
+    }
+
+  for(i=0; i<prog->num; i++)
+    {
+      op = &prog->insn[i].op;
 
+      switch(op->operation)
+	{
+	case TOFFOLI:
+	  q = op->arg[2];
+	  break;
+	case CNOT:
+	  q = op->arg[1];
+	  break;
 	case SIGMA_X:
 	case SIGMA_Y:
-	case SIGMA_Z:
 	case HADAMARD:
-	case BMEASURE:
-	case BMEASURE_P:
-	case SWAPLEADS:
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  j = quantum_char2int(buf);
-	  switch(operation)
-	    {
-	    case SIGMA_X: quantum_sigma_x(j, reg);
-	      break;
-	    case SIGMA_Y: quantum_sigma_y(j, reg);
-	      break;
-	    case SIGMA_Z: quantum_sigma_z(j, reg);
-	      break;
-	    case HADAMARD: quantum_hadamard(j, reg);
-	      break;
-	    case BMEASURE: quantum_bmeasure(j, reg);
-	      break;
-	    case BMEASURE_P: quantum_bmeasure_bitpreserve(j, reg);
-	      break;
-	    case SWAPLEADS: quantum_swaptheleads(j, reg);
-	      break;
-	    }
-	  break;
-
 	case ROT_X:
 	case ROT_Y:
-	case ROT_Z:
-	case PHASE_KICK:
-	case PHASE_SCALE:
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  j = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(double), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  d = quantum_char2double(buf);
-	  switch(operation)
-	    {
-	    case ROT_X: quantum_r_x(j, d, reg);
-	      break;
-	    case ROT_Y: quantum_r_y(j, d, reg);
-	      break;
-	    case ROT_Z: quantum_r_z(j, d, reg);
-	      break;
-	    case PHASE_KICK: quantum_phase_kick(j, d, reg);
-	      break;
-	    case PHASE_SCALE: quantum_phase_scale(j, d, reg);
-	      break;
-	    }
+	  q = op->arg[0];
 	  break;
-
-	case CPHASE_KICK:
-	  if(!fread(buf, sizeof(int), 1, fhd))	
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  j = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(int), 1, fhd))
-	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
-	    }
-	  k = quantum_char2int(buf);
-	  if(!fread(buf, sizeof(double), 1, fhd))
+	case SWAPLEADS:
+	  for(j=0; (j < op->arg[0]) && (op->arg[0]+j < 8*sizeof(MAX_UNSIGNED));
+	      j++)
 	    {
-	      quantum_error(QUANTUM_FAILURE);
-	      break;
+	      t = cur[j];
+	      cur[j] = cur[op->arg[0]+j];
+	      cur[op->arg[0]+j] = t;
 	    }
-	  d = quantum_char2double(buf);
-	  quantum_cond_phase_kick(j, k, d, reg);
-	  break;
-	  
-	case MEASURE: quantum_measure(*reg);
-	  break;
-
-	case NOP:
+	  q = -1;
 	  break;
-
 	default:
-	  fprintf(stderr, "%i: Unknown opcode 0x(%X)!\n", i, operation);
-	  return;
+	  q = -1;
 	}
 
+      if((q >= 0) && (q < 8*sizeof(MAX_UNSIGNED)))
+	count[cur[q]]++;
     }
 
-  fclose(fhd);
+  /* Sort the qubits by decreasing use */
+
+  for(i=1; i<reg->width; i++)
+    {
+      q = order[i];
+
+      for(j=i; (j > 0) && (count[order[j-1]] < count[q]); j--)
+	order[j] = order[j-1];
+
+      order[j] = q;
+    }
+
+  for(i=0; i<reg->width; i++)
+    perm[order[i]] = i;
+
+  quantum_remap(perm, reg);
+}
 
-}  
+/* Record a single decoded operation */
+
+static void
+quantum_objcode_putop(quantum_objcode_recorder *rec, quantum_objcode_op *op)
+{
+  switch(op->operation)
+    {
+    case INIT:
+      quantum_objcode_record(rec, INIT, op->mu, op->arg[0]);
+      break;
+    case CNOT:
+    case COND_PHASE:
+      quantum_objcode_record(rec, op->operation, op->arg[0], op->arg[1]);
+      break;
+    case TOFFOLI:
+      quantum_objcode_record(rec, TOFFOLI, op->arg[0], op->arg[1], 
+			     op->arg[2]);
+      break;
+    case SIGMA_X:
+    case SIGMA_Y:
+    case SIGMA_Z:
+    case HADAMARD:
+    case BMEASURE:
+    case BMEASURE_P:
+    case SWAPLEADS:
+      quantum_objcode_record(rec, op->operation, op->arg[0]);
+      break;
+    case ROT_X:
+    case ROT_Y:
+    case ROT_Z:
+    case PHASE_KICK:
+    case PHASE_SCALE:
+      quantum_objcode_record(rec, op->operation, op->arg[0], op->d);
+      break;
+    case CPHASE_KICK:
+    case CPHASE_SHIFT:
+      quantum_objcode_record(rec, op->operation, op->arg[0], op->arg[1], 
+			     op->d);
+      break;
+    default:
+      quantum_objcode_record(rec, op->operation);
+    }
+}
+
+/* Write a loaded program to FILE, using the encoding set with
+   quantum_objcode_format. Returns 0 on success. */
+
+int
+quantum_objcode_save(quantum_objcode_program *prog, char *file)
+{
+  int i;
+  quantum_objcode_recorder *rec;
+
+  rec = quantum_new_recorder(file);
+
+  if(!rec)
+    return -1;
+
+  for(i=0; i<prog->num; i++)
+    quantum_objcode_putop(rec, &prog->insn[i].op);
+
+  if(!rec->opwidth)
+    rec->opwidth = prog->width;
+
+  quantum_delete_recorder(rec);
+
+  return 0;
+}
+
+/* Free a loaded program */
+
+void
+quantum_objcode_free(quantum_objcode_program *prog)
+{
+  if(!prog)
+    return;
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  -sizeof(quantum_objcode_program) 
+			  - prog->alloc * sizeof(quantum_objcode_insn));
+
+  free(prog->insn);
+  free(prog);
+}
+
+/* Execute the contents of an object code file. The operations are
+   decoded and executed OBJCODE_CHUNK at a time, so files of any
+   length can be replayed. */
+
+void
+quantum_objcode_run(char *file, quantum_reg *reg)
+{
+  int status, valid = 0;
+  quantum_objcode_reader r;
+  quantum_objcode_program prog;
+
+  if(quantum_objcode_open(file, &r))
+    return;
+
+  prog.insn = malloc(OBJCODE_CHUNK * sizeof(quantum_objcode_insn));
+  prog.alloc = OBJCODE_CHUNK;
+  prog.width = r.width;
+
+  if(!prog.insn)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  OBJCODE_CHUNK * sizeof(quantum_objcode_insn));
+
+  do
+    {
+      prog.num = 0;
+      status = quantum_objcode_fill(&r, &prog, 0);
+      quantum_objcode_prepare(&prog);
+      valid = quantum_objcode_dispatch(&prog, reg, 0, valid);
+    }
+  while(status > 0);
+
+  quantum_objcode_close(&r);
+
+  free(prog.insn);
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  -OBJCODE_CHUNK * (long) sizeof(quantum_objcode_insn));
+}
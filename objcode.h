@@ -25,12 +25,61 @@
 
 #define __OBJCODE_H
 
+#include <stdio.h>
+
 #include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
 #include "qureg.h"
 
 #define OBJCODE_PAGE 65536
 #define OBJBUF_SIZE 80
 
+/* Number of operations quantum_objcode_run() decodes at a time */
+
+#define OBJCODE_CHUNK 4096
+
+/* Object code files start with a header of OBJCODE_HEADER bytes. All
+   header fields and all operands are stored in little-endian byte
+   order, independent of the host:
+
+   offset  size  field
+        0     4  magic "QUOB"
+        4     4  format version (OBJCODE_VERSION)
+        8     4  byte order mark (OBJCODE_BYTEORDER)
+       12     4  flags (OBJCODE_COMPACT, OBJCODE_LZ)
+       16     4  width of the first initialized register
+       20     4  reserved (0)
+       24     8  number of operations, 0 if unknown
+
+   Integer operands take 4 bytes, basis states and doubles 8 bytes.
+   Files without a header are read as the original (version 1) format
+   using host-sized fields.
+
+   With OBJCODE_COMPACT, each integer operand is stored as the
+   difference to the operand at the same position of the previous
+   operation. The difference is zigzag-encoded and written 7 bits per
+   byte, least significant group first, with the high bit set on all
+   but the last byte. Basis states use the same variable-length
+   encoding without the difference, doubles keep their 8 bytes.
+
+   With OBJCODE_LZ, the operations are split into blocks of at most
+   OBJCODE_PAGE bytes. Each block is preceded by its original and its
+   compressed size as 4-byte integers and compressed with
+   quantum_lz_compress. Blocks whose sizes are equal are stored
+   uncompressed. Operations may span two blocks. */
+
+#define OBJCODE_MAGIC "QUOB"
+#define OBJCODE_VERSION 3
+#define OBJCODE_HEADER 32
+#define OBJCODE_BYTEORDER 0x01020304
+
+#define OBJCODE_COMPACT 0x01
+#define OBJCODE_LZ      0x02
+
 enum {
   INIT        = 0x00,
   CNOT        = 0x01,
@@ -47,6 +96,7 @@ enum {
   COND_PHASE  = 0x0C,
   CPHASE_KICK = 0x0D,
   SWAPLEADS   = 0x0E,
+  CPHASE_SHIFT = 0x0F,
   
   MEASURE     = 0x80,
   BMEASURE    = 0x81,
@@ -55,15 +105,123 @@ enum {
   NOP         = 0xFF
 };
 
+/* State of an object code recording. quantum_objcode_start and the
+   related functions use a default recorder for the whole process.
+   Registers can be attached to a recorder of their own with
+   quantum_attach_recorder. */
+
+struct quantum_objcode_recorder_struct
+{
+  int status;               /* non-zero while recording */
+  unsigned char *objcode;   /* recorded data */
+  unsigned long position;   /* end of the recorded data in OBJCODE */
+  unsigned long allocated;  /* number of allocated pages */
+  MAX_UNSIGNED opcount;     /* number of recorded operations */
+  int opwidth;              /* width of the first register */
+  int flags;                /* encoding of the recorded data */
+  int last[3];              /* previous operands for OBJCODE_COMPACT */
+  FILE *file;               /* file the data is streamed to */
+  char *filename;
+  unsigned char *buf[2];    /* pages used for streaming */
+  int cur;                  /* page currently being filled */
+  unsigned char *pending;   /* page handed to the writer thread */
+  unsigned long pendinglen;
+  int error;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int done;
+#endif
+};
+
+typedef struct quantum_objcode_recorder_struct quantum_objcode_recorder;
+
+/* A single decoded operation */
+
+struct quantum_objcode_op_struct
+{
+  int operation;
+  int arg[3];       /* qubit (or width) operands */
+  MAX_UNSIGNED mu;  /* initial basis state of INIT */
+  double d;         /* angle of rotations and phase kicks */
+};
+
+typedef struct quantum_objcode_op_struct quantum_objcode_op;
+
+/* An object code file opened for reading */
+
+struct quantum_objcode_reader_struct
+{
+  unsigned char *data;  /* file contents */
+  size_t size;          /* length of the file in bytes */
+  size_t pos;           /* offset of the next operation */
+  int version;          /* file format version */
+  int flags;            /* encoding flags from the header */
+  int width;            /* register width from the header */
+  MAX_UNSIGNED ops;     /* number of operations from the header */
+  int mapped;           /* non-zero if DATA is a memory mapping */
+  int last[3];          /* previous operands of compact files */
+  unsigned char *block; /* decompressed data of OBJCODE_LZ files */
+  size_t blen;          /* length of the decompressed data */
+  size_t bpos;          /* offset of the next operation in BLOCK */
+};
+
+typedef struct quantum_objcode_reader_struct quantum_objcode_reader;
+
+/* An instruction of a program loaded into memory. Consecutive basis
+   permutations (CNOT, TOFFOLI and SIGMA_X) are described by the bits
+   which have to be set for the TARGET bits to be flipped. */
+
+struct quantum_objcode_insn_struct
+{
+  quantum_objcode_op op;
+  MAX_UNSIGNED control;
+  MAX_UNSIGNED target;
+  int run;              /* number of permutations starting here */
+};
+
+typedef struct quantum_objcode_insn_struct quantum_objcode_insn;
+
+struct quantum_objcode_program_struct
+{
+  quantum_objcode_insn *insn;
+  int num;              /* number of instructions */
+  int alloc;            /* number of allocated instructions */
+  int width;            /* register width from the file header */
+};
+
+typedef struct quantum_objcode_program_struct quantum_objcode_program;
+
 extern MAX_UNSIGNED quantum_char2mu(unsigned char *buf);
 extern int quantum_char2int(unsigned char *buf);
 extern double quantum_char2double(unsigned char *buf);
 extern void quantum_objcode_start();
 extern void quantum_objcode_stop();
-extern int quantum_objcode_put(int operation, ...);
+extern int quantum_objcode_put(int operation, quantum_reg *reg, ...);
 extern int quantum_objcode_write(char *file);
 extern void quantum_objcode_file(char *file);
 extern void quantum_objcode_exit(char *file);
+extern void quantum_objcode_format(int flags);
+extern const char *quantum_objcode_opname(int operation);
+extern quantum_objcode_recorder *quantum_new_recorder(char *file);
+extern void quantum_delete_recorder(quantum_objcode_recorder *rec);
+extern void quantum_attach_recorder(quantum_reg *reg, 
+				    quantum_objcode_recorder *rec);
+extern int quantum_objcode_open(char *file, quantum_objcode_reader *r);
+extern int quantum_objcode_next(quantum_objcode_reader *r, 
+				quantum_objcode_op *op);
+extern void quantum_objcode_close(quantum_objcode_reader *r);
 extern void quantum_objcode_run(char *file, quantum_reg *reg);
+extern quantum_objcode_program *quantum_objcode_load(char *file);
+extern void quantum_objcode_exec(quantum_objcode_program *prog,
+				 quantum_reg *reg);
+extern void quantum_objcode_schedule(quantum_objcode_program *prog,
+				     quantum_reg *reg);
+extern void quantum_objcode_apply(quantum_objcode_program *prog,
+				  quantum_reg *reg);
+extern void quantum_objcode_free(quantum_objcode_program *prog);
+extern void quantum_objcode_prepare(quantum_objcode_program *prog);
+extern int quantum_objcode_save(quantum_objcode_program *prog, char *file);
 
 #endif
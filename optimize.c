@@ -0,0 +1,278 @@
+/* optimize.c: Peephole optimization of object code
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "optimize.h"
+#include "objcode.h"
+#include "config.h"
+#include "error.h"
+
+/* Number of preceding gates examined for each gate */
+
+#define OPT_WINDOW 64
+
+/* Angles below this value are treated as zero */
+
+#define OPT_EPSILON 1e-12
+
+/* Classes of operations with respect to commutation */
+
+enum {
+  OPT_BARRIER, /* measurements, initializations and the like */
+  OPT_PERM,    /* basis permutations: controlled sigma_x gates */
+  OPT_DIAG,    /* gates diagonal in the computational basis */
+  OPT_GATE     /* any other gate */
+};
+
+/* Determine the class of an instruction and the qubits it acts on */
+
+static int
+quantum_opt_class(quantum_objcode_insn *insn, MAX_UNSIGNED *support)
+{
+  quantum_objcode_op *op = &insn->op;
+
+  switch(op->operation)
+    {
+    case CNOT:
+    case TOFFOLI:
+    case SIGMA_X:
+      *support = insn->control | insn->target;
+      return OPT_PERM;
+    case COND_PHASE:
+    case CPHASE_KICK:
+    case CPHASE_SHIFT:
+      *support = ((MAX_UNSIGNED) 1 << op->arg[0]) 
+	| ((MAX_UNSIGNED) 1 << op->arg[1]);
+      return OPT_DIAG;
+    case SIGMA_Z:
+    case ROT_Z:
+    case PHASE_KICK:
+      *support = (MAX_UNSIGNED) 1 << op->arg[0];
+      return OPT_DIAG;
+    case PHASE_SCALE:
+      /* A global phase */
+      *support = 0;
+      return OPT_DIAG;
+    case SIGMA_Y:
+    case HADAMARD:
+    case ROT_X:
+    case ROT_Y:
+      *support = (MAX_UNSIGNED) 1 << op->arg[0];
+      return OPT_GATE;
+    default:
+      *support = ~(MAX_UNSIGNED) 0;
+      return OPT_BARRIER;
+    }
+}
+
+/* Check whether the instructions A and B commute */
+
+static int
+quantum_opt_commute(quantum_objcode_insn *a, quantum_objcode_insn *b)
+{
+  int ca, cb;
+  MAX_UNSIGNED sa, sb;
+
+  ca = quantum_opt_class(a, &sa);
+  cb = quantum_opt_class(b, &sb);
+
+  if((ca == OPT_BARRIER) || (cb == OPT_BARRIER))
+    return 0;
+
+  if(!(sa & sb))
+    return 1;
+
+  if((ca == OPT_DIAG) && (cb == OPT_DIAG))
+    return 1;
+
+  /* Controlled sigma_x gates commute unless one of them flips a
+     control bit of the other */
+
+  if((ca == OPT_PERM) && (cb == OPT_PERM))
+    return !(a->target & b->control) && !(b->target & a->control);
+
+  /* Diagonal gates commute with controlled sigma_x gates if they do
+     not involve the target bit */
+
+  if((ca == OPT_DIAG) && (cb == OPT_PERM))
+    return !(b->target & sa);
+
+  if((ca == OPT_PERM) && (cb == OPT_DIAG))
+    return !(a->target & sb);
+
+  return 0;
+}
+
+/* Try to combine the operation B with the earlier operation A.
+   Returns 2 if both operations cancel, 1 if B has been merged into A
+   and 0 if they cannot be combined. */
+
+static int
+quantum_opt_combine(quantum_objcode_op *a, quantum_objcode_op *b)
+{
+  if(a->operation != b->operation)
+    return 0;
+
+  switch(a->operation)
+    {
+    case CNOT:
+      return ((a->arg[0] == b->arg[0]) && (a->arg[1] == b->arg[1])) ? 2 : 0;
+    case TOFFOLI:
+      if(a->arg[2] != b->arg[2])
+	return 0;
+      if(((a->arg[0] == b->arg[0]) && (a->arg[1] == b->arg[1]))
+	 || ((a->arg[0] == b->arg[1]) && (a->arg[1] == b->arg[0])))
+	return 2;
+      return 0;
+    case SIGMA_X:
+    case SIGMA_Y:
+    case SIGMA_Z:
+    case HADAMARD:
+      return (a->arg[0] == b->arg[0]) ? 2 : 0;
+    case ROT_X:
+    case ROT_Y:
+    case ROT_Z:
+    case PHASE_KICK:
+      if(a->arg[0] != b->arg[0])
+	return 0;
+      break;
+    case CPHASE_KICK:
+      /* The phase is applied if both bits are set, so the order of
+	 the qubits does not matter */
+      if(!((a->arg[0] == b->arg[0]) && (a->arg[1] == b->arg[1]))
+	 && !((a->arg[0] == b->arg[1]) && (a->arg[1] == b->arg[0])))
+	return 0;
+      break;
+    case CPHASE_SHIFT:
+      if((a->arg[0] != b->arg[0]) || (a->arg[1] != b->arg[1]))
+	return 0;
+      break;
+    case PHASE_SCALE:
+      break;
+    default:
+      return 0;
+    }
+
+  /* Fold the angles of rotations and phase kicks */
+
+  a->d += b->d;
+
+  return (fabs(a->d) < OPT_EPSILON) ? 2 : 1;
+}
+
+/* Optimize a loaded program. Each gate is moved towards the front of
+   the program past all gates it commutes with, until it either
+   cancels against an identical self-inverse gate, is merged with a
+   rotation about the same axis or reaches a gate it does not commute
+   with. Measurements and initializations are never crossed. NOPs are
+   removed. The optimized program is equivalent to the original one
+   in the absence of decoherence. Returns the number of removed
+   operations. */
+
+int
+quantum_objcode_optimize(quantum_objcode_program *prog)
+{
+  int i, j, k, n, tail = -1, r, removed;
+  int *prev, *next;
+  quantum_objcode_insn *insn = prog->insn;
+
+  /* The instructions kept so far are linked in a list, so that they
+     can be removed from the middle of it */
+
+  prev = malloc(prog->num * sizeof(int));
+  next = malloc(prog->num * sizeof(int));
+
+  if(prog->num && !(prev && next))
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE, 2 * prog->num * sizeof(int));
+
+  quantum_objcode_prepare(prog);
+
+  for(i=0; i<prog->num; i++)
+    {
+      if(insn[i].op.operation == NOP)
+	continue;
+
+      r = 0;
+
+      for(j=tail, k=0; (j >= 0) && (k < OPT_WINDOW); j=prev[j], k++)
+	{
+	  if((r = quantum_opt_combine(&insn[j].op, &insn[i].op)))
+	    break;
+
+	  if(!quantum_opt_commute(&insn[j], &insn[i]))
+	    break;
+	}
+
+      if(r == 2)
+	{
+	  /* Unlink the cancelled instruction */
+
+	  if(prev[j] >= 0)
+	    next[prev[j]] = next[j];
+	  if(next[j] >= 0)
+	    prev[next[j]] = prev[j];
+	  if(j == tail)
+	    tail = prev[j];
+	}
+
+      if(!r)
+	{
+	  prev[i] = tail;
+	  next[i] = -1;
+
+	  if(tail >= 0)
+	    next[tail] = i;
+
+	  tail = i;
+	}
+    }
+
+  /* Compact the remaining instructions. As each instruction is only
+     linked after all earlier ones, the list is in program order. */
+
+  for(j=tail, n=0; j >= 0; j=prev[j])
+    n++;
+
+  for(j=tail, i=n-1; j >= 0; j=prev[j], i--)
+    next[i] = j;
+
+  for(i=0; i<n; i++)
+    insn[i] = insn[next[i]];
+
+  removed = prog->num - n;
+  prog->num = n;
+
+  free(prev);
+  free(next);
+
+  quantum_memman_category(QUANTUM_MEM_OBJCODE,
+			  -2 * (prog->num + removed) * sizeof(int));
+
+  quantum_objcode_prepare(prog);
+
+  return removed;
+}
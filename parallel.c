@@ -0,0 +1,175 @@
+/* parallel.c: Size dependent parallelization of the gates
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "parallel.h"
+#include "config.h"
+
+/* Starting and joining a team of threads costs several microseconds,
+   while a gate spends a few nanoseconds on each basis state. Loops
+   over fewer basis states than the threshold therefore run in the
+   calling thread. Unless set with quantum_parallel_threshold() or the
+   environment variable QUANTUM_PARALLEL, the threshold is measured
+   the first time it is needed. */
+
+long quantum_parallel_limit = QUANTUM_PARALLEL_UNSET;
+
+/* Set the threshold to N basis states, 0 parallelizes all loops and a
+   negative value calibrates it again. Returns the previous
+   threshold. */
+
+long
+quantum_parallel_threshold(long n)
+{
+  long old = quantum_parallel_limit;
+
+  if(n < 0)
+    quantum_parallel_calibrate();
+  else
+    quantum_parallel_limit = n;
+
+  return old;
+}
+
+#ifdef _OPENMP
+
+/* Number of repetitions and basis states of the benchmark */
+
+#define QUANTUM_PARALLEL_RUNS 16
+#define QUANTUM_PARALLEL_STATES (1 << 12)
+
+/* Time a cnot on N basis states in the calling thread */
+
+static double
+quantum_parallel_serial(MAX_UNSIGNED *state, int n)
+{
+  double t = omp_get_wtime();
+  int i;
+
+  for(i=0; i<n; i++)
+    {
+      if(state[i] & 1)
+	state[i] ^= 2;
+    }
+
+  return omp_get_wtime() - t;
+}
+
+/* Time an empty parallel loop */
+
+static double
+quantum_parallel_fork(MAX_UNSIGNED *state, int n)
+{
+  double t = omp_get_wtime();
+  int i;
+
+#pragma omp parallel for
+  for(i=0; i<n; i++)
+    state[i] ^= 4;
+
+  return omp_get_wtime() - t;
+}
+
+#endif
+
+/* Measure the threshold at which a parallel loop starts to pay off.
+   With K threads, a loop over N basis states taking C each finishes
+   after N*C/K plus the overhead F of the team, so the break even lies
+   at N = F*K/(C*(K-1)). The fastest of several runs is taken. */
+
+long
+quantum_parallel_calibrate()
+{
+#ifdef _OPENMP
+  MAX_UNSIGNED state[QUANTUM_PARALLEL_STATES];
+  double c = 1, f = 1, t;
+  long n;
+  int i, k = omp_get_max_threads();
+
+  if(k < 2)
+    return QUANTUM_PARALLEL_MAX;
+
+  for(i=0; i<QUANTUM_PARALLEL_STATES; i++)
+    state[i] = i;
+
+  for(i=0; i<QUANTUM_PARALLEL_RUNS; i++)
+    {
+      t = quantum_parallel_serial(state, QUANTUM_PARALLEL_STATES);
+
+      if(t < c)
+	c = t;
+
+      t = quantum_parallel_fork(state, k);
+
+      if(t < f)
+	f = t;
+    }
+
+  c /= QUANTUM_PARALLEL_STATES;
+
+  if(c > 0)
+    n = f * k / (c * (k - 1));
+  else
+    n = QUANTUM_PARALLEL_MAX;
+
+  if(n < QUANTUM_PARALLEL_MIN)
+    n = QUANTUM_PARALLEL_MIN;
+  if(n > QUANTUM_PARALLEL_MAX)
+    n = QUANTUM_PARALLEL_MAX;
+
+  quantum_parallel_limit = n;
+
+  return n;
+#else
+  return QUANTUM_PARALLEL_MAX;
+#endif
+}
+
+/* Determine the threshold on first use. Threads limited to a single
+   OpenMP thread, like those of quantum_batch(), run serially without
+   calibrating. */
+
+int
+quantum_parallel_slow(long n)
+{
+  char *c;
+
+#ifdef _OPENMP
+  if(omp_get_max_threads() < 2)
+    return 0;
+#endif
+
+  c = getenv("QUANTUM_PARALLEL");
+
+  if(c && atol(c) >= 0)
+    quantum_parallel_limit = atol(c);
+  else
+    quantum_parallel_calibrate();
+
+  return (quantum_parallel_limit >= 0) && (n >= quantum_parallel_limit);
+}
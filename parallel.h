@@ -0,0 +1,58 @@
+/* parallel.h: Declarations for parallel.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __PARALLEL_H
+
+#define __PARALLEL_H
+
+/* Bounds for the calibrated threshold */
+
+#define QUANTUM_PARALLEL_MIN (1 << 9)
+#define QUANTUM_PARALLEL_MAX (1 << 22)
+
+/* Threshold before it has been calibrated or set */
+
+#define QUANTUM_PARALLEL_UNSET -1
+
+extern long quantum_parallel_threshold(long n);
+extern long quantum_parallel_calibrate();
+extern int quantum_parallel_slow(long n);
+
+extern long quantum_parallel_limit;
+
+/* Decide whether a loop doing work on N amplitudes is worth the
+   fork and join of an OpenMP team. Used in the if clause of the
+   parallel regions, e.g.
+
+   #pragma omp parallel for if (quantum_parallel(reg->size)) */
+
+static inline int
+quantum_parallel(long n)
+{
+  if(quantum_parallel_limit == QUANTUM_PARALLEL_UNSET)
+    return quantum_parallel_slow(n);
+
+  return n >= quantum_parallel_limit;
+}
+
+#endif
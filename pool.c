@@ -0,0 +1,505 @@
+/* pool.c: Persistent threads working through a queue of gates
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#include "pool.h"
+#include "qureg.h"
+#include "precision.h"
+#include "context.h"
+#include "parallel.h"
+#include "matrix.h"
+#include "error.h"
+
+/* Each gate of the modular exponentiation only takes a few
+   microseconds, so starting a parallel region for every gate costs
+   about as much as the gate itself. Between quantum_pool_begin() and
+   quantum_pool_end(), permutations and phase gates applied to a
+   register are not executed by the calling thread but put into a
+   queue. Each thread of the pool owns a fixed chunk of the register
+   and works through the queue at its own pace, since none of these
+   gates moves amplitudes between chunks. The calling thread only
+   waits for the pool before a gate that needs the whole register,
+   like a hadamard gate or a measurement. */
+
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+
+#define QUANTUM_POOL_PERMUTE 0  /* flip TMASK if CMASK is set */
+#define QUANTUM_POOL_PHASE 1    /* see quantum_kernel_phase() */
+
+/* Number of times a waiting thread looks for progress before going to
+   sleep */
+
+#define QUANTUM_POOL_SPIN 256
+
+struct quantum_pool_gate_struct
+{
+  int type;
+  MAX_UNSIGNED xmask;
+  MAX_UNSIGNED cmask;
+  MAX_UNSIGNED tmask;
+  complex double z1;
+  complex double z0;
+};
+
+typedef struct quantum_pool_gate_struct quantum_pool_gate;
+
+/* The counters of the workers are kept on separate cache lines */
+
+struct quantum_pool_worker_struct
+{
+  long done;                 /* number of gates applied to the chunk */
+  int id;
+  pthread_t thread;
+  char pad[64];
+};
+
+typedef struct quantum_pool_worker_struct quantum_pool_worker;
+
+static int workers = 0;
+static quantum_pool_worker *worker = 0;
+static quantum_pool_gate queue[QUANTUM_POOL_QUEUE];
+static long tail = 0;        /* number of gates ever queued */
+static int stop = 0;
+static int sleepers = 0;     /* workers waiting for WAKE */
+
+/* OWNER is claimed and released atomically, so that any thread can
+   tell whether a register uses the pool. VIEW and STALE are only
+   used by the thread owning the pool and, once a gate has been
+   queued, read by the workers. */
+
+static quantum_reg *owner = 0;
+static quantum_reg view;     /* OWNER when the queue was last empty */
+static int stale = 1;        /* OWNER may have changed since */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+/* Return the register using the pool */
+
+static quantum_reg *
+quantum_pool_owner()
+{
+  return __atomic_load_n(&owner, __ATOMIC_ACQUIRE);
+}
+
+/* Return the number of gates applied by all workers */
+
+static long
+quantum_pool_done()
+{
+  long d, min = tail;
+  int i;
+
+  for(i=0; i<workers; i++)
+    {
+      d = __atomic_load_n(&worker[i].done, __ATOMIC_ACQUIRE);
+
+      if(d < min)
+	min = d;
+    }
+
+  return min;
+}
+
+/* Wait until more than HEAD gates have been queued. Returns the number
+   of queued gates, which equals HEAD if the pool is stopped. */
+
+static long
+quantum_pool_wait(long head)
+{
+  long t;
+  int i;
+
+  for(i=0; i<QUANTUM_POOL_SPIN; i++)
+    {
+      t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+      if(t != head || __atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+	return t;
+
+      sched_yield();
+    }
+
+  pthread_mutex_lock(&lock);
+  __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+
+  while(((t = __atomic_load_n(&tail, __ATOMIC_SEQ_CST)) == head) && !stop)
+    pthread_cond_wait(&wake, &lock);
+
+  __atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&lock);
+
+  return t;
+}
+
+/* Apply the gates starting at HEAD to the basis states LO to HI-1.
+   Consecutive permutations are done in a single sweep. Returns the
+   number of gates applied. */
+
+static long
+quantum_pool_apply(long head, long t, long lo, long hi)
+{
+  quantum_pool_gate *g = &queue[head % QUANTUM_POOL_QUEUE];
+  MAX_UNSIGNED cmask[QUANTUM_POOL_RUN], tmask[QUANTUM_POOL_RUN], a;
+  quantum_reg sub;
+  long i;
+  int j, n;
+
+  if(g->type == QUANTUM_POOL_PHASE)
+    {
+      sub = view;
+      sub.state = &view.state[lo];
+      sub.amplitude = (COMPLEX_FLOAT *) ((char *) view.amplitude
+					 + lo * quantum_amplitude_size(&view));
+      sub.size = hi - lo;
+
+      quantum_kernel_phase_part(&sub, g->xmask, g->cmask, g->tmask, g->z1,
+				g->z0);
+
+      return 1;
+    }
+
+  for(n=0; (n < QUANTUM_POOL_RUN) && (head + n < t); n++)
+    {
+      g = &queue[(head + n) % QUANTUM_POOL_QUEUE];
+
+      if(g->type != QUANTUM_POOL_PERMUTE)
+	break;
+
+      cmask[n] = g->cmask;
+      tmask[n] = g->tmask;
+    }
+
+  for(i=lo; i<hi; i++)
+    {
+      a = view.state[i];
+
+      for(j=0; j<n; j++)
+	{
+	  if((a & cmask[j]) == cmask[j])
+	    a ^= tmask[j];
+	}
+
+      view.state[i] = a;
+    }
+
+  return n;
+}
+
+static void *
+quantum_pool_main(void *arg)
+{
+  quantum_pool_worker *w = arg;
+  long head = w->done, t, lo, hi;
+
+  /* The chunk is small enough for a single thread */
+
+#ifdef _OPENMP
+  omp_set_num_threads(1);
+#endif
+
+  while((t = quantum_pool_wait(head)) != head)
+    {
+      lo = (long) view.size * w->id / workers;
+      hi = (long) view.size * (w->id + 1) / workers;
+
+      while(head < t)
+	{
+	  head += quantum_pool_apply(head, t, lo, hi);
+	  __atomic_store_n(&w->done, head, __ATOMIC_RELEASE);
+	}
+    }
+
+  return 0;
+}
+
+/* Queue the gate G, waiting for the workers if the queue is full */
+
+static void
+quantum_pool_push(quantum_pool_gate *g)
+{
+  while(tail - quantum_pool_done() >= QUANTUM_POOL_QUEUE)
+    sched_yield();
+
+  queue[tail % QUANTUM_POOL_QUEUE] = *g;
+  __atomic_store_n(&tail, tail + 1, __ATOMIC_SEQ_CST);
+
+  if(__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock(&lock);
+      pthread_cond_broadcast(&wake);
+      pthread_mutex_unlock(&lock);
+    }
+}
+
+/* Check whether a gate on REG can be queued. Registers below the size
+   at which parallel loops pay off are left to the calling thread, as
+   are registers subject to decoherence, which needs the whole
+   register after each gate. */
+
+static int
+quantum_pool_ready(quantum_reg *reg)
+{
+  if(!reg || reg != quantum_pool_owner())
+    return 0;
+
+  if(quantum_get_context()->status)
+    {
+      quantum_pool_sync(reg);
+      return 0;
+    }
+
+  if(stale)
+    {
+      if(!quantum_parallel(reg->size))
+	return 0;
+
+      view = *reg;
+      stale = 0;
+    }
+
+  return 1;
+}
+
+#endif /* HAVE_LIBPTHREAD && __GNUC__ */
+
+/* Start a pool of THREADS threads, 0 for one per OpenMP thread. A
+   running pool is stopped first. Returns the number of threads
+   started. */
+
+int
+quantum_pool_start(int threads)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  int i;
+
+  quantum_pool_stop();
+
+  if(threads <= 0)
+    {
+#ifdef _OPENMP
+      threads = omp_get_max_threads();
+#else
+      threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+
+  if(threads <= 0)
+    threads = 1;
+
+  worker = calloc(threads, sizeof(quantum_pool_worker));
+
+  if(!worker)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(threads * sizeof(quantum_pool_worker));
+
+  workers = threads;
+
+  for(i=0; i<threads; i++)
+    {
+      worker[i].id = i;
+      worker[i].done = tail;
+    }
+
+  for(i=0; i<threads; i++)
+    {
+      if(pthread_create(&worker[i].thread, 0, quantum_pool_main, &worker[i]))
+	{
+	  /* Keep the threads that could be started */
+
+	  quantum_pool_stop();
+	  return i ? quantum_pool_start(i) : 0;
+	}
+    }
+
+  return workers;
+#else
+  return 0;
+#endif
+}
+
+/* Wait for the queued gates and terminate the threads of the pool.
+   The register using the pool, if any, is simulated by its thread
+   again. The pool must not be started or stopped while another
+   thread is applying gates to that register. */
+
+void
+quantum_pool_stop()
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  int i;
+
+  if(!worker)
+    return;
+
+  while(quantum_pool_done() < tail)
+    sched_yield();
+
+  __atomic_store_n(&owner, 0, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&lock);
+  __atomic_store_n(&stop, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&lock);
+
+  for(i=0; i<workers; i++)
+    {
+      if(worker[i].thread)
+	pthread_join(worker[i].thread, 0);
+    }
+
+  free(worker);
+  quantum_memman(-workers * sizeof(quantum_pool_worker));
+
+  worker = 0;
+  workers = 0;
+  stop = 0;
+#endif
+}
+
+/* Queue the gates applied to REG from now on. Only one register can
+   use the pool at a time. Returns 1 if the pool has been assigned to
+   REG. Until quantum_pool_end() is called, REG may only be passed to
+   the functions applying gates or measuring it. */
+
+int
+quantum_pool_begin(quantum_reg *reg)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  quantum_reg *none = 0;
+
+  if(!workers || !reg->state)
+    return 0;
+
+  /* Fails if another register, or REG itself, already uses the pool */
+
+  if(!__atomic_compare_exchange_n(&owner, &none, reg, 0, __ATOMIC_ACQUIRE,
+				  __ATOMIC_RELAXED))
+    return 0;
+
+  stale = 1;
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Wait for the queued gates of REG and release the pool */
+
+void
+quantum_pool_end(quantum_reg *reg)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  if(!reg || reg != quantum_pool_owner())
+    return;
+
+  quantum_pool_sync(reg);
+
+  __atomic_store_n(&owner, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+/* Wait until the queued gates have been applied to REG. Called before
+   any access to the register as a whole. */
+
+void
+quantum_pool_sync(quantum_reg *reg)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  if(!reg || reg != quantum_pool_owner())
+    return;
+
+  while(quantum_pool_done() < tail)
+    sched_yield();
+
+  stale = 1;
+#endif
+}
+
+/* Queue a permutation of REG that flips the bits in TMASK of all basis
+   states containing CMASK. Returns 1 if the gate has been queued and
+   must not be applied by the caller. */
+
+int
+quantum_pool_permute(quantum_reg *reg, MAX_UNSIGNED cmask, MAX_UNSIGNED tmask)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  quantum_pool_gate g;
+
+  if(!quantum_pool_ready(reg))
+    return 0;
+
+  g.type = QUANTUM_POOL_PERMUTE;
+  g.cmask = cmask;
+  g.tmask = tmask;
+
+  quantum_pool_push(&g);
+
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+/* Queue a phase gate on REG, with the arguments of
+   quantum_kernel_phase(). Returns 1 if the gate has been queued. */
+
+int
+quantum_pool_phase(quantum_reg *reg, MAX_UNSIGNED xmask, MAX_UNSIGNED cmask,
+		   MAX_UNSIGNED tmask, complex double z1, complex double z0)
+{
+#if defined(HAVE_LIBPTHREAD) && defined(__GNUC__)
+  quantum_pool_gate g;
+
+  if(!quantum_pool_ready(reg))
+    return 0;
+
+  g.type = QUANTUM_POOL_PHASE;
+  g.xmask = xmask;
+  g.cmask = cmask;
+  g.tmask = tmask;
+  g.z1 = z1;
+  g.z0 = z0;
+
+  quantum_pool_push(&g);
+
+  return 1;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,53 @@
+/* pool.h: Declarations for pool.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __POOL_H
+
+#define __POOL_H
+
+#include <complex.h>
+
+#include "config.h"
+#include "qureg.h"
+
+/* Number of gates that can be queued before the calling thread has to
+   wait for the workers */
+
+#define QUANTUM_POOL_QUEUE 1024
+
+/* Number of permutations a worker applies in one sweep */
+
+#define QUANTUM_POOL_RUN 64
+
+extern int quantum_pool_start(int threads);
+extern void quantum_pool_stop();
+extern int quantum_pool_begin(quantum_reg *reg);
+extern void quantum_pool_end(quantum_reg *reg);
+extern void quantum_pool_sync(quantum_reg *reg);
+extern int quantum_pool_permute(quantum_reg *reg, MAX_UNSIGNED cmask,
+				MAX_UNSIGNED tmask);
+extern int quantum_pool_phase(quantum_reg *reg, MAX_UNSIGNED xmask,
+			      MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+			      complex double z1, complex double z0);
+
+#endif
@@ -0,0 +1,406 @@
+/* precision.c: Single and double precision quantum registers
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "precision.h"
+#include "qureg.h"
+#include "matrix.h"
+#include "qcomplex.h"
+#include "config.h"
+#include "error.h"
+#include "numa.h"
+#include "context.h"
+#include "parallel.h"
+#include "pool.h"
+
+/* The amplitudes of a register are stored as float complex, double
+   complex or bfloat16 pairs, independent of the COMPLEX_FLOAT chosen
+   by configure. The kernels that sweep over the amplitudes are
+   instantiated for each type from kernels.h. */
+
+/* Split N elements among the threads of a parallel region like
+   `schedule(static)'. Returns the number of the calling thread. */
+
+int
+quantum_thread_range(long n, long *lo, long *hi)
+{
+#ifdef _OPENMP
+  int t = omp_get_thread_num(), k = omp_get_num_threads();
+  long q = n / k, r = n % k;
+
+  *lo = q * t + ((t < r) ? t : r);
+  *hi = *lo + q + (t < r);
+
+  return t;
+#else
+  *lo = 0;
+  *hi = n;
+
+  return 0;
+#endif
+}
+
+/* Maximum number of threads of a parallel region */
+
+int
+quantum_threads()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+#define QUANTUM_LOAD(a, i) ((a)[i])
+#define QUANTUM_STORE(a, i, z) ((a)[i] = (z))
+
+#define QUANTUM_S float complex
+#define QUANTUM_T float complex
+#define QUANTUM_K(name) name ## _single
+#include "kernels.h"
+#undef QUANTUM_S
+#undef QUANTUM_T
+#undef QUANTUM_K
+
+#define QUANTUM_S double complex
+#define QUANTUM_T double complex
+#define QUANTUM_K(name) name ## _double
+#include "kernels.h"
+#undef QUANTUM_S
+#undef QUANTUM_T
+#undef QUANTUM_K
+
+#undef QUANTUM_LOAD
+#undef QUANTUM_STORE
+
+#define QUANTUM_LOAD(a, i) quantum_bfloat16_get(&(a)[i])
+#define QUANTUM_STORE(a, i, z) quantum_bfloat16_set(&(a)[i], (z))
+
+#define QUANTUM_S quantum_bfloat16
+#define QUANTUM_T double complex
+#define QUANTUM_K(name) name ## _bfloat16
+#include "kernels.h"
+#undef QUANTUM_S
+#undef QUANTUM_T
+#undef QUANTUM_K
+
+#undef QUANTUM_LOAD
+#undef QUANTUM_STORE
+
+/* Registers stored as bfloat16 are renormalized after a number of
+   their gates, including phase gates, set in the current context.
+   The loss kept there sums up the deviations of the norm corrected by
+   doing so and the errors made when converting to bfloat16. */
+
+/* Convert the amplitudes of REG to PRECISION */
+
+void
+quantum_set_precision(int precision, quantum_reg *reg)
+{
+  int i;
+  size_t size, old;
+  double d = 0;
+  quantum_reg out;
+
+  if(precision == QUANTUM_NATIVE)
+    precision = QUANTUM_NATIVE_PRECISION;
+
+  if(precision != QUANTUM_SINGLE && precision != QUANTUM_DOUBLE
+     && precision != QUANTUM_BFLOAT16)
+    quantum_error(QUANTUM_EPRECISION);
+
+  quantum_pool_sync(reg);
+
+  old = quantum_amplitude_size(reg);
+
+  if(precision != quantum_precision(reg))
+    {
+      out = *reg;
+      out.precision = precision;
+      size = quantum_amplitude_size(&out);
+
+      if(quantum_memman_exceeds(reg->size * size))
+	quantum_error(QUANTUM_EBUDGET);
+
+      out.amplitude = quantum_numa_calloc(reg->size, size, QUANTUM_NUMA_LOCAL);
+
+      if(reg->size && !out.amplitude)
+	quantum_error(QUANTUM_ENOMEM);
+
+#ifdef _OPENMP
+#pragma omp parallel for reduction (+:d) if (quantum_parallel(reg->size))
+#endif
+      for(i=0; i<reg->size; i++)
+	{
+	  quantum_set_amplitude(&out, i, quantum_get_amplitude(reg, i));
+
+	  if(precision == QUANTUM_BFLOAT16)
+	    d += quantum_prob_inline(quantum_get_amplitude(reg, i)
+				     - quantum_get_amplitude(&out, i));
+	}
+
+      quantum_get_context()->loss += sqrt(d);
+
+      free(reg->amplitude);
+      reg->amplitude = out.amplitude;
+
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      (long) reg->size * size
+			      - (long) reg->size * old);
+    }
+
+  reg->precision = (precision == QUANTUM_NATIVE_PRECISION) ? 0 : precision;
+  reg->renormalized = 0;
+}
+
+/* Set the number of gates after which bfloat16 registers are
+   renormalized, 0 turns renormalization off. Returns the previous
+   interval. */
+
+int
+quantum_precision_renormalize(int n)
+{
+  quantum_context *ctx = quantum_get_context();
+  int old = ctx->renormalize;
+
+  ctx->renormalize = n;
+
+  return old;
+}
+
+/* Return the accumulated error caused by storing amplitudes as
+   bfloat16 */
+
+double
+quantum_precision_loss()
+{
+  return quantum_get_context()->loss;
+}
+
+void
+quantum_precision_reset()
+{
+  quantum_get_context()->loss = 0;
+}
+
+/* Count a gate applied to REG and renormalize if it is due. Each
+   register keeps its own count, since the rounding errors of one
+   register do not depend on the gates applied to others. */
+
+static void
+quantum_precision_gate(quantum_reg *reg)
+{
+  double r;
+  quantum_context *ctx;
+
+  if(quantum_precision(reg) != QUANTUM_BFLOAT16)
+    return;
+
+  ctx = quantum_get_context();
+
+  if(ctx->renormalize <= 0 || ++reg->renormalized < ctx->renormalize)
+    return;
+
+  reg->renormalized = 0;
+
+  /* The gate may still be waiting in the queue of the pool */
+
+  quantum_pool_sync(reg);
+
+  r = quantum_kernel_probsum_bfloat16(reg, 0, 0);
+
+  if(r > 0)
+    {
+      ctx->loss += fabs(1 - r);
+      quantum_kernel_phase_bfloat16(reg, 0, 0, 0, 1 / sqrt(r), 1);
+    }
+}
+
+/* Return the type of the amplitudes of REG */
+
+int
+quantum_get_precision(quantum_reg *reg)
+{
+  return quantum_precision(reg);
+}
+
+/* Return amplitude I of REG */
+
+complex double
+quantum_amplitude(int i, quantum_reg *reg)
+{
+  return quantum_get_amplitude(reg, i);
+}
+
+/* Dispatch the kernels according to the type of the amplitudes */
+
+void
+quantum_kernel_phase(quantum_reg *reg, MAX_UNSIGNED xmask,
+		     MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+		     complex double z1, complex double z0)
+{
+  if(!quantum_pool_phase(reg, xmask, cmask, tmask, z1, z0))
+    quantum_kernel_phase_part(reg, xmask, cmask, tmask, z1, z0);
+
+  quantum_precision_gate(reg);
+}
+
+/* Apply a phase gate to the basis states of REG without counting it
+   as a gate. REG may be a part of a larger register. */
+
+void
+quantum_kernel_phase_part(quantum_reg *reg, MAX_UNSIGNED xmask,
+			  MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+			  complex double z1, complex double z0)
+{
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      quantum_kernel_phase_single(reg, xmask, cmask, tmask, z1, z0);
+      break;
+    case QUANTUM_BFLOAT16:
+      quantum_kernel_phase_bfloat16(reg, xmask, cmask, tmask, z1, z0);
+      break;
+    default:
+      quantum_kernel_phase_double(reg, xmask, cmask, tmask, z1, z0);
+    }
+}
+
+void
+quantum_kernel_gate1(quantum_reg *reg, int target, complex double *m,
+		     long *first)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      quantum_kernel_gate1_single(reg, target, m, first);
+      break;
+    case QUANTUM_BFLOAT16:
+      quantum_kernel_gate1_bfloat16(reg, target, m, first);
+      break;
+    default:
+      quantum_kernel_gate1_double(reg, target, m, first);
+    }
+
+  quantum_precision_gate(reg);
+}
+
+void
+quantum_kernel_gatek(quantum_reg *reg, int *bits, int k, complex double *m,
+		     long *first, char *owner, char *keep, double limit)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      quantum_kernel_gatek_single(reg, bits, k, m, first, owner, keep, limit);
+      break;
+    case QUANTUM_BFLOAT16:
+      quantum_kernel_gatek_bfloat16(reg, bits, k, m, first, owner, keep,
+				    limit);
+      break;
+    default:
+      quantum_kernel_gatek_double(reg, bits, k, m, first, owner, keep, limit);
+    }
+
+  quantum_precision_gate(reg);
+}
+
+int
+quantum_kernel_prune(quantum_reg *reg, double limit)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return quantum_kernel_prune_single(reg, limit, 0);
+    case QUANTUM_BFLOAT16:
+      return quantum_kernel_prune_bfloat16(reg, limit, 0);
+    default:
+      return quantum_kernel_prune_double(reg, limit, 0);
+    }
+}
+
+/* Remove the basis states not marked in KEEP */
+
+int
+quantum_kernel_compact(quantum_reg *reg, char *keep)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return quantum_kernel_prune_single(reg, 0, keep);
+    case QUANTUM_BFLOAT16:
+      return quantum_kernel_prune_bfloat16(reg, 0, keep);
+    default:
+      return quantum_kernel_prune_double(reg, 0, keep);
+    }
+}
+
+double
+quantum_kernel_probsum(quantum_reg *reg, MAX_UNSIGNED mask,
+		       MAX_UNSIGNED value)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return quantum_kernel_probsum_single(reg, mask, value);
+    case QUANTUM_BFLOAT16:
+      return quantum_kernel_probsum_bfloat16(reg, mask, value);
+    default:
+      return quantum_kernel_probsum_double(reg, mask, value);
+    }
+}
+
+int
+quantum_kernel_select(quantum_reg *reg, double r)
+{
+  quantum_pool_sync(reg);
+
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return quantum_kernel_select_single(reg, r);
+    case QUANTUM_BFLOAT16:
+      return quantum_kernel_select_bfloat16(reg, r);
+    default:
+      return quantum_kernel_select_double(reg, r);
+    }
+}
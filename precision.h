@@ -0,0 +1,234 @@
+/* precision.h: Declarations for precision.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __PRECISION_H
+
+#define __PRECISION_H
+
+#include <complex.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+#include "qureg.h"
+
+/* Types of the amplitudes of a quantum register */
+
+#define QUANTUM_NATIVE 0  /* COMPLEX_FLOAT as chosen by configure */
+#define QUANTUM_SINGLE 1  /* float complex */
+#define QUANTUM_DOUBLE 2  /* double complex */
+#define QUANTUM_BFLOAT16 3  /* pairs of bfloat16, see below */
+
+/* USE_DOUBLE is not reliable for the complex type, so look at its
+   size instead */
+
+#define QUANTUM_NATIVE_PRECISION \
+  ((sizeof(COMPLEX_FLOAT) == sizeof(float complex)) ? QUANTUM_SINGLE \
+   : QUANTUM_DOUBLE)
+
+/* Amplitudes of QUANTUM_BFLOAT16 registers keep the upper half of a
+   float for both parts. The exponent range of a float is retained, so
+   the tiny amplitudes of wide registers do not underflow like they
+   would with IEEE half precision. All arithmetic is done in double
+   precision. */
+
+struct quantum_bfloat16_struct {
+  uint16_t re;
+  uint16_t im;
+};
+
+typedef struct quantum_bfloat16_struct quantum_bfloat16;
+
+static inline float
+quantum_bfloat16_float(uint16_t h)
+{
+  uint32_t u = (uint32_t) h << 16;
+  float f;
+
+  memcpy(&f, &u, sizeof(f));
+
+  return f;
+}
+
+/* Round to nearest even */
+
+static inline uint16_t
+quantum_float_bfloat16(float f)
+{
+  uint32_t u;
+
+  memcpy(&u, &f, sizeof(u));
+  u += 0x7FFF + ((u >> 16) & 1);
+
+  return u >> 16;
+}
+
+static inline complex double
+quantum_bfloat16_get(quantum_bfloat16 *a)
+{
+  return quantum_bfloat16_float(a->re)
+    + IMAGINARY * (double) quantum_bfloat16_float(a->im);
+}
+
+static inline void
+quantum_bfloat16_set(quantum_bfloat16 *a, complex double z)
+{
+  a->re = quantum_float_bfloat16(creal(z));
+  a->im = quantum_float_bfloat16(cimag(z));
+}
+
+/* Return the type of the amplitudes of REG */
+
+static inline int
+quantum_precision(quantum_reg *reg)
+{
+  return reg->precision ? reg->precision : QUANTUM_NATIVE_PRECISION;
+}
+
+/* Return the size of a single amplitude of REG */
+
+static inline size_t
+quantum_amplitude_size(quantum_reg *reg)
+{
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return sizeof(float complex);
+    case QUANTUM_BFLOAT16:
+      return sizeof(quantum_bfloat16);
+    default:
+      return sizeof(double complex);
+    }
+}
+
+/* Read and write amplitude I of REG regardless of its type. The
+   kernels below are faster for sweeps over the whole register. */
+
+static inline complex double
+quantum_get_amplitude(quantum_reg *reg, int i)
+{
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      return ((float complex *) reg->amplitude)[i];
+    case QUANTUM_BFLOAT16:
+      return quantum_bfloat16_get(&((quantum_bfloat16 *) reg->amplitude)[i]);
+    default:
+      return ((double complex *) reg->amplitude)[i];
+    }
+}
+
+static inline void
+quantum_set_amplitude(quantum_reg *reg, int i, complex double z)
+{
+  switch(quantum_precision(reg))
+    {
+    case QUANTUM_SINGLE:
+      ((float complex *) reg->amplitude)[i] = z;
+      break;
+    case QUANTUM_BFLOAT16:
+      quantum_bfloat16_set(&((quantum_bfloat16 *) reg->amplitude)[i], z);
+      break;
+    default:
+      ((double complex *) reg->amplitude)[i] = z;
+    }
+}
+
+/* Return the position of the basis state A in REG, or -1 if it is
+   not present. Registers without a hash table hold all states below
+   their size at the position given by the state itself. */
+
+static inline long
+quantum_find_state(MAX_UNSIGNED a, quantum_reg *reg)
+{
+  if(!reg->hashw)
+    return (a < (MAX_UNSIGNED) reg->size) ? (long) a : -1;
+
+  return quantum_get_state(a, *reg);
+}
+
+/* Compensated summation [A. Neumaier, Z. Angew. Math. Mech. 54, 39
+   (1974)]. The rounding error of each addition is collected in C. */
+
+struct quantum_sum_struct {
+  double s;
+  double c;
+};
+
+typedef struct quantum_sum_struct quantum_sum;
+
+static inline void
+quantum_sum_add(quantum_sum *a, double x)
+{
+  double t = a->s + x;
+
+  if(fabs(a->s) >= fabs(x))
+    a->c += (a->s - t) + x;
+  else
+    a->c += (x - t) + a->s;
+
+  a->s = t;
+}
+
+static inline double
+quantum_sum_get(quantum_sum *a)
+{
+  return a->s + a->c;
+}
+
+/* Kernels that create or drop basis states split the register into
+   blocks of QUANTUM_KERNEL_BLOCK states, so that the position of each
+   state in the result does not depend on the number of threads */
+
+#define QUANTUM_KERNEL_BLOCK 4096
+#define QUANTUM_KERNEL_BLOCKS(n) \
+  (((n) + QUANTUM_KERNEL_BLOCK - 1) / QUANTUM_KERNEL_BLOCK)
+
+extern void quantum_set_precision(int precision, quantum_reg *reg);
+extern int quantum_get_precision(quantum_reg *reg);
+extern complex double quantum_amplitude(int i, quantum_reg *reg);
+extern int quantum_precision_renormalize(int interval);
+extern double quantum_precision_loss();
+extern void quantum_precision_reset();
+extern int quantum_thread_range(long n, long *lo, long *hi);
+extern int quantum_threads();
+
+extern void quantum_kernel_phase(quantum_reg *reg, MAX_UNSIGNED xmask,
+				 MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+				 complex double z1, complex double z0);
+extern void quantum_kernel_phase_part(quantum_reg *reg, MAX_UNSIGNED xmask,
+				      MAX_UNSIGNED cmask, MAX_UNSIGNED tmask,
+				      complex double z1, complex double z0);
+extern void quantum_kernel_gate1(quantum_reg *reg, int target,
+				 complex double *m, long *first);
+extern void quantum_kernel_gatek(quantum_reg *reg, int *bits, int k,
+				 complex double *m, long *first, char *owner,
+				 char *keep, double limit);
+extern int quantum_kernel_prune(quantum_reg *reg, double limit);
+extern int quantum_kernel_compact(quantum_reg *reg, char *keep);
+extern double quantum_kernel_probsum(quantum_reg *reg, MAX_UNSIGNED mask,
+				     MAX_UNSIGNED value);
+extern int quantum_kernel_select(quantum_reg *reg, double r);
+
+#endif
@@ -0,0 +1,295 @@
+/* profile.c: Gate and memory profiling
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+#include "trace.h"
+#include "objcode.h"
+#include "matrix.h"
+#include "qureg.h"
+#include "precision.h"
+#include "qcomplex.h"
+#include "config.h"
+
+/* Status of the profiler (0 = disabled) */
+
+int quantum_profile_status = 0;
+
+/* Statistics for each opcode of objcode.h */
+
+static quantum_profile_entry profile[256];
+
+/* File the report is written to at exit */
+
+static char *profilefile = 0;
+
+/* Current time in nanoseconds */
+
+static long long
+quantum_profile_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Determine the histogram bucket of a duration NS */
+
+static int
+quantum_profile_bucket(unsigned long long ns)
+{
+  int e;
+
+  if(ns < 4)
+    return ns;
+
+  for(e=2; (ns >> (e + 1)); e++);
+
+  return 4 * (e - 1) + ((ns >> (e - 2)) & 3);
+}
+
+/* Lower bound of the durations in bucket B */
+
+static unsigned long long
+quantum_profile_bound(int b)
+{
+  if(b < 4)
+    return b;
+
+  return (unsigned long long) (4 + (b & 3)) << (b / 4 - 1);
+}
+
+/* Enable profiling */
+
+void
+quantum_profile_start()
+{
+  quantum_profile_status = 1;
+}
+
+/* Disable profiling. The collected statistics are kept. */
+
+void
+quantum_profile_stop()
+{
+  quantum_profile_status = 0;
+}
+
+/* Clear the collected statistics */
+
+void
+quantum_profile_reset()
+{
+  memset(profile, 0, sizeof(profile));
+}
+
+/* Start timing an operation on REG. This also serves the register
+   size trace of trace.c. */
+
+void
+quantum_profile_enter(quantum_profile_timer *t, quantum_reg *reg)
+{
+  if(!(quantum_profile_status || quantum_trace_status))
+    {
+      t->start = -1;
+      return;
+    }
+
+  t->size = reg->size;
+  t->start = quantum_profile_clock();
+}
+
+/* Account the operation timed by T to OPERATION */
+
+void
+quantum_profile_leave(quantum_profile_timer *t, int operation, 
+		      quantum_reg *reg)
+{
+  unsigned long long ns;
+  int entry;
+  quantum_profile_entry *p;
+
+  if(t->start < 0)
+    return;
+
+  if(quantum_trace_status)
+    quantum_trace_record(operation, reg);
+
+  if(!quantum_profile_status)
+    return;
+
+  ns = quantum_profile_clock() - t->start;
+
+  /* Every basis state is read and written once */
+
+  entry = quantum_amplitude_size(reg)
+    + (reg->state ? sizeof(MAX_UNSIGNED) : 0);
+
+  p = &profile[operation & 0xFF];
+
+#ifdef _OPENMP
+#pragma omp critical (quantum_profile)
+#endif
+  {
+    p->calls++;
+    p->ns += ns;
+    p->bytes += (unsigned long long) (t->size + reg->size) * entry;
+    p->sizein += t->size;
+    p->sizeout += reg->size;
+    p->hist[quantum_profile_bucket(ns)]++;
+
+    if(ns > p->maxns)
+      p->maxns = ns;
+
+    if(reg->size > p->maxsize)
+      p->maxsize = reg->size;
+  }
+}
+
+/* Find the duration below which a fraction Q of the calls finished */
+
+static double
+quantum_profile_percentile(quantum_profile_entry *p, double q)
+{
+  int b;
+  unsigned long n = 0;
+
+  for(b=0; b<QUANTUM_PROFILE_BUCKETS-1; b++)
+    {
+      n += p->hist[b];
+
+      if(n >= q * p->calls)
+	break;
+    }
+
+  /* Report the middle of the bucket */
+
+  return (quantum_profile_bound(b) + quantum_profile_bound(b + 1)) / 2.0;
+}
+
+/* Print the collected statistics */
+
+void
+quantum_profile_print(FILE *out)
+{
+  int i;
+  unsigned long calls = 0;
+  unsigned long long ns = 0;
+  quantum_profile_entry *p;
+
+  for(i=0; i<256; i++)
+    {
+      calls += profile[i].calls;
+      ns += profile[i].ns;
+    }
+
+  fprintf(out, "# libquantum profile: %lu operations in %.6f s, "
+	  "peak memory %lu bytes\n", calls, ns * 1e-9, quantum_memman_peak());
+  fprintf(out, "# %-16s %9s %10s %9s %9s %9s %9s %9s %10s %9s %9s %9s\n",
+	  "operation", "calls", "total[s]", "mean[us]", "p50[us]", "p90[us]",
+	  "p99[us]", "max[us]", "MB", "size_in", "size_out", "max_size");
+
+  for(i=0; i<256; i++)
+    {
+      p = &profile[i];
+
+      if(!p->calls)
+	continue;
+
+      fprintf(out, "  %-16s %9lu %10.6f %9.2f %9.2f %9.2f %9.2f %9.2f "
+	      "%10.2f %9.0f %9.0f %9i\n",
+	      quantum_objcode_opname(i), p->calls, p->ns * 1e-9,
+	      p->ns * 1e-3 / p->calls, 
+	      quantum_profile_percentile(p, 0.5) * 1e-3,
+	      quantum_profile_percentile(p, 0.9) * 1e-3,
+	      quantum_profile_percentile(p, 0.99) * 1e-3,
+	      p->maxns * 1e-3, p->bytes / 1048576.0,
+	      (double) p->sizein / p->calls, (double) p->sizeout / p->calls,
+	      p->maxsize);
+    }
+}
+
+/* Write the collected statistics to FILE, or to stderr if FILE is
+   NULL or "-" */
+
+void
+quantum_profile_report(char *file)
+{
+  FILE *out = stderr;
+
+  if(file && strcmp(file, "-"))
+    {
+      out = fopen(file, "w");
+
+      if(!out)
+	{
+	  fprintf(stderr, "Could not open %s: ", file);
+	  perror(0);
+	  return;
+	}
+    }
+
+  quantum_profile_print(out);
+
+  if(out != stderr)
+    fclose(out);
+}
+
+/* This function is used as a hook before exiting when profiling has
+   been enabled with the QUANTUM_PROFILE environment variable */
+
+static void
+quantum_profile_exit()
+{
+  quantum_profile_report(profilefile);
+}
+
+/* Enable profiling if the QUANTUM_PROFILE environment variable is
+   set. Its value is the file the report is written to at exit, with
+   "-" meaning stderr. */
+
+void
+quantum_profile_env()
+{
+  static int done = 0;
+  char *c;
+
+  if(done)
+    return;
+
+  done = 1;
+  c = getenv("QUANTUM_PROFILE");
+
+  if(c)
+    {
+      profilefile = *c ? c : "-";
+      quantum_profile_start();
+      atexit(quantum_profile_exit);
+    }
+}
@@ -0,0 +1,76 @@
+/* profile.h: Declarations for profile.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __PROFILE_H
+
+#define __PROFILE_H
+
+#include <stdio.h>
+
+#include "config.h"
+#include "qureg.h"
+
+/* Operation times are sorted into logarithmic buckets, four per
+   power of two nanoseconds */
+
+#define QUANTUM_PROFILE_BUCKETS 256
+
+/* Statistics of a single type of operation */
+
+struct quantum_profile_entry_struct
+{
+  unsigned long calls;
+  unsigned long long ns;       /* total time in nanoseconds */
+  unsigned long long maxns;    /* longest single call */
+  unsigned long long bytes;    /* estimated amount of memory touched */
+  unsigned long long sizein;   /* sum of the register sizes before */
+  unsigned long long sizeout;  /* and after each call */
+  int maxsize;
+  unsigned long hist[QUANTUM_PROFILE_BUCKETS];
+};
+
+typedef struct quantum_profile_entry_struct quantum_profile_entry;
+
+/* An operation being timed */
+
+struct quantum_profile_timer_struct
+{
+  long long start;  /* -1 if profiling is disabled */
+  int size;         /* register size at the start */
+};
+
+typedef struct quantum_profile_timer_struct quantum_profile_timer;
+
+extern int quantum_profile_status;
+
+extern void quantum_profile_start();
+extern void quantum_profile_stop();
+extern void quantum_profile_reset();
+extern void quantum_profile_enter(quantum_profile_timer *t, quantum_reg *reg);
+extern void quantum_profile_leave(quantum_profile_timer *t, int operation,
+				  quantum_reg *reg);
+extern void quantum_profile_print(FILE *out);
+extern void quantum_profile_report(char *file);
+extern void quantum_profile_env();
+
+#endif
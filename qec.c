@@ -28,26 +28,24 @@
 #include "config.h"
 #include "decoherence.h"
 #include "measure.h"
+#include "context.h"
 
-/* Type of the QEC. Currently implemented versions are:
+/* The type of the QEC and the number of protected qubits are kept in
+   the current context. Currently implemented types are:
 
    0: no QEC (default)
    1: Steane's 3-bit code */
 
-int type = 0;
-
-/* How many qubits are protected */
-
-int width = 0;
-
 
 /* Change the status of the QEC. */
 
 void
 quantum_qec_set_status(int stype, int swidth)
 {
-  type = stype;
-  width = swidth;
+  quantum_context *ctx = quantum_get_context();
+
+  ctx->qec_type = stype;
+  ctx->qec_width = swidth;
 }
 
 /* Get the current QEC status */
@@ -55,10 +53,12 @@ quantum_qec_set_status(int stype, int swidth)
 void
 quantum_qec_get_status(int *ptype, int *pwidth)
 {
+  quantum_context *ctx = quantum_get_context();
+
   if(ptype)
-    *ptype = type;
+    *ptype = ctx->qec_type;
   if(pwidth)
-    *pwidth = width;
+    *pwidth = ctx->qec_width;
 } 
 
 /* Encode a quantum register. All qubits up to SWIDTH are protected,
@@ -151,25 +151,24 @@ quantum_qec_decode(int type, int width, quantum_reg *reg)
 int
 quantum_qec_counter(int inc, int frequency, quantum_reg *reg)
 {
-  static int counter = 0;
-  static int freq = (1<<30);
+  quantum_context *ctx = quantum_get_context();
 
   if(inc > 0)
-    counter += inc;
+    ctx->qec_counter += inc;
   else if(inc < 0)
-    counter = 0;
+    ctx->qec_counter = 0;
 
   if(frequency > 0)
-    freq = frequency;
+    ctx->qec_freq = frequency;
 
-  if(counter >= freq)
+  if(ctx->qec_counter >= ctx->qec_freq)
     {
-      counter = 0;
-      quantum_qec_decode(type, width, reg);
-      quantum_qec_encode(type, width, reg);
+      ctx->qec_counter = 0;
+      quantum_qec_decode(ctx->qec_type, ctx->qec_width, reg);
+      quantum_qec_encode(ctx->qec_type, ctx->qec_width, reg);
     }
     
-  return counter;
+  return ctx->qec_counter;
 }
 
 /* Fault-tolerant version of the NOT gate */
@@ -179,9 +178,11 @@ quantum_sigma_x_ft(int target, quantum_reg *reg)
 {
   int tmp;
   float lambda;
+  quantum_context *ctx = quantum_get_context();
+  int width = ctx->qec_width;
 
-  tmp = type;
-  type = 0;
+  tmp = ctx->qec_type;
+  ctx->qec_type = 0;
 
   lambda = quantum_get_decoherence();
   quantum_set_decoherence(0);
@@ -195,7 +196,7 @@ quantum_sigma_x_ft(int target, quantum_reg *reg)
 
   quantum_qec_counter(1, 0, reg);
 
-  type = tmp;
+  ctx->qec_type = tmp;
 }
 
 /* Fault-tolerant version of the Controlled NOT gate */
@@ -205,9 +206,11 @@ quantum_cnot_ft(int control, int target, quantum_reg *reg)
 {
   int tmp;
   float lambda;
+  quantum_context *ctx = quantum_get_context();
+  int width = ctx->qec_width;
 
-  tmp = type;
-  type = 0;
+  tmp = ctx->qec_type;
+  ctx->qec_type = 0;
 
   /* These operations can be performed simultaneously */
   
@@ -221,7 +224,7 @@ quantum_cnot_ft(int control, int target, quantum_reg *reg)
 
   quantum_qec_counter(1, 0, reg);
 
-  type = tmp;
+  ctx->qec_type = tmp;
 
 }
 
@@ -232,8 +235,13 @@ quantum_toffoli_ft(int control1, int control2, int target, quantum_reg *reg)
 {
   int i;
   int c1, c2;
+  int width = quantum_get_context()->qec_width;
   MAX_UNSIGNED mask;
 
+  /* The encoded qubits are addressed by their bits directly */
+
+  quantum_unmap(reg);
+
   mask = ((MAX_UNSIGNED) 1 << target)
     + ((MAX_UNSIGNED) 1 << (target+width))
     + ((MAX_UNSIGNED) 1 << (target+2*width));
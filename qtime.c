@@ -28,6 +28,7 @@
 #include "qtime.h"
 #include "qureg.h"
 #include "qcomplex.h"
+#include "precision.h"
 #include "config.h"
 
 /* Forth-order Runge-Kutta
@@ -41,10 +42,9 @@ quantum_rk4(quantum_reg *reg, double t, double dt,
 {
   quantum_reg k, out, tmp;
   double r = 0;
-  int i;
   void *hash;
   int hashw;
-  COMPLEX_FLOAT step = dt;
+  complex double step = dt;
 
   hash = reg->hash;
   reg->hash = 0;
@@ -95,14 +95,14 @@ quantum_rk4(quantum_reg *reg, double t, double dt,
   if(flags & QUANTUM_RK4_IMAGINARY)
     {
 
-      for(i=0; i<out.size; i++)
-	r += quantum_prob(out.amplitude[i]);
+      r = quantum_kernel_probsum(&out, 0, 0);
 
       quantum_scalar_qureg(sqrt(1.0/r), &out);
     }
 
   out.hash = hash;
   out.hashw = hashw;
+  out.recorder = reg->recorder;
 
   *reg = out;
   
@@ -118,6 +118,7 @@ quantum_rk4a(quantum_reg *reg, double t, double *dt, double epsilon,
 {
   quantum_reg reg2, old;
   double delta, r, dtused;
+  complex double a, b;
   int i;
   void *hash;
   int hashw;
@@ -141,8 +142,9 @@ quantum_rk4a(quantum_reg *reg, double t, double *dt, double epsilon,
 
       for(i=0;i<reg->size;i++)
 	{
-	  r = 2*sqrt(quantum_prob(reg->amplitude[i] - reg2.amplitude[i])/
-		     quantum_prob(reg->amplitude[i] + reg2.amplitude[i]));
+	  a = quantum_get_amplitude(reg, i);
+	  b = quantum_get_amplitude(&reg2, i);
+	  r = 2*sqrt(quantum_prob(a - b) / quantum_prob(a + b));
 	  
 	  if(r > delta)
 	    delta = r;
@@ -165,9 +167,9 @@ quantum_rk4a(quantum_reg *reg, double t, double *dt, double epsilon,
       if(delta > epsilon)
 	{
 	  memcpy(reg->amplitude, old.amplitude, 
-		 reg->size*sizeof(COMPLEX_FLOAT));
+		 reg->size * quantum_amplitude_size(reg));
 	  memcpy(reg2.amplitude, old.amplitude, 
-		 reg->size*sizeof(COMPLEX_FLOAT));
+		 reg->size * quantum_amplitude_size(reg));
 	  if(reg->state && old.state)
 	    memcpy(reg->state, old.state, reg->size*sizeof(MAX_UNSIGNED));
 	  if(reg2.state && old.state)
@@ -0,0 +1,58 @@
+/* quobopt.c: Optimize quantum object code file
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "objcode.h"
+#include "optimize.h"
+
+int main(int argc, char **argv)
+{
+  int before, removed;
+  quantum_objcode_program *prog;
+
+  if(argc != 3)
+    {
+      printf("Usage: quobopt [input file] [output file]\n\n");
+      return 1;
+    }
+
+  prog = quantum_objcode_load(argv[1]);
+
+  if(!prog)
+    return 1;
+
+  before = prog->num;
+  removed = quantum_objcode_optimize(prog);
+
+  if(quantum_objcode_save(prog, argv[2]))
+    return 1;
+
+  printf("%i operations, %i removed (%.1f%%)\n", before - removed, removed,
+	 before ? 100.0 * removed / before : 0.0);
+
+  quantum_objcode_free(prog);
+
+  return 0;
+}
@@ -30,84 +30,42 @@
 
 int main(int argc, char **argv)
 {
-  int i, j, k, l;
-  FILE *fhd;
-  unsigned char operation;
-  unsigned char buf[OBJBUF_SIZE];
-  char output[OBJBUF_SIZE];
-  char opname[256][25];
-  MAX_UNSIGNED mu;
-  double d;
-
-  strncpy(opname[INIT], "init", 24);
-  strncpy(opname[CNOT], "cnot", 24);
-  strncpy(opname[TOFFOLI], "toffoli", 24);
-  strncpy(opname[SIGMA_X], "sigma_x", 24);
-  strncpy(opname[SIGMA_Y], "sigma_y", 24);
-  strncpy(opname[SIGMA_Z], "sigma_z", 24);
-  strncpy(opname[HADAMARD], "hadamard", 24);
-  strncpy(opname[ROT_X], "rotate_x", 24);
-  strncpy(opname[ROT_Y], "rotate_y", 24);
-  strncpy(opname[ROT_Z], "rotate_z", 24);
-  strncpy(opname[PHASE_KICK], "phase_kick", 24);
-  strncpy(opname[PHASE_SCALE], "phase_scale", 24);
-  strncpy(opname[COND_PHASE], "cond_phase", 24);
-  strncpy(opname[CPHASE_KICK], "cond_phase_kick", 24);
-  strncpy(opname[MEASURE], "measure", 24);
-  strncpy(opname[BMEASURE], "bmeasure", 24);
-  strncpy(opname[BMEASURE_P], "bmeasure_preserve", 24);
-  strncpy(opname[SWAPLEADS], "swaptheleads", 24);
-  strncpy(opname[NOP], "nop", 24);
+  int i, status;
+  quantum_objcode_reader r;
+  quantum_objcode_op op;
+  const char *name;
+
   if(argc != 2)
     {
       printf("Usage: quobprint [file]\n\n");
       return 1;
     }
 
-  fhd = fopen(argv[1], "r");
+  if(quantum_objcode_open(argv[1], &r))
+    return 1;
 
-  if(!fhd)
-    {
-      fprintf(stderr, "Could not open %s: ", argv[1]);
-      perror(0);
-      return 1;
-    }
+  if(r.version > 1)
+    printf("# object code version %i, %i qubits, %llu operations%s%s\n",
+	   r.version, r.width, (unsigned long long) r.ops,
+	   (r.flags & OBJCODE_COMPACT) ? ", compact" : "",
+	   (r.flags & OBJCODE_LZ) ? ", compressed" : "");
 
-  for(i=0; !feof(fhd); i++)
+  for(i=0; (status = quantum_objcode_next(&r, &op)) > 0; i++)
     {
-      for(j=0; j<OBJBUF_SIZE; j++)
-	{
-	  buf[j] = 0;
-	  output[j] = 0;
-	}
-      operation = fgetc(fhd);
-
-      if(feof(fhd))
-	break;
+      name = quantum_objcode_opname(op.operation);
 
-      switch(operation)
+      switch(op.operation)
 	{
 	case INIT:
-	  fread(buf, sizeof(MAX_UNSIGNED), 1, fhd);
-	  mu = quantum_char2mu(buf);
-	  printf("%5i: %s %llu\n", i, opname[INIT], mu);
+	  printf("%5i: %s %llu\n", i, name, (unsigned long long) op.mu);
 	  break;
 	case CNOT:
 	case COND_PHASE:
-	  fread(buf, sizeof(int), 1, fhd);
-	  j = quantum_char2int(buf);
-	  fread(buf, sizeof(int), 1, fhd);
-	  k = quantum_char2int(buf);
-	  printf("%5i: %s %i, %i\n", i, opname[operation], j, k);
+	  printf("%5i: %s %i, %i\n", i, name, op.arg[0], op.arg[1]);
 	  break;
 	case TOFFOLI:
-	  fread(buf, sizeof(int), 1, fhd);
-	  j = quantum_char2int(buf);
-	  fread(buf, sizeof(int), 1, fhd);
-	  k = quantum_char2int(buf);
-	  fread(buf, sizeof(int), 1, fhd);
-	  l = quantum_char2int(buf);
-	  printf("%5i: %s %i, %i, %i\n", i, opname[TOFFOLI], j, k, l);
+	  printf("%5i: %s %i, %i, %i\n", i, name, op.arg[0], op.arg[1],
+		 op.arg[2]);
 	  break;
 	case SIGMA_X:
 	case SIGMA_Y:
@@ -116,42 +74,34 @@ int main(int argc, char **argv)
 	case BMEASURE:
 	case BMEASURE_P:
 	case SWAPLEADS:
-	  fread(buf, sizeof(int), 1, fhd);
-	  j = quantum_char2int(buf);
-	  printf("%5i: %s %i\n", i, opname[operation], j);
+	  printf("%5i: %s %i\n", i, name, op.arg[0]);
 	  break;
 	case ROT_X:
 	case ROT_Y:
 	case ROT_Z:
 	case PHASE_KICK:
 	case PHASE_SCALE:
-	  fread(buf, sizeof(int), 1, fhd);
-	  j = quantum_char2int(buf);
-	  fread(buf, sizeof(double), 1, fhd);
-	  d = quantum_char2double(buf);
-	  printf("%5i: %s %i, %f\n", i, opname[operation], j, d);
+	  printf("%5i: %s %i, %f\n", i, name, op.arg[0], op.d);
 	  break;
 	case CPHASE_KICK:
-	  fread(buf, sizeof(int), 1, fhd);
-	  j = quantum_char2int(buf);
-	  fread(buf, sizeof(int), 1, fhd);
-	  k = quantum_char2int(buf);
-	  fread(buf, sizeof(double), 1, fhd);
-	  d = quantum_char2double(buf);
-	  printf("%5i: %s %i, %i, %f\n", i, opname[operation], j, k, d);
+	case CPHASE_SHIFT:
+	  printf("%5i: %s %i, %i, %f\n", i, name, op.arg[0], op.arg[1], op.d);
 	  break;
 	case MEASURE:
 	case NOP:
-	  printf("%5i: %s\n", i, opname[operation]);
+	  printf("%5i: %s\n", i, name);
 	  break;
-	default:
-	  printf("%i: Unknown opcode 0x(%X)!\n", i, operation);
-	  exit(EXIT_FAILURE);
 	}
+    }
 
+  if(status < 0)
+    {
+      printf("%i: Unknown opcode or truncated operation 0x(%X)!\n", i,
+	     op.operation);
+      exit(EXIT_FAILURE);
     }
 
-  fclose(fhd);
+  quantum_objcode_close(&r);
 
   return 0;
 }
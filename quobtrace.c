@@ -0,0 +1,196 @@
+/* quobtrace: Summarize a register size trace
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+
+/* Statistics for one type of operation */
+
+struct entry
+{
+  char name[32];
+  unsigned long calls;
+  double size;      /* sum of the register sizes */
+  double growth;    /* sum of the size changes */
+  double pruned;
+  int maxsize;
+};
+
+int main(int argc, char **argv)
+{
+  FILE *in;
+  char line[256], name[32];
+  unsigned long index, records=0, sparse=0, overloaded=0, pruning=0;
+  unsigned long long bytes, maxbytes=0;
+  int i, width, size, pruned, n=0, maxwidth=0, maxsize=0, minsize=-1;
+  int prev=0, hashw;
+  double load, maxload=0, sumload=0, sumsize=0, totalpruned=0;
+  double density, maxdensity=0;
+  unsigned long hist[65];
+  struct entry ops[64];
+
+  if(argc != 2)
+    {
+      printf("Usage: quobtrace [trace file]\n\n");
+      return 1;
+    }
+
+  in = fopen(argv[1], "r");
+
+  if(!in)
+    {
+      fprintf(stderr, "Could not open %s: ", argv[1]);
+      perror(0);
+      return 1;
+    }
+
+  memset(hist, 0, sizeof(hist));
+
+  while(fgets(line, sizeof(line), in))
+    {
+      if(sscanf(line, "%lu,%31[^,],%i,%i,%lf,%i,%llu", &index, name, &width,
+		&size, &load, &pruned, &bytes) != 7)
+	continue;
+
+      for(i=0; i<n; i++)
+	{
+	  if(!strcmp(ops[i].name, name))
+	    break;
+	}
+
+      if(i == n)
+	{
+	  if(n == 64)
+	    continue;
+
+	  memset(&ops[n], 0, sizeof(struct entry));
+	  strcpy(ops[n].name, name);
+	  n++;
+	}
+
+      ops[i].calls++;
+      ops[i].size += size;
+      ops[i].growth += records ? size - prev : 0;
+      ops[i].pruned += pruned;
+
+      if(size > ops[i].maxsize)
+	ops[i].maxsize = size;
+
+      records++;
+      sumsize += size;
+      totalpruned += pruned;
+      prev = size;
+
+      if(pruned)
+	pruning++;
+
+      if(size > maxsize)
+	maxsize = size;
+
+      if(minsize < 0 || size < minsize)
+	minsize = size;
+
+      if(width > maxwidth)
+	maxwidth = width;
+
+      if(bytes > maxbytes)
+	maxbytes = bytes;
+
+      density = size / ldexp(1, width);
+
+      if(density > maxdensity)
+	maxdensity = density;
+
+      /* The gates warn about an inefficient hash table above a load
+	 factor of 0.5 */
+
+      if(load > 0)
+	{
+	  sparse++;
+	  sumload += load;
+
+	  if(load > maxload)
+	    maxload = load;
+
+	  if(load > 0.5)
+	    overloaded++;
+	}
+
+      for(i=0; (1 << i) <= size && i < 64; i++);
+      hist[i]++;
+    }
+
+  fclose(in);
+
+  if(!records)
+    {
+      printf("No records found in %s\n", argv[1]);
+      return 1;
+    }
+
+  printf("%lu operations on up to %i qubits\n", records, maxwidth);
+  printf("size: min %i, mean %.1f, max %i, final %i\n", minsize,
+	 sumsize / records, maxsize, prev);
+  printf("peak density %.3g, peak register memory %llu bytes\n", maxdensity,
+	 maxbytes);
+
+  if(sparse)
+    printf("hash load: mean %.3f, max %.3f, %lu operations above 0.5\n",
+	   sumload / sparse, maxload, overloaded);
+
+  printf("pruned: %.0f basis states in %lu operations\n\n", totalpruned,
+	 pruning);
+
+  printf("%-16s %9s %12s %9s %12s %12s\n", "operation", "calls", 
+	 "mean size", "max size", "mean growth", "pruned");
+
+  for(i=0; i<n; i++)
+    printf("%-16s %9lu %12.1f %9i %12.2f %12.0f\n", ops[i].name,
+	   ops[i].calls, ops[i].size / ops[i].calls, ops[i].maxsize,
+	   ops[i].growth / ops[i].calls, ops[i].pruned);
+
+  printf("\n%-16s %9s\n", "size", "operations");
+
+  for(i=0; i<65; i++)
+    {
+      if(hist[i])
+	printf("< 2^%-12i %9lu\n", i, hist[i]);
+    }
+
+  /* Compare the peak memory of the sparse representation (state,
+     amplitude and a hash table with a load of at most 0.5) with a
+     dense vector of all amplitudes */
+
+  for(hashw=0; (1 << hashw) < 2 * maxsize && hashw < 62; hashw++);
+
+  printf("\nsuggested hash width %i (sparse: %.0f bytes, dense: %.0f "
+	 "bytes)\n", hashw, 
+	 (double) maxsize * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED))
+	 + ldexp(sizeof(int), hashw), ldexp(sizeof(COMPLEX_FLOAT), maxwidth));
+
+  return 0;
+}
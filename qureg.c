@@ -31,7 +31,44 @@
 #include "config.h"
 #include "qcomplex.h"
 #include "objcode.h"
+#include "profile.h"
+#include "trace.h"
 #include "error.h"
+#include "numa.h"
+#include "precision.h"
+#include "parallel.h"
+#include "pool.h"
+
+/* Allocate an identity qubit map for REG */
+
+void
+quantum_new_map(quantum_reg *reg)
+{
+  int i;
+
+  reg->map = malloc(8 * sizeof(MAX_UNSIGNED) * sizeof(int));
+
+  if(!reg->map)
+    quantum_error(QUANTUM_ENOMEM);
+
+  quantum_memman(8 * sizeof(MAX_UNSIGNED) * sizeof(int));
+
+  for(i=0; i<8*sizeof(MAX_UNSIGNED); i++)
+    reg->map[i] = i;
+}
+
+/* Free the qubit map of REG */
+
+static void
+quantum_delete_map(quantum_reg *reg)
+{
+  if(reg->map)
+    {
+      free(reg->map);
+      quantum_memman(-8 * sizeof(MAX_UNSIGNED) * sizeof(int));
+      reg->map = 0;
+    }
+}
 
 /* Convert a vector to a quantum register */
 
@@ -58,23 +95,36 @@ quantum_matrix2qureg(quantum_matrix *m, int width)
 
   reg.size = size;
   reg.hashw = width + 2;
+  reg.recorder = 0;
+  reg.map = 0;
+  reg.precision = 0;
+  reg.renormalized = 0;
 
-  reg.amplitude = calloc(size, sizeof(COMPLEX_FLOAT));
-  reg.state = calloc(size, sizeof(MAX_UNSIGNED));
+  if(quantum_memman_exceeds(size * (sizeof(COMPLEX_FLOAT) 
+				    + sizeof(MAX_UNSIGNED))
+			    + (1 << reg.hashw) * sizeof(int)))
+    quantum_error(QUANTUM_EBUDGET);
+
+  reg.amplitude = quantum_numa_calloc(size, sizeof(COMPLEX_FLOAT),
+				      QUANTUM_NUMA_LOCAL);
+  reg.state = quantum_numa_calloc(size, sizeof(MAX_UNSIGNED),
+				  QUANTUM_NUMA_LOCAL);
 
   if(!(reg.state && reg.amplitude))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(size * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE, size * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_STATE, size * sizeof(MAX_UNSIGNED));
 
   /* Allocate the hash table */
 
-  reg.hash = calloc(1 << reg.hashw, sizeof(int));
+  reg.hash = quantum_numa_calloc(1 << reg.hashw, sizeof(int),
+				 QUANTUM_NUMA_RANDOM);
 
   if(!reg.hash)
     quantum_error(QUANTUM_ENOMEM);
         
-  quantum_memman((1 << reg.hashw) * sizeof(int));
+  quantum_memman_category(QUANTUM_MEM_HASH, (1 << reg.hashw) * sizeof(int));
 
   /* Copy the nonzero amplitudes of the vector into the quantum
      register */
@@ -99,10 +149,22 @@ quantum_new_qureg(MAX_UNSIGNED initval, int width)
 {
   quantum_reg reg;
   char *c;
+  static int quobfile = 0;
 
   reg.width = width;
   reg.size = 1;
   reg.hashw = width + 2;
+  reg.recorder = 0;
+  reg.map = 0;
+  reg.precision = 0;
+  reg.renormalized = 0;
+
+  quantum_memman_env();
+  quantum_numa_env();
+
+  if(quantum_memman_exceeds(sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)
+			    + (1 << reg.hashw) * sizeof(int)))
+    quantum_error(QUANTUM_EBUDGET);
 
   /* Allocate memory for 1 base state */
 
@@ -112,16 +174,18 @@ quantum_new_qureg(MAX_UNSIGNED initval, int width)
   if(!(reg.state && reg.amplitude))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(sizeof(MAX_UNSIGNED) + sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE, sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_STATE, sizeof(MAX_UNSIGNED));
 
   /* Allocate the hash table */
 
-  reg.hash = calloc(1 << reg.hashw, sizeof(int));
+  reg.hash = quantum_numa_calloc(1 << reg.hashw, sizeof(int),
+				 QUANTUM_NUMA_RANDOM);
 
   if(!reg.hash)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman((1 << reg.hashw) * sizeof(int));
+  quantum_memman_category(QUANTUM_MEM_HASH, (1 << reg.hashw) * sizeof(int));
 
   /* Initialize the quantum register */
   
@@ -134,14 +198,18 @@ quantum_new_qureg(MAX_UNSIGNED initval, int width)
 
   c = getenv("QUOBFILE");
 
-  if(c)
+  if(c && !quobfile)
     {
+      quobfile = 1;
       quantum_objcode_start();
       quantum_objcode_file(c);
       atexit((void *) &quantum_objcode_exit);
     }
 
-  quantum_objcode_put(INIT, initval);
+  quantum_profile_env();
+  quantum_trace_env();
+
+  quantum_objcode_put(INIT, &reg, initval, width);
 
   return reg;
 }
@@ -157,16 +225,24 @@ quantum_new_qureg_size(int n, int width)
   reg.size = n;
   reg.hashw = 0;
   reg.hash = 0;
+  reg.recorder = 0;
+  reg.map = 0;
+  reg.precision = 0;
+  reg.renormalized = 0;
 
   /* Allocate memory for n basis states */
 
-  reg.amplitude = calloc(n, sizeof(COMPLEX_FLOAT));
+  if(quantum_memman_exceeds(n * sizeof(COMPLEX_FLOAT)))
+    quantum_error(QUANTUM_EBUDGET);
+
+  reg.amplitude = quantum_numa_calloc(n, sizeof(COMPLEX_FLOAT),
+				      QUANTUM_NUMA_LOCAL);
   reg.state = 0;
 
   if(!reg.amplitude)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(n*sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE, n*sizeof(COMPLEX_FLOAT));
 
   return reg;
 }
@@ -182,16 +258,26 @@ quantum_new_qureg_sparse(int n, int width)
   reg.size = n;
   reg.hashw = 0;
   reg.hash = 0;
+  reg.recorder = 0;
+  reg.map = 0;
+  reg.precision = 0;
+  reg.renormalized = 0;
 
   /* Allocate memory for n basis states */
 
-  reg.amplitude = calloc(n, sizeof(COMPLEX_FLOAT));
-  reg.state = calloc(n, sizeof(MAX_UNSIGNED));
+  if(quantum_memman_exceeds(n * (sizeof(COMPLEX_FLOAT) 
+				 + sizeof(MAX_UNSIGNED))))
+    quantum_error(QUANTUM_EBUDGET);
+
+  reg.amplitude = quantum_numa_calloc(n, sizeof(COMPLEX_FLOAT),
+				      QUANTUM_NUMA_LOCAL);
+  reg.state = quantum_numa_calloc(n, sizeof(MAX_UNSIGNED), QUANTUM_NUMA_LOCAL);
 
   if(!(reg.amplitude && reg.state))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(n*(sizeof(COMPLEX_FLOAT)+sizeof(MAX_UNSIGNED)));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE, n * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_STATE, n * sizeof(MAX_UNSIGNED));
 
   return reg;
 }
@@ -207,7 +293,8 @@ quantum_qureg2matrix(quantum_reg reg)
   m = quantum_new_matrix(1, 1 << reg.width);
   
   for(i=0; i<reg.size; i++)
-    m.t[reg.state[i]] = reg.amplitude[i];
+    m.t[quantum_unmap_state(reg.state[i], &reg)] 
+      = quantum_get_amplitude(&reg, i);
 
   return m;
 }
@@ -218,7 +305,7 @@ void
 quantum_destroy_hash(quantum_reg *reg)
 {
   free(reg->hash);
-  quantum_memman(-(1 << reg->hashw) * sizeof(int));
+  quantum_memman_category(QUANTUM_MEM_HASH, -(1 << reg->hashw) * sizeof(int));
   reg->hash = 0;
 }
 
@@ -230,14 +317,18 @@ quantum_delete_qureg(quantum_reg *reg)
   if(reg->hashw && reg->hash)
     quantum_destroy_hash(reg);
 
+  quantum_delete_map(reg);
+
   free(reg->amplitude);
-  quantum_memman(-reg->size * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  -reg->size * quantum_amplitude_size(reg));
   reg->amplitude = 0;
 
   if(reg->state)
     {
       free(reg->state);
-      quantum_memman(-reg->size * sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      -reg->size * sizeof(MAX_UNSIGNED));
       reg->state = 0;
     }
 
@@ -248,14 +339,18 @@ quantum_delete_qureg(quantum_reg *reg)
 void
 quantum_delete_qureg_hashpreserve(quantum_reg *reg)
 {
+  quantum_delete_map(reg);
+
   free(reg->amplitude);
-  quantum_memman(-reg->size * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  -reg->size * quantum_amplitude_size(reg));
   reg->amplitude = 0;
 
   if(reg->state)
     {
       free(reg->state);
-      quantum_memman(-reg->size * sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      -reg->size * sizeof(MAX_UNSIGNED));
       reg->state = 0;
     }
 }
@@ -266,26 +361,43 @@ void
 quantum_copy_qureg(quantum_reg *src, quantum_reg *dst)
 {
   *dst = *src;
+
+  /* The copy is not recorded together with the original */
+
+  dst->recorder = 0;
   
   /* Allocate memory for basis states */
 
-  dst->amplitude = calloc(dst->size, sizeof(COMPLEX_FLOAT));
+  if(quantum_memman_exceeds(dst->size * (quantum_amplitude_size(src)
+					 + (src->state ? sizeof(MAX_UNSIGNED)
+					    : 0))
+			    + (dst->hashw ? (1 << dst->hashw) : 0) 
+			    * sizeof(int)))
+    quantum_error(QUANTUM_EBUDGET);
+
+  dst->amplitude = quantum_numa_calloc(dst->size,
+				       quantum_amplitude_size(src),
+				       QUANTUM_NUMA_LOCAL);
 
   if(!dst->amplitude)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(dst->size*sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  dst->size * quantum_amplitude_size(src));
 
-  memcpy(dst->amplitude, src->amplitude, src->size*sizeof(COMPLEX_FLOAT));
+  memcpy(dst->amplitude, src->amplitude,
+	 src->size * quantum_amplitude_size(src));
 
   if(src->state)
     {
-      dst->state = calloc(dst->size, sizeof(MAX_UNSIGNED));
+      dst->state = quantum_numa_calloc(dst->size, sizeof(MAX_UNSIGNED),
+				       QUANTUM_NUMA_LOCAL);
 
       if(!dst->state)
 	quantum_error(QUANTUM_ENOMEM);
       
-      quantum_memman(dst->size*sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      dst->size*sizeof(MAX_UNSIGNED));
 
       memcpy(dst->state, src->state, src->size*sizeof(MAX_UNSIGNED));
 
@@ -295,12 +407,20 @@ quantum_copy_qureg(quantum_reg *src, quantum_reg *dst)
 
   if(dst->hashw)
     {
-      dst->hash = calloc(1 << dst->hashw, sizeof(int));
+      dst->hash = quantum_numa_calloc(1 << dst->hashw, sizeof(int),
+				      QUANTUM_NUMA_RANDOM);
       
       if(!dst->hash)
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman((1 << dst->hashw) * sizeof(int));
+      quantum_memman_category(QUANTUM_MEM_HASH,
+			      (1 << dst->hashw) * sizeof(int));
+    }
+
+  if(src->map)
+    {
+      quantum_new_map(dst);
+      memcpy(dst->map, src->map, 8 * sizeof(MAX_UNSIGNED) * sizeof(int));
     }
 
 }
@@ -311,17 +431,21 @@ void
 quantum_print_qureg(quantum_reg reg)
 {
   int i,j;
+  MAX_UNSIGNED a;
+  complex double z;
   
   for(i=0; i<reg.size; i++)
     {
-      printf("% f %+fi|%llu> (%e) (|", quantum_real(reg.amplitude[i]),
-	     quantum_imag(reg.amplitude[i]), reg.state[i], 
-	     quantum_prob_inline(reg.amplitude[i]));
+      a = quantum_unmap_state(reg.state[i], &reg);
+      z = quantum_get_amplitude(&reg, i);
+
+      printf("% f %+fi|%llu> (%e) (|", quantum_real(z), quantum_imag(z), a, 
+	     quantum_prob_inline(z));
       for(j=reg.width-1;j>=0;j--)
 	{
 	  if(j % 4 == 3)
 	    printf(" ");
-	  printf("%i", ((((MAX_UNSIGNED) 1 << j) & reg.state[i]) > 0));
+	  printf("%i", ((((MAX_UNSIGNED) 1 << j) & a) > 0));
 	}
 
       printf(">)\n");
@@ -339,7 +463,8 @@ quantum_print_expn(quantum_reg reg)
   
   for(i=0; i<reg.size; i++)
     {
-      printf("%i: %lli\n", i, reg.state[i] - i * (1 << (reg.width / 2)));
+      printf("%i: %lli\n", i, quantum_unmap_state(reg.state[i], &reg) 
+	     - i * (1 << (reg.width / 2)));
     }
 }
 
@@ -359,6 +484,152 @@ quantum_addscratch(int bits, quantum_reg *reg)
       l = reg->state[i] << bits;
       reg->state[i] = l;
     }
+
+  /* The qubits move up together with their bits */
+
+  if(reg->map)
+    {
+      for(i=8*sizeof(MAX_UNSIGNED)-1; i>=bits; i--)
+	reg->map[i] = reg->map[i-bits] + bits;
+
+      for(i=0; i<bits; i++)
+	reg->map[i] = i;
+    }
+}
+
+/* Move the bits of all basis states, so that qubit Q is stored at bit
+   PERM[Q]. PERM has to be a permutation of the qubits of REG. This is
+   done classically and does not change the state of the register. */
+
+void
+quantum_remap(int *perm, quantum_reg *reg)
+{
+  int i, k, b, q;
+  int move[8*sizeof(MAX_UNSIGNED)];
+  MAX_UNSIGNED a, seen = 0;
+  MAX_UNSIGNED table[sizeof(MAX_UNSIGNED)][256];
+
+  quantum_pool_sync(reg);
+
+  for(q=0; q<reg->width; q++)
+    {
+      if(perm[q] < 0 || perm[q] >= reg->width 
+	 || (seen & ((MAX_UNSIGNED) 1 << perm[q])))
+	quantum_error(QUANTUM_EQUBITMAP);
+
+      seen |= (MAX_UNSIGNED) 1 << perm[q];
+    }
+
+  if(!reg->map)
+    quantum_new_map(reg);
+
+  /* Bit B of each basis state moves to bit MOVE[B] */
+
+  for(b=0; b<8*sizeof(MAX_UNSIGNED); b++)
+    move[b] = b;
+
+  for(q=0; q<reg->width; q++)
+    move[reg->map[q]] = perm[q];
+
+  for(q=0; q<reg->width; q++)
+    reg->map[q] = perm[q];
+
+  /* Dense registers have no basis states to move */
+
+  if(!reg->state)
+    return;
+
+  /* Look up the moved bits of a whole byte at once */
+
+  for(k=0; k<sizeof(MAX_UNSIGNED); k++)
+    {
+      for(i=0; i<256; i++)
+	{
+	  table[k][i] = 0;
+
+	  for(b=0; b<8; b++)
+	    {
+	      if(i & (1 << b))
+		table[k][i] |= (MAX_UNSIGNED) 1 << move[8*k+b];
+	    }
+	}
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for private (k, a) if (quantum_parallel(reg->size))
+#endif
+  for(i=0; i<reg->size; i++)
+    {
+      for(k=0, a=0; k<sizeof(MAX_UNSIGNED); k++)
+	a |= table[k][(reg->state[i] >> 8*k) & 255];
+
+      reg->state[i] = a;
+    }
+
+  quantum_reconstruct_hash(reg);
+}
+
+/* Move all qubits back to their own bits */
+
+void
+quantum_unmap(quantum_reg *reg)
+{
+  int q;
+  int perm[8*sizeof(MAX_UNSIGNED)];
+
+  if(!reg->map)
+    return;
+
+  for(q=0; (q < reg->width) && (reg->map[q] == q); q++);
+
+  if(q == reg->width)
+    return;
+
+  for(q=0; q<reg->width; q++)
+    perm[q] = q;
+
+  quantum_remap(perm, reg);
+}
+
+/* Convert a basis state given in the order of the qubits of REG into
+   its bits */
+
+MAX_UNSIGNED
+quantum_map_state(MAX_UNSIGNED a, quantum_reg *reg)
+{
+  int q;
+  MAX_UNSIGNED s = 0;
+
+  if(!reg->map)
+    return a;
+
+  for(q=0; q<8*sizeof(MAX_UNSIGNED); q++)
+    {
+      if(a & ((MAX_UNSIGNED) 1 << q))
+	s |= (MAX_UNSIGNED) 1 << reg->map[q];
+    }
+
+  return s;
+}
+
+/* Convert a basis state of REG back to the order of its qubits */
+
+MAX_UNSIGNED
+quantum_unmap_state(MAX_UNSIGNED a, quantum_reg *reg)
+{
+  int q;
+  MAX_UNSIGNED s = 0;
+
+  if(!reg->map)
+    return a;
+
+  for(q=0; q<8*sizeof(MAX_UNSIGNED); q++)
+    {
+      if(a & ((MAX_UNSIGNED) 1 << reg->map[q]))
+	s |= (MAX_UNSIGNED) 1 << q;
+    }
+
+  return s;
 }
 
 /* Print the hash table to stdout and test if the hash table is
@@ -385,28 +656,45 @@ quantum_kronecker(quantum_reg *reg1, quantum_reg *reg2)
 {
   int i,j;
   quantum_reg reg;
+
+  quantum_unmap(reg1);
+  quantum_unmap(reg2);
   
   reg.width = reg1->width+reg2->width;
   reg.size = reg1->size*reg2->size;
   reg.hashw = reg.width + 2;
+  reg.recorder = 0;
+  reg.map = 0;
+  reg.precision = 0;
+  reg.renormalized = 0;
 
   /* allocate memory for the new basis states */
 
-  reg.amplitude = calloc(reg.size, sizeof(COMPLEX_FLOAT));
-  reg.state = calloc(reg.size, sizeof(MAX_UNSIGNED));
+  if(quantum_memman_exceeds(reg.size * (sizeof(COMPLEX_FLOAT) 
+					+ sizeof(MAX_UNSIGNED))
+			    + (1 << reg.hashw) * sizeof(int)))
+    quantum_error(QUANTUM_EBUDGET);
+
+  reg.amplitude = quantum_numa_calloc(reg.size, sizeof(COMPLEX_FLOAT),
+				      QUANTUM_NUMA_LOCAL);
+  reg.state = quantum_numa_calloc(reg.size, sizeof(MAX_UNSIGNED),
+				  QUANTUM_NUMA_LOCAL);
 
   if(!(reg.state && reg.amplitude))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(reg.size * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  reg.size * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_STATE, reg.size * sizeof(MAX_UNSIGNED));
 
   /* Allocate the hash table */
 
-  reg.hash = calloc(1 << reg.hashw, sizeof(int));
+  reg.hash = quantum_numa_calloc(1 << reg.hashw, sizeof(int),
+				 QUANTUM_NUMA_RANDOM);
   if(!reg.hash)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman((1 << reg.hashw) * sizeof(int));
+  quantum_memman_category(QUANTUM_MEM_HASH, (1 << reg.hashw) * sizeof(int));
 
   for(i=0; i<reg1->size; i++)
     for(j=0; j<reg2->size; j++)
@@ -417,7 +705,8 @@ quantum_kronecker(quantum_reg *reg1, quantum_reg *reg2)
 
       reg.state[i*reg2->size+j] = ((reg1->state[i]) << reg2->width) 
 	| reg2->state[j];
-      reg.amplitude[i*reg2->size+j] = reg1->amplitude[i] * reg2->amplitude[j];
+      reg.amplitude[i*reg2->size+j] = quantum_get_amplitude(reg1, i)
+	* quantum_get_amplitude(reg2, j);
     }
 
   return reg;
@@ -434,6 +723,25 @@ quantum_state_collapse(int pos, int value, quantum_reg reg)
   MAX_UNSIGNED lpat=0, rpat=0, pos2;
   quantum_reg out;
 
+  /* From here on, POS is the bit holding the measured qubit */
+
+  out.map = 0;
+  out.precision = reg.precision;
+  out.renormalized = 0;
+
+  if(reg.map)
+    {
+      quantum_new_map(&out);
+
+      for(i=0, j=0; i<reg.width; i++)
+	{
+	  if(i != pos)
+	    out.map[j++] = reg.map[i] - (reg.map[i] > reg.map[pos]);
+	}
+      
+      pos = reg.map[pos];
+    }
+
   pos2 = (MAX_UNSIGNED) 1 << pos;
 
   /* Eradicate all amplitudes of base states which have been ruled out
@@ -443,25 +751,29 @@ quantum_state_collapse(int pos, int value, quantum_reg reg)
     {
       if(((reg.state[i] & pos2) && value) 
 	 || (!(reg.state[i] & pos2) && !value))
-	{
-	  d += quantum_prob_inline(reg.amplitude[i]);
-	  size++;
-	}
+	size++;
     }
 
+  d = quantum_kernel_probsum(&reg, pos2, value ? pos2 : 0);
+
   /* Build the new quantum register */
 
   out.width = reg.width-1;
   out.size = size;
-  out.amplitude = calloc(size, sizeof(COMPLEX_FLOAT));
-  out.state = calloc(size, sizeof(MAX_UNSIGNED));
+  out.amplitude = quantum_numa_calloc(size, quantum_amplitude_size(&reg),
+				      QUANTUM_NUMA_LOCAL);
+  out.state = quantum_numa_calloc(size, sizeof(MAX_UNSIGNED),
+				  QUANTUM_NUMA_LOCAL);
 
   if(!(out.state && out.amplitude))
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(size * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  size * quantum_amplitude_size(&reg));
+  quantum_memman_category(QUANTUM_MEM_STATE, size * sizeof(MAX_UNSIGNED));
   out.hashw = reg.hashw;
   out.hash = reg.hash;
+  out.recorder = reg.recorder;
 
   /* Determine the numbers of the new base states and norm the quantum
      register */
@@ -482,7 +794,8 @@ quantum_state_collapse(int pos, int value, quantum_reg reg)
 	  lpat &= reg.state[i];
 
 	  out.state[j] = (lpat >> 1) | rpat;
-	  out.amplitude[j] = reg.amplitude[i] * 1 / (float) sqrt(d);
+	  quantum_set_amplitude(&out, j, quantum_get_amplitude(&reg, i)
+				* 1 / (float) sqrt(d));
 	
 	  j++;
 	}
@@ -494,11 +807,14 @@ quantum_state_collapse(int pos, int value, quantum_reg reg)
 
 /* Compute the dot product of two quantum registers */
 
-COMPLEX_FLOAT
+complex double
 quantum_dot_product(quantum_reg *reg1, quantum_reg *reg2)
 {
   int i, j;
-  COMPLEX_FLOAT f = 0;
+  complex double f = 0;
+
+  quantum_unmap(reg1);
+  quantum_unmap(reg2);
 
   /* Check whether quantum registers are sorted */
   
@@ -512,7 +828,8 @@ quantum_dot_product(quantum_reg *reg1, quantum_reg *reg2)
 	  j = quantum_get_state(reg1->state[i], *reg2);
 
 	  if(j > -1) /* state exists in reg2 */
-	    f += quantum_conj(reg1->amplitude[i]) * reg2->amplitude[j];
+	    f += quantum_conj(quantum_get_amplitude(reg1, i))
+	      * quantum_get_amplitude(reg2, j);
 	}
     }
 
@@ -523,7 +840,8 @@ quantum_dot_product(quantum_reg *reg1, quantum_reg *reg2)
 	  j = quantum_get_state(i, *reg2);
 
 	  if(j > -1) /* state exists in reg2 */
-	    f += quantum_conj(reg1->amplitude[i]) * reg2->amplitude[j];
+	    f += quantum_conj(quantum_get_amplitude(reg1, i))
+	      * quantum_get_amplitude(reg2, j);
 	}
     }
       
@@ -533,11 +851,14 @@ quantum_dot_product(quantum_reg *reg1, quantum_reg *reg2)
 
 /* Same as above, but without complex conjugation */
 
-COMPLEX_FLOAT
+complex double
 quantum_dot_product_noconj(quantum_reg *reg1, quantum_reg *reg2)
 {
   int i, j;
-  COMPLEX_FLOAT f = 0;
+  complex double f = 0;
+
+  quantum_unmap(reg1);
+  quantum_unmap(reg2);
 
   /* Check whether quantum registers are sorted */
   
@@ -547,7 +868,8 @@ quantum_dot_product_noconj(quantum_reg *reg1, quantum_reg *reg2)
   if(!reg2->state)
     {
       for(i=0; i<reg1->size; i++)
-	f += reg1->amplitude[i] * reg2->amplitude[reg1->state[i]];
+	f += quantum_get_amplitude(reg1, i)
+	  * quantum_get_amplitude(reg2, reg1->state[i]);
     }
 
   else
@@ -557,7 +879,8 @@ quantum_dot_product_noconj(quantum_reg *reg1, quantum_reg *reg2)
 	  j = quantum_get_state(reg1->state[i], *reg2);
 
 	  if(j > -1) /* state exists in reg2 */
-	    f += reg1->amplitude[i] * reg2->amplitude[j];
+	    f += quantum_get_amplitude(reg1, i)
+	      * quantum_get_amplitude(reg2, j);
 	}
     }
 
@@ -576,6 +899,9 @@ quantum_vectoradd(quantum_reg *reg1, quantum_reg *reg2)
   int addsize = 0;
   quantum_reg reg;
 
+  quantum_unmap(reg1);
+  quantum_unmap(reg2);
+
   quantum_copy_qureg(reg1, &reg);
   
   if(reg1->hashw || reg2->hashw)
@@ -594,15 +920,23 @@ quantum_vectoradd(quantum_reg *reg1, quantum_reg *reg2)
 
   if(addsize)
     {
+      if(quantum_memman_exceeds(addsize * (quantum_amplitude_size(&reg)
+					   + sizeof(MAX_UNSIGNED))))
+	quantum_error(QUANTUM_EBUDGET);
+
       reg.size += addsize;
 
-      reg.amplitude = realloc(reg.amplitude, reg.size*sizeof(COMPLEX_FLOAT));
+      reg.amplitude = realloc(reg.amplitude,
+			      reg.size * quantum_amplitude_size(&reg));
       reg.state = realloc(reg.state, reg.size*sizeof(MAX_UNSIGNED));
 
       if(!(reg.state && reg.amplitude))
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(addsize * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      addsize * quantum_amplitude_size(&reg));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      addsize * sizeof(MAX_UNSIGNED));
     }
 
   k = reg1->size;
@@ -610,7 +944,8 @@ quantum_vectoradd(quantum_reg *reg1, quantum_reg *reg2)
   if(!reg2->state)
     {
       for(i=0; i<reg2->size; i++)
-	reg.amplitude[i] += reg2->amplitude[i];
+	quantum_set_amplitude(&reg, i, quantum_get_amplitude(&reg, i)
+			      + quantum_get_amplitude(reg2, i));
     }
 
   else
@@ -620,12 +955,13 @@ quantum_vectoradd(quantum_reg *reg1, quantum_reg *reg2)
 	  j = quantum_get_state(reg2->state[i], *reg1);
 	  
 	  if(j >= 0)
-	    reg.amplitude[j] += reg2->amplitude[i];
+	    quantum_set_amplitude(&reg, j, quantum_get_amplitude(&reg, j)
+				  + quantum_get_amplitude(reg2, i));
 
 	  else
 	    {
 	      reg.state[k] = reg2->state[i];
-	      reg.amplitude[k] = reg2->amplitude[i];
+	      quantum_set_amplitude(&reg, k, quantum_get_amplitude(reg2, i));
 	      k++;
 	    }
 	}
@@ -643,6 +979,9 @@ quantum_vectoradd_inplace(quantum_reg *reg1, quantum_reg *reg2)
   int i, j, k;
   int addsize = 0;
 
+  quantum_unmap(reg1);
+  quantum_unmap(reg2);
+
   if(reg1->hashw || reg2->hashw)
     {
       quantum_reconstruct_hash(reg1);
@@ -661,15 +1000,22 @@ quantum_vectoradd_inplace(quantum_reg *reg1, quantum_reg *reg2)
 
       /* Allocate memory for basis states */
 
-      reg1->amplitude = realloc(reg1->amplitude, 
-				(reg1->size+addsize)*sizeof(COMPLEX_FLOAT));
+      if(quantum_memman_exceeds(addsize * (quantum_amplitude_size(reg1)
+					   + sizeof(MAX_UNSIGNED))))
+	quantum_error(QUANTUM_EBUDGET);
+
+      reg1->amplitude = realloc(reg1->amplitude, (reg1->size+addsize)
+				* quantum_amplitude_size(reg1));
       reg1->state = realloc(reg1->state, (reg1->size+addsize)
 			    *sizeof(MAX_UNSIGNED));
 
       if(!(reg1->state && reg1->amplitude))
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(addsize * (sizeof(COMPLEX_FLOAT) + sizeof(MAX_UNSIGNED)));
+      quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			      addsize * quantum_amplitude_size(reg1));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      addsize * sizeof(MAX_UNSIGNED));
 
     }
 
@@ -678,7 +1024,8 @@ quantum_vectoradd_inplace(quantum_reg *reg1, quantum_reg *reg2)
   if(!reg2->state)
     {
       for(i=0; i<reg2->size; i++)
-	reg1->amplitude[i] += reg2->amplitude[i];
+	quantum_set_amplitude(reg1, i, quantum_get_amplitude(reg1, i)
+			      + quantum_get_amplitude(reg2, i));
     }
 
   else
@@ -688,12 +1035,13 @@ quantum_vectoradd_inplace(quantum_reg *reg1, quantum_reg *reg2)
 	  j = quantum_get_state(reg2->state[i], *reg1);
 
 	  if(j >= 0)
-	    reg1->amplitude[j] += reg2->amplitude[i];
+	    quantum_set_amplitude(reg1, j, quantum_get_amplitude(reg1, j)
+				  + quantum_get_amplitude(reg2, i));
 
 	  else
 	    {
 	      reg1->state[k] = reg2->state[i];
-	      reg1->amplitude[k] = reg2->amplitude[i];
+	      quantum_set_amplitude(reg1, k, quantum_get_amplitude(reg2, i));
 	      k++;
 	    }
 	}
@@ -717,38 +1065,53 @@ quantum_matrix_qureg(quantum_reg A(MAX_UNSIGNED, double), double t,
   quantum_reg reg2;
   quantum_reg tmp;
 
+  /* The rows are multiplied in parallel, so REG must not be unmapped
+     by each of them */
+
+  quantum_unmap(reg);
+
   reg2.width = reg->width;
   reg2.size = reg->size;
   reg2.hashw = 0;
   reg2.hash = 0;
-
-  reg2.amplitude = calloc(reg2.size, sizeof(COMPLEX_FLOAT));
+  reg2.recorder = 0;
+  reg2.map = 0;
+  reg2.precision = reg->precision;
+  reg2.renormalized = 0;
+
+  reg2.amplitude = quantum_numa_calloc(reg2.size,
+				       quantum_amplitude_size(&reg2),
+				       QUANTUM_NUMA_LOCAL);
   reg2.state = 0;
 
   if(!reg2.amplitude)
     quantum_error(QUANTUM_ENOMEM);
 
-  quantum_memman(reg2.size * sizeof(COMPLEX_FLOAT));
+  quantum_memman_category(QUANTUM_MEM_AMPLITUDE,
+			  reg2.size * quantum_amplitude_size(&reg2));
 
   if(reg->state)
     {
-      reg2.state = calloc(reg2.size, sizeof(MAX_UNSIGNED));
+      reg2.state = quantum_numa_calloc(reg2.size, sizeof(MAX_UNSIGNED),
+				       QUANTUM_NUMA_LOCAL);
 
       if(!reg2.state)
 	quantum_error(QUANTUM_ENOMEM);
 
-      quantum_memman(reg2.size * sizeof(MAX_UNSIGNED));
+      quantum_memman_category(QUANTUM_MEM_STATE,
+			      reg2.size * sizeof(MAX_UNSIGNED));
     }
 
 #ifdef _OPENMP
-  #pragma omp parallel for private (tmp)
+#pragma omp parallel for private (tmp) \
+  if (quantum_parallel((long) reg->size * reg->size))
 #endif
   for(i=0; i<reg->size; i++)
     {
       if(reg2.state)
 	reg2.state[i] = i;
       tmp = A(i, t);
-      reg2.amplitude[i] = quantum_dot_product_noconj(&tmp, reg);
+      quantum_set_amplitude(&reg2, i, quantum_dot_product_noconj(&tmp, reg));
       if(!(flags & 1))
 	quantum_delete_qureg(&tmp);
     }
@@ -764,11 +1127,14 @@ quantum_mvmult(quantum_reg *y, quantum_matrix A, quantum_reg *x)
 {
   int i, j;
 
+  complex double z;
+
   for(i=0; i<A.cols; i++)
     {
-      y->amplitude[i] = 0;
+      z = 0;
       for(j=0; j<A.cols; j++)
-	y->amplitude[i] += M(A, j, i)*x->amplitude[j];
+	z += M(A, j, i) * quantum_get_amplitude(x, j);
+      quantum_set_amplitude(y, i, z);
     }
 } 
 
@@ -778,12 +1144,9 @@ quantum_mvmult(quantum_reg *y, quantum_matrix A, quantum_reg *x)
    if you know what you are doing. */
 
 void
-quantum_scalar_qureg(COMPLEX_FLOAT r, quantum_reg *reg)
+quantum_scalar_qureg(complex double r, quantum_reg *reg)
 {
-  int i;
-  
-  for(i=0; i<reg->size; i++)
-      reg->amplitude[i] *= r;
+  quantum_kernel_phase(reg, 0, 0, 0, r, 1);
 }
 
 /* Print the time evolution matrix for a series of gates */
@@ -801,8 +1164,13 @@ quantum_print_timeop(int width, void f(quantum_reg *))
     {
       tmp = quantum_new_qureg(i, width);
       f(&tmp);
+
+      /* F may have moved the qubits to other bits */
+
+      quantum_unmap(&tmp);
+
       for(j=0; j<tmp.size; j++)
-	M(m, tmp.state[j], i) = tmp.amplitude[j];
+	M(m, tmp.state[j], i) = quantum_get_amplitude(&tmp, j);
 
       quantum_delete_qureg(&tmp);
 	  
@@ -819,11 +1187,9 @@ quantum_print_timeop(int width, void f(quantum_reg *))
 void
 quantum_normalize(quantum_reg *reg)
 {
-  int i;
-  double r = 0;
+  double r;
 
-  for(i=0; i<reg->size; i++)
-    r += quantum_prob(reg->amplitude[i]);
+  r = quantum_kernel_probsum(reg, 0, 0);
 
   quantum_scalar_qureg(1./sqrt(r), reg);
 
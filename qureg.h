@@ -26,6 +26,7 @@
 #define __QUREG_H
 
 #include <sys/types.h>
+#include <complex.h>
 
 #include "config.h"
 #include "matrix.h"
@@ -41,6 +42,10 @@ struct quantum_reg_struct
   COMPLEX_FLOAT *amplitude;
   MAX_UNSIGNED *state;
   int *hash;
+  struct quantum_objcode_recorder_struct *recorder; /* attached recorder */
+  int *map;     /* bit position of each qubit, 0 if unchanged */
+  int precision; /* type of the amplitudes, 0 for COMPLEX_FLOAT */
+  int renormalized; /* gates since the last renormalization */
 };
 
 typedef struct quantum_reg_struct quantum_reg;
@@ -60,6 +65,12 @@ extern void quantum_print_expn(quantum_reg reg);
 
 extern void quantum_addscratch(int bits, quantum_reg *reg);
 
+extern void quantum_new_map(quantum_reg *reg);
+extern void quantum_remap(int *perm, quantum_reg *reg);
+extern void quantum_unmap(quantum_reg *reg);
+extern MAX_UNSIGNED quantum_map_state(MAX_UNSIGNED a, quantum_reg *reg);
+extern MAX_UNSIGNED quantum_unmap_state(MAX_UNSIGNED a, quantum_reg *reg);
+
 extern void quantum_print_hash(quantum_reg reg);
 
 extern quantum_reg quantum_kronecker(quantum_reg *reg1, quantum_reg *reg2);
@@ -67,12 +78,13 @@ extern quantum_reg quantum_kronecker(quantum_reg *reg1, quantum_reg *reg2);
 extern quantum_reg quantum_state_collapse(int bit, int value, 
 					  quantum_reg reg);
 
-extern COMPLEX_FLOAT quantum_dot_product(quantum_reg *reg1, quantum_reg *reg2);
+extern complex double quantum_dot_product(quantum_reg *reg1,
+					  quantum_reg *reg2);
 extern quantum_reg quantum_vectoradd(quantum_reg *reg1, quantum_reg *reg2);
 extern void quantum_vectoradd_inplace(quantum_reg *reg1, quantum_reg *reg2);
 extern quantum_reg quantum_matrix_qureg(quantum_reg A(MAX_UNSIGNED, double),
 					double t, quantum_reg *reg, int flags);
-extern void quantum_scalar_qureg(COMPLEX_FLOAT r, quantum_reg *reg);
+extern void quantum_scalar_qureg(complex double r, quantum_reg *reg);
 extern void quantum_mvmult(quantum_reg *y, quantum_matrix A, quantum_reg *x);
 
 extern void quantum_print_timeop(int width, void f(quantum_reg *));
@@ -93,6 +105,17 @@ quantum_hash64(MAX_UNSIGNED key, int width)
   return k32;
 }
 
+/* Return the bit of the basis states that holds qubit Q */
+
+static inline int
+quantum_qubit(int q, quantum_reg *reg)
+{
+  if(reg->map && q < 8 * sizeof(MAX_UNSIGNED))
+    return reg->map[q];
+
+  return q;
+}
+
 /* Get the position of a given base state via the hash table */
 
 static inline int
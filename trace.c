@@ -0,0 +1,172 @@
+/* trace.c: Trace of the register size
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "objcode.h"
+#include "qureg.h"
+#include "precision.h"
+#include "qcomplex.h"
+#include "config.h"
+
+/* Status of the trace (0 = disabled) */
+
+int quantum_trace_status = 0;
+
+/* File the trace is written to and the number of records so far */
+
+static FILE *tracefile = 0;
+static unsigned long traceindex = 0;
+
+/* Number of basis states removed by the current gate. Every thread
+   applies its gates on its own, so the counter is private to it. */
+
+static int pruned = 0;
+
+#ifdef _OPENMP
+#pragma omp threadprivate(pruned)
+#endif
+
+/* Start writing the trace to FILE. Returns -1 on error. */
+
+int
+quantum_trace_start(char *file)
+{
+  FILE *f;
+
+  quantum_trace_stop();
+
+  f = fopen(file, "w");
+
+  if(!f)
+    {
+      fprintf(stderr, "Could not open %s: ", file);
+      perror(0);
+      return -1;
+    }
+
+  fprintf(f, "index,operation,width,size,load,pruned,bytes\n");
+
+#ifdef _OPENMP
+#pragma omp critical (quantum_trace)
+#endif
+  {
+    tracefile = f;
+    traceindex = 0;
+  }
+
+  quantum_trace_status = 1;
+
+  return 0;
+}
+
+/* Finish the trace. Gates recorded by other threads at the same time
+   are either written before the file is closed or dropped. */
+
+void
+quantum_trace_stop()
+{
+  quantum_trace_status = 0;
+
+#ifdef _OPENMP
+#pragma omp critical (quantum_trace)
+#endif
+  {
+    if(tracefile)
+      fclose(tracefile);
+
+    tracefile = 0;
+  }
+}
+
+/* Note that N basis states have been removed from a register */
+
+void
+quantum_trace_prune(int n)
+{
+  pruned += n;
+}
+
+/* Append a record for OPERATION, which has just been applied to REG */
+
+void
+quantum_trace_record(int operation, quantum_reg *reg)
+{
+  double load = 0;
+  unsigned long long bytes;
+
+  /* The load factor is only meaningful for sparse registers */
+
+  if(reg->hashw)
+    load = (double) reg->size / ((unsigned long long) 1 << reg->hashw);
+
+  bytes = (unsigned long long) reg->size * quantum_amplitude_size(reg);
+
+  if(reg->state)
+    bytes += (unsigned long long) reg->size * sizeof(MAX_UNSIGNED);
+
+  if(reg->hash)
+    bytes += ((unsigned long long) 1 << reg->hashw) * sizeof(int);
+
+#ifdef _OPENMP
+#pragma omp critical (quantum_trace)
+#endif
+  {
+    if(tracefile)
+      fprintf(tracefile, "%lu,%s,%i,%i,%.4f,%i,%llu\n", traceindex++,
+	      quantum_objcode_opname(operation), reg->width, reg->size, load,
+	      pruned, bytes);
+  }
+
+  pruned = 0;
+}
+
+/* This function is used as a hook before exiting when the trace has
+   been enabled with the QUANTUM_TRACE environment variable */
+
+static void
+quantum_trace_exit()
+{
+  quantum_trace_stop();
+}
+
+/* Enable the trace if the QUANTUM_TRACE environment variable is set to
+   a file name */
+
+void
+quantum_trace_env()
+{
+  static int done = 0;
+  char *c;
+
+  if(done)
+    return;
+
+  done = 1;
+  c = getenv("QUANTUM_TRACE");
+
+  if(c && *c && !quantum_trace_start(c))
+    atexit(quantum_trace_exit);
+}
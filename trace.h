@@ -0,0 +1,38 @@
+/* trace.h: Declarations for trace.c
+
+   Copyright 2013 Bjoern Butscher, Hendrik Weimer
+
+   This file is part of libquantum
+
+   libquantum is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published
+   by the Free Software Foundation; either version 3 of the License,
+   or (at your option) any later version.
+
+   libquantum is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libquantum; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02110-1301, USA
+
+*/
+
+#ifndef __TRACE_H
+
+#define __TRACE_H
+
+#include "qureg.h"
+
+extern int quantum_trace_status;
+
+extern int quantum_trace_start(char *file);
+extern void quantum_trace_stop();
+extern void quantum_trace_prune(int n);
+extern void quantum_trace_record(int operation, quantum_reg *reg);
+extern void quantum_trace_env();
+
+#endif